@@ -37,6 +37,7 @@ type
   TCTMfloat = Single;
   TCTMint = Integer;
   TCTMuint = Cardinal;
+  TCTMuint64 = UInt64;
   TCTMcontext = Pointer;
   TCTMenum = Cardinal;
 
@@ -48,6 +49,8 @@ type
   // Callback function pointer types
   TCTMreadfn = function (ABuf: Pointer; ACount: TCTMuint; AUserData: Pointer): TCTMuint; stdcall;
   TCTMwritefn = function (ABuf: Pointer; ACount: TCTMuint; AUserData: Pointer): TCTMuint; stdcall;
+  TCTMallocfn = function (ASize: NativeUInt; AUserData: Pointer): Pointer; stdcall;
+  TCTMfreefn = procedure (APtr: Pointer; AUserData: Pointer); stdcall;
 
 
 //------------------------------------------------------------------------------
@@ -76,6 +79,10 @@ const
   CTM_METHOD_RAW        = $0201;
   CTM_METHOD_MG1        = $0202;
   CTM_METHOD_MG2        = $0203;
+  CTM_SKIP_NORMALS      = $1000;
+  CTM_SKIP_UV_MAPS      = $2000;
+  CTM_SKIP_ATTRIBS      = $4000;
+  CTM_LAZY_LOAD         = $8000;
   CTM_VERTEX_COUNT      = $0301;
   CTM_TRIANGLE_COUNT    = $0302;
   CTM_HAS_NORMALS       = $0303;
@@ -85,12 +92,20 @@ const
   CTM_NORMAL_PRECISION  = $0307;
   CTM_COMPRESSION_METHOD = $0308;
   CTM_FILE_COMMENT      = $0309;
+  CTM_STREAM_BUFFER_SIZE = $030A;
+  CTM_LOAD_OPTIONS      = $030B;
+  CTM_THREAD_COUNT      = $030C;
+  CTM_COMPRESSION_THREADS = $030D;
+  CTM_PEAK_MEMORY = $030E;
+  CTM_MEMORY_USAGE = $030F;
+  CTM_MEMORY_LIMIT = $0310;
   CTM_NAME              = $0501;
   CTM_FILE_NAME         = $0502;
   CTM_PRECISION         = $0503;
   CTM_INDICES           = $0601;
   CTM_VERTICES          = $0602;
   CTM_NORMALS           = $0603;
+  CTM_AABB              = $0604;
   CTM_UV_MAP_1          = $0700;
   CTM_UV_MAP_2          = $0701;
   CTM_UV_MAP_3          = $0702;
@@ -118,6 +133,7 @@ procedure ctmFreeContext(AContext: TCTMcontext); stdcall;
 function ctmGetError(AContext: TCTMcontext): TCTMenum; stdcall;
 function ctmErrorString(AError: TCTMenum): PChar; stdcall;
 function ctmGetInteger(AContext: TCTMcontext; AProperty: TCTMenum): TCTMuint; stdcall;
+function ctmGetInteger64(AContext: TCTMcontext; AProperty: TCTMenum): TCTMuint64; stdcall;
 function ctmGetFloat(AContext: TCTMcontext; AProperty: TCTMenum): TCTMfloat; stdcall;
 function ctmGetIntegerArray(AContext: TCTMcontext; AProperty: TCTMenum): PCTMuint; stdcall;
 function ctmGetFloatArray(AContext: TCTMcontext; AProperty: TCTMenum): PCTMfloat; stdcall;
@@ -130,17 +146,27 @@ function ctmGetAttribMapFloat(AContext: TCTMcontext; AAttribMap: TCTMenum; AProp
 function ctmGetString(AContext: TCTMcontext; AProperty: TCTMenum): PChar; stdcall;
 procedure ctmCompressionMethod(AContext: TCTMcontext; AMethod: TCTMenum); stdcall;
 procedure ctmCompressionLevel(AContext: TCTMcontext; ALevel: TCTMuint); stdcall;
+procedure ctmCompressionThreads(AContext: TCTMcontext; AThreads: TCTMuint); stdcall;
 procedure ctmVertexPrecision(AContext: TCTMcontext; APrecision: TCTMfloat); stdcall;
 procedure ctmVertexPrecisionRel(AContext: TCTMcontext; ARelPrecision: TCTMfloat); stdcall;
 procedure ctmNormalPrecision(AContext: TCTMcontext; APrecision: TCTMfloat); stdcall;
 procedure ctmUVCoordPrecision(AContext: TCTMcontext; AUVMap: TCTMenum; APrecision: TCTMfloat); stdcall;
 procedure ctmAttribPrecision(AContext: TCTMcontext; AAttribMap: TCTMenum; APrecision: TCTMfloat); stdcall;
 procedure ctmFileComment(AContext: TCTMcontext; AFileComment: PChar); stdcall;
+procedure ctmStreamBufferSize(AContext: TCTMcontext; ASize: TCTMuint); stdcall;
+procedure ctmThreadCount(AContext: TCTMcontext; ACount: TCTMuint); stdcall;
+procedure ctmAllocator(AContext: TCTMcontext; AAllocFn: TCTMallocfn; AFreeFn: TCTMfreefn; AUserData: Pointer); stdcall;
+procedure ctmMemoryLimit(AContext: TCTMcontext; ALimit: NativeUInt); stdcall;
+procedure ctmLoadOptions(AContext: TCTMcontext; AOptions: TCTMuint); stdcall;
 procedure ctmDefineMesh(AContext: TCTMcontext; AVertices: PCTMfloat; AVertexCount: TCTMuint; AIndices: PCTMuint; ATriangleCount: TCTMuint; ANormals: PCTMfloat); stdcall;
+procedure ctmDefineMesh64(AContext: TCTMcontext; AVertices: PCTMfloat; AVertexCount: TCTMuint64; AIndices: PCTMuint; ATriangleCount: TCTMuint64; ANormals: PCTMfloat); stdcall;
 function ctmAddUVMap(AContext: TCTMcontext; AUVCoords: PCTMfloat; AName: PChar; AFileName: PChar): TCTMenum; stdcall;
 function ctmAddAttribMap(AContext: TCTMcontext; AAttribValues: PCTMfloat; AName: PChar): TCTMenum; stdcall;
 procedure ctmLoad(AContext: TCTMcontext; AFileName: PChar); stdcall;
 procedure ctmLoadCustom(AContext: TCTMcontext; AReadFn: TCTMreadfn; AUserData: Pointer); stdcall;
+procedure ctmLoadMapped(AContext: TCTMcontext; AFileName: PChar); stdcall;
+procedure ctmLoadHeader(AContext: TCTMcontext; AFileName: PChar); stdcall;
+procedure ctmLoadHeaderCustom(AContext: TCTMcontext; AReadFn: TCTMreadfn; AUserData: Pointer); stdcall;
 procedure ctmSave(AContext: TCTMcontext; AFileName: PChar); stdcall;
 procedure ctmSaveCustom(AContext: TCTMcontext; AWriteFn: TCTMwritefn; AUserData: Pointer); stdcall;
 
@@ -159,6 +185,7 @@ procedure ctmFreeContext; external DLLNAME;
 function ctmGetError; external DLLNAME;
 function ctmErrorString; external DLLNAME;
 function ctmGetInteger; external DLLNAME;
+function ctmGetInteger64; external DLLNAME;
 function ctmGetFloat; external DLLNAME;
 function ctmGetIntegerArray; external DLLNAME;
 function ctmGetFloatArray; external DLLNAME;
@@ -171,17 +198,27 @@ function ctmGetAttribMapFloat; external DLLNAME;
 function ctmGetString; external DLLNAME;
 procedure ctmCompressionMethod; external DLLNAME;
 procedure ctmCompressionLevel; external DLLNAME;
+procedure ctmCompressionThreads; external DLLNAME;
 procedure ctmVertexPrecision; external DLLNAME;
 procedure ctmVertexPrecisionRel; external DLLNAME;
 procedure ctmNormalPrecision; external DLLNAME;
 procedure ctmUVCoordPrecision; external DLLNAME;
 procedure ctmAttribPrecision; external DLLNAME;
 procedure ctmFileComment; external DLLNAME;
+procedure ctmStreamBufferSize; external DLLNAME;
+procedure ctmThreadCount; external DLLNAME;
+procedure ctmAllocator; external DLLNAME;
+procedure ctmMemoryLimit; external DLLNAME;
+procedure ctmLoadOptions; external DLLNAME;
 procedure ctmDefineMesh; external DLLNAME;
+procedure ctmDefineMesh64; external DLLNAME;
 function ctmAddUVMap; external DLLNAME;
 function ctmAddAttribMap; external DLLNAME;
 procedure ctmLoad; external DLLNAME;
 procedure ctmLoadCustom; external DLLNAME;
+procedure ctmLoadMapped; external DLLNAME;
+procedure ctmLoadHeader; external DLLNAME;
+procedure ctmLoadHeaderCustom; external DLLNAME;
 procedure ctmSave; external DLLNAME;
 procedure ctmSaveCustom; external DLLNAME;
 
@@ -35,14 +35,18 @@ var ffi = require('ffi');
 var CTMfloat = ref.types.float;
 var CTMint = ref.types.int32;
 var CTMuint = ref.types.uint32;
+var CTMuint64 = ref.types.uint64;
 var CTMcontext = ref.refType(ref.types.void);
 var CTMenum = ref.types.uint32;
 var CTMreadfn = ref.refType(ref.types.void);
 var CTMwritefn = ref.refType(ref.types.void);
+var CTMallocfn = ref.refType(ref.types.void);
+var CTMfreefn = ref.refType(ref.types.void);
 
 exports.CTMfloat = CTMfloat;
 exports.CTMint = CTMint;
 exports.CTMuint = CTMuint;
+exports.CTMuint64 = CTMuint64;
 exports.CTMcontext = CTMcontext;
 exports.CTMenum = CTMenum;
 
@@ -68,6 +72,10 @@ exports.CTM_EXPORT = 0x0102;
 exports.CTM_METHOD_RAW = 0x0201;
 exports.CTM_METHOD_MG1 = 0x0202;
 exports.CTM_METHOD_MG2 = 0x0203;
+exports.CTM_SKIP_NORMALS = 0x1000;
+exports.CTM_SKIP_UV_MAPS = 0x2000;
+exports.CTM_SKIP_ATTRIBS = 0x4000;
+exports.CTM_LAZY_LOAD = 0x8000;
 exports.CTM_VERTEX_COUNT = 0x0301;
 exports.CTM_TRIANGLE_COUNT = 0x0302;
 exports.CTM_HAS_NORMALS = 0x0303;
@@ -77,12 +85,20 @@ exports.CTM_VERTEX_PRECISION = 0x0306;
 exports.CTM_NORMAL_PRECISION = 0x0307;
 exports.CTM_COMPRESSION_METHOD = 0x0308;
 exports.CTM_FILE_COMMENT = 0x0309;
+exports.CTM_STREAM_BUFFER_SIZE = 0x030A;
+exports.CTM_LOAD_OPTIONS = 0x030B;
+exports.CTM_THREAD_COUNT = 0x030C;
+exports.CTM_COMPRESSION_THREADS = 0x030D;
+exports.CTM_PEAK_MEMORY = 0x030E;
+exports.CTM_MEMORY_USAGE = 0x030F;
+exports.CTM_MEMORY_LIMIT = 0x0310;
 exports.CTM_NAME = 0x0501;
 exports.CTM_FILE_NAME = 0x0502;
 exports.CTM_PRECISION = 0x0503;
 exports.CTM_INDICES = 0x0601;
 exports.CTM_VERTICES = 0x0602;
 exports.CTM_NORMALS = 0x0603;
+exports.CTM_AABB = 0x0604;
 exports.CTM_UV_MAP_1 = 0x0700;
 exports.CTM_UV_MAP_2 = 0x0701;
 exports.CTM_UV_MAP_3 = 0x0702;
@@ -112,6 +128,7 @@ var openctm = ffi.Library(libname, {
     'ctmGetError' : [CTMenum, [CTMcontext]],
     'ctmErrorString' : [ref.types.CString, [CTMenum]],
     'ctmGetInteger' : [CTMint, [CTMcontext, CTMenum]],
+    'ctmGetInteger64' : [CTMuint64, [CTMcontext, CTMenum]],
     'ctmGetFloat' : [CTMfloat, [CTMcontext, CTMenum]],
     'ctmGetIntegerArray' : [ref.refType(CTMuint), [CTMcontext, CTMenum]],
     'ctmGetFloatArray' : [ref.refType(CTMfloat), [CTMcontext, CTMenum]],
@@ -124,13 +141,21 @@ var openctm = ffi.Library(libname, {
     'ctmGetString' : [ref.types.CString, [CTMcontext, CTMenum]],
     'ctmCompressionMethod' : ['void', [CTMcontext, CTMenum]],
     'ctmCompressionLevel' : ['void', [CTMcontext, CTMuint]],
+    'ctmCompressionThreads' : ['void', [CTMcontext, CTMuint]],
     'ctmVertexPrecision' : ['void', [CTMcontext, CTMfloat]],
     'ctmVertexPrecisionRel' : ['void', [CTMcontext, CTMfloat]],
     'ctmNormalPrecision' : ['void', [CTMcontext, CTMfloat]],
     'ctmUVCoordPrecision' : ['void', [CTMcontext, CTMenum, CTMfloat]],
     'ctmAttribPrecision' : ['void', [CTMcontext, CTMenum, CTMfloat]],
     'ctmFileComment' : ['void', [CTMcontext, ref.types.CString]],
+    'ctmStreamBufferSize' : ['void', [CTMcontext, CTMuint]],
+    'ctmThreadCount' : ['void', [CTMcontext, CTMuint]],
+    'ctmAllocator' : ['void', [CTMcontext, CTMallocfn, CTMfreefn, 'void *']],
+    'ctmMemoryLimit' : ['void', [CTMcontext, ref.types.size_t]],
+    'ctmLoadOptions' : ['void', [CTMcontext, CTMuint]],
+    'ctmLoadDestination' : ['void', [CTMcontext, CTMenum, 'void *', ref.types.size_t, CTMuint, CTMuint]],
     'ctmDefineMesh' : ['void', [CTMcontext, ref.refType(CTMfloat), CTMuint, ref.refType(CTMuint), CTMuint, ref.refType(CTMfloat)]],
+    'ctmDefineMesh64' : ['void', [CTMcontext, ref.refType(CTMfloat), CTMuint64, ref.refType(CTMuint), CTMuint64, ref.refType(CTMfloat)]],
     'ctmAddUVMap' : [CTMenum, [CTMcontext, ref.refType(CTMfloat), ref.types.CString, ref.types.CString]],
     'ctmAddAttribMap' : [CTMenum, [CTMcontext, ref.refType(CTMfloat), ref.types.CString]],
     'ctmLoad' : ['void', [CTMcontext, ref.types.CString]],
@@ -139,7 +164,11 @@ var openctm = ffi.Library(libname, {
     'ctmSaveCustom' : ['void', [CTMcontext, CTMwritefn, 'void *']],
     // extension
     'ctmSaveToBuffer' : ['void *', [CTMcontext, ref.refType(ref.types.size_t)]],
-    'ctmFreeBuffer' : ['void', ['void *']]
+    'ctmFreeBuffer' : ['void', ['void *']],
+    'ctmLoadFromMemory' : ['void', [CTMcontext, 'void *', ref.types.size_t]],
+    'ctmLoadMapped' : ['void', [CTMcontext, ref.types.CString]],
+    'ctmLoadHeader' : ['void', [CTMcontext, ref.types.CString]],
+    'ctmLoadHeaderCustom' : ['void', [CTMcontext, CTMreadfn, 'void *']]
 });
 
 for (name in openctm) {
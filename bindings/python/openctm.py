@@ -35,6 +35,7 @@ from ctypes.util import find_library
 CTMfloat = c_float
 CTMint = c_int32
 CTMuint = c_uint32
+CTMuint64 = c_uint64
 CTMcontext = c_void_p
 CTMenum = c_uint32
 
@@ -60,6 +61,10 @@ CTM_EXPORT = 0x0102
 CTM_METHOD_RAW = 0x0201
 CTM_METHOD_MG1 = 0x0202
 CTM_METHOD_MG2 = 0x0203
+CTM_SKIP_NORMALS = 0x1000
+CTM_SKIP_UV_MAPS = 0x2000
+CTM_SKIP_ATTRIBS = 0x4000
+CTM_LAZY_LOAD = 0x8000
 CTM_VERTEX_COUNT = 0x0301
 CTM_TRIANGLE_COUNT = 0x0302
 CTM_HAS_NORMALS = 0x0303
@@ -69,12 +74,20 @@ CTM_VERTEX_PRECISION = 0x0306
 CTM_NORMAL_PRECISION = 0x0307
 CTM_COMPRESSION_METHOD = 0x0308
 CTM_FILE_COMMENT = 0x0309
+CTM_STREAM_BUFFER_SIZE = 0x030A
+CTM_LOAD_OPTIONS = 0x030B
+CTM_THREAD_COUNT = 0x030C
+CTM_COMPRESSION_THREADS = 0x030D
+CTM_PEAK_MEMORY = 0x030E
+CTM_MEMORY_USAGE = 0x030F
+CTM_MEMORY_LIMIT = 0x0310
 CTM_NAME = 0x0501
 CTM_FILE_NAME = 0x0502
 CTM_PRECISION = 0x0503
 CTM_INDICES = 0x0601
 CTM_VERTICES = 0x0602
 CTM_NORMALS = 0x0603
+CTM_AABB = 0x0604
 CTM_UV_MAP_1 = 0x0700
 CTM_UV_MAP_2 = 0x0701
 CTM_UV_MAP_3 = 0x0702
@@ -116,6 +129,14 @@ else:
 if not _lib:
     raise Exception('Could not open the OpenCTM shared library.')
 
+# Callback function types
+if os.name == 'nt':
+    _CTMFUNCTYPE = WINFUNCTYPE
+else:
+    _CTMFUNCTYPE = CFUNCTYPE
+CTMallocfn = _CTMFUNCTYPE(c_void_p, c_size_t, c_void_p)
+CTMfreefn = _CTMFUNCTYPE(None, c_void_p, c_void_p)
+
 # Functions
 ctmNewContext = _lib.ctmNewContext
 ctmNewContext.argtypes = [CTMenum]
@@ -136,6 +157,10 @@ ctmGetInteger = _lib.ctmGetInteger
 ctmGetInteger.argtypes = [CTMcontext, CTMenum]
 ctmGetInteger.restype = CTMint
 
+ctmGetInteger64 = _lib.ctmGetInteger64
+ctmGetInteger64.argtypes = [CTMcontext, CTMenum]
+ctmGetInteger64.restype = CTMuint64
+
 ctmGetFloat = _lib.ctmGetFloat
 ctmGetFloat.argtypes = [CTMcontext, CTMenum]
 ctmGetFloat.restype = CTMfloat
@@ -182,6 +207,9 @@ ctmCompressionMethod.argtypes = [CTMcontext, CTMenum]
 ctmCompressionLevel = _lib.ctmCompressionLevel
 ctmCompressionLevel.argtypes = [CTMcontext, CTMuint]
 
+ctmCompressionThreads = _lib.ctmCompressionThreads
+ctmCompressionThreads.argtypes = [CTMcontext, CTMuint]
+
 ctmVertexPrecision = _lib.ctmVertexPrecision
 ctmVertexPrecision.argtypes = [CTMcontext, CTMfloat]
 
@@ -200,9 +228,30 @@ ctmAttribPrecision.argtypes = [CTMcontext, CTMenum, CTMfloat]
 ctmFileComment = _lib.ctmFileComment
 ctmFileComment.argtypes = [CTMcontext, c_char_p]
 
+ctmStreamBufferSize = _lib.ctmStreamBufferSize
+ctmStreamBufferSize.argtypes = [CTMcontext, CTMuint]
+
+ctmThreadCount = _lib.ctmThreadCount
+ctmThreadCount.argtypes = [CTMcontext, CTMuint]
+
+ctmAllocator = _lib.ctmAllocator
+ctmAllocator.argtypes = [CTMcontext, CTMallocfn, CTMfreefn, c_void_p]
+
+ctmMemoryLimit = _lib.ctmMemoryLimit
+ctmMemoryLimit.argtypes = [CTMcontext, c_size_t]
+
+ctmLoadOptions = _lib.ctmLoadOptions
+ctmLoadOptions.argtypes = [CTMcontext, CTMuint]
+
+ctmLoadDestination = _lib.ctmLoadDestination
+ctmLoadDestination.argtypes = [CTMcontext, CTMenum, c_void_p, c_size_t, CTMuint, CTMuint]
+
 ctmDefineMesh = _lib.ctmDefineMesh
 ctmDefineMesh.argtypes = [CTMcontext, POINTER(CTMfloat), CTMuint, POINTER(CTMuint), CTMuint, POINTER(CTMfloat)]
 
+ctmDefineMesh64 = _lib.ctmDefineMesh64
+ctmDefineMesh64.argtypes = [CTMcontext, POINTER(CTMfloat), CTMuint64, POINTER(CTMuint), CTMuint64, POINTER(CTMfloat)]
+
 ctmAddUVMap = _lib.ctmAddUVMap
 ctmAddUVMap.argtypes = [CTMcontext, POINTER(CTMfloat), c_char_p, c_char_p]
 ctmAddUVMap.restype = CTMenum
@@ -214,5 +263,14 @@ ctmAddAttribMap.restype = CTMenum
 ctmLoad = _lib.ctmLoad
 ctmLoad.argtypes = [CTMcontext, c_char_p]
 
+ctmLoadFromMemory = _lib.ctmLoadFromMemory
+ctmLoadFromMemory.argtypes = [CTMcontext, c_void_p, c_size_t]
+
+ctmLoadMapped = _lib.ctmLoadMapped
+ctmLoadMapped.argtypes = [CTMcontext, c_char_p]
+
+ctmLoadHeader = _lib.ctmLoadHeader
+ctmLoadHeader.argtypes = [CTMcontext, c_char_p]
+
 ctmSave = _lib.ctmSave
 ctmSave.argtypes = [CTMcontext, c_char_p]
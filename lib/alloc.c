@@ -0,0 +1,336 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        alloc.c
+// Description: Memory allocation through the allocator of a context (see
+//              ctmAllocator()), and memory accounting (see
+//              ctmMemoryLimit()).
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include "openctm.h"
+#include "internal.h"
+
+
+// Size of the header that is stored in front of every memory block (it holds
+// the size of the block, and keeps the alignment of the allocator)
+#define _CTM_ALLOC_HEADER 16
+
+
+//-----------------------------------------------------------------------------
+// _ctmMemoryAcquire() - Account for aSize more bytes of memory in a context.
+// Returns false (without changing anything) if that would exceed the memory
+// limit of the context (see ctmMemoryLimit()).
+//-----------------------------------------------------------------------------
+static int _ctmMemoryAcquire(_CTMcontext * self, size_t aSize)
+{
+  int ok = CTM_TRUE;
+
+  _ctmMemoryLock(self);
+  if(self->mMemoryLimit && ((aSize > self->mMemoryLimit) ||
+     (self->mMemoryUsed > self->mMemoryLimit - aSize)))
+    ok = CTM_FALSE;
+  else
+  {
+    self->mMemoryUsed += aSize;
+    if(self->mMemoryUsed > self->mMemoryPeak)
+      self->mMemoryPeak = self->mMemoryUsed;
+  }
+  _ctmMemoryUnlock(self);
+
+  return ok;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMemoryRelease() - Account for aSize bytes of memory that have been freed.
+//-----------------------------------------------------------------------------
+static void _ctmMemoryRelease(_CTMcontext * self, size_t aSize)
+{
+  _ctmMemoryLock(self);
+  self->mMemoryUsed -= aSize;
+  _ctmMemoryUnlock(self);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMemoryAvailable() - Get the number of bytes that can still be allocated
+// within the memory limit of a context ((size_t) -1 if there is no limit).
+//-----------------------------------------------------------------------------
+size_t _ctmMemoryAvailable(_CTMcontext * self)
+{
+  size_t available;
+
+  if(!self->mMemoryLimit)
+    return (size_t) -1;
+  _ctmMemoryLock(self);
+  available = (self->mMemoryUsed < self->mMemoryLimit) ?
+              self->mMemoryLimit - self->mMemoryUsed : 0;
+  _ctmMemoryUnlock(self);
+
+  return available;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAlloc() - Allocate aSize bytes (at least one byte, so that a zero size
+// is not mistaken for an allocation failure). Returns a null pointer if the
+// memory could not be allocated, or if it would exceed the memory limit of
+// the context (the allocator is not called then).
+//-----------------------------------------------------------------------------
+void * _ctmAlloc(_CTMcontext * self, size_t aSize)
+{
+  unsigned char * block;
+
+  if(!aSize)
+    aSize = 1;
+  if(aSize > ((size_t) -1) - _CTM_ALLOC_HEADER)
+    return (void *) 0;
+  aSize += _CTM_ALLOC_HEADER;
+
+  if(!_ctmMemoryAcquire(self, aSize))
+    return (void *) 0;
+  if(self->mAllocFn)
+    block = (unsigned char *) self->mAllocFn(aSize, self->mAllocUserData);
+  else
+    block = (unsigned char *) malloc(aSize);
+  if(!block)
+  {
+    _ctmMemoryRelease(self, aSize);
+    return (void *) 0;
+  }
+
+  // Remember the size of the block (for _ctmFree())
+  *((size_t *) block) = aSize;
+  return (void *) (block + _CTM_ALLOC_HEADER);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCalloc() - Allocate a zero initialized array of aCount elements of
+// aSize bytes each.
+//-----------------------------------------------------------------------------
+void * _ctmCalloc(_CTMcontext * self, size_t aCount, size_t aSize)
+{
+  void * ptr;
+
+  // Check for overflow
+  if(aSize && (aCount > ((size_t) -1) / aSize))
+    return (void *) 0;
+
+  ptr = _ctmAlloc(self, aCount * aSize);
+  if(ptr)
+    memset(ptr, 0, aCount * aSize);
+  return ptr;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRealloc() - Resize a memory block from aOldSize to aNewSize bytes. The
+// allocator has no resize function, so the data is moved to a new block. On
+// failure, a null pointer is returned and the old block is left intact.
+//-----------------------------------------------------------------------------
+void * _ctmRealloc(_CTMcontext * self, void * aPtr, size_t aOldSize,
+  size_t aNewSize)
+{
+  unsigned char * block;
+  size_t oldSize;
+  void * ptr;
+
+  if(aPtr && !self->mAllocFn)
+  {
+    // Resize the block with realloc() (both blocks are accounted for while
+    // it is being resized)
+    if(!aNewSize)
+      aNewSize = 1;
+    if(aNewSize > ((size_t) -1) - _CTM_ALLOC_HEADER)
+      return (void *) 0;
+    aNewSize += _CTM_ALLOC_HEADER;
+    if(!_ctmMemoryAcquire(self, aNewSize))
+      return (void *) 0;
+    block = ((unsigned char *) aPtr) - _CTM_ALLOC_HEADER;
+    oldSize = *((size_t *) block);
+    block = (unsigned char *) realloc((void *) block, aNewSize);
+    if(!block)
+    {
+      _ctmMemoryRelease(self, aNewSize);
+      return (void *) 0;
+    }
+    _ctmMemoryRelease(self, oldSize);
+    *((size_t *) block) = aNewSize;
+    return (void *) (block + _CTM_ALLOC_HEADER);
+  }
+
+  ptr = _ctmAlloc(self, aNewSize);
+  if(ptr && aPtr)
+  {
+    memcpy(ptr, aPtr, aOldSize < aNewSize ? aOldSize : aNewSize);
+    _ctmFree(self, aPtr);
+  }
+  return ptr;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFree() - Free a memory block that was allocated by _ctmAlloc(),
+// _ctmCalloc() or _ctmRealloc(). A null pointer is ignored.
+//-----------------------------------------------------------------------------
+void _ctmFree(_CTMcontext * self, void * aPtr)
+{
+  unsigned char * block;
+  size_t size;
+
+  if(!aPtr)
+    return;
+  block = ((unsigned char *) aPtr) - _CTM_ALLOC_HEADER;
+  size = *((size_t *) block);
+  if(self->mFreeFn)
+    self->mFreeFn((void *) block, self->mAllocUserData);
+  else
+    free((void *) block);
+  _ctmMemoryRelease(self, size);
+}
+
+//-----------------------------------------------------------------------------
+// _CTMarenablock - Header of a memory block that was allocated from the heap
+// because the arena was full (see _ctmArenaAlloc()). The memory follows the
+// header, which is padded to _CTM_ARENA_ALIGN bytes (_CTM_ARENA_HEADER).
+//-----------------------------------------------------------------------------
+typedef struct _CTMarenablock_struct _CTMarenablock;
+struct _CTMarenablock_struct {
+  _CTMarenablock * mNext; // Next (earlier) block
+  size_t mTop;            // Arena top before the block was allocated
+};
+
+#define _CTM_ARENA_HEADER ((sizeof(_CTMarenablock) + _CTM_ARENA_ALIGN - 1) & \
+                           ~((size_t) _CTM_ARENA_ALIGN - 1))
+
+//-----------------------------------------------------------------------------
+// _ctmArenaReserve() - Make sure that the scratch arena of a context holds at
+// least aSize bytes (or as much as was used by any earlier operation, if that
+// is more). This only has an effect while the arena is not in use, i.e. the
+// arena is never moved while there are allocations in it. Failure is not an
+// error, since _ctmArenaAlloc() falls back to the heap.
+//-----------------------------------------------------------------------------
+void _ctmArenaReserve(_CTMcontext * self, size_t aSize)
+{
+  if(self->mArenaTop > 0)
+    return;
+  if(aSize < self->mArenaPeak)
+    aSize = self->mArenaPeak;
+  if(aSize <= self->mArenaSize)
+    return;
+
+  // The old contents are not needed, so free before allocating
+  if(self->mArena)
+    _ctmFree(self, self->mArena);
+  self->mArena = (unsigned char *) _ctmAlloc(self, aSize);
+  self->mArenaSize = self->mArena ? aSize : 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmArenaMark() - Get the current top of the scratch arena (pass it to
+// _ctmArenaRelease() to free everything that is allocated after this call).
+//-----------------------------------------------------------------------------
+size_t _ctmArenaMark(_CTMcontext * self)
+{
+  return self->mArenaTop;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmArenaAlloc() - Allocate aSize bytes of temporary memory from the
+// scratch arena of a context. The memory is freed by _ctmArenaRelease(), and
+// is aligned to _CTM_ARENA_ALIGN bytes. If the arena is full, the memory is
+// allocated from the heap instead (the arena is enlarged by the next call to
+// _ctmArenaReserve()). Returns a null pointer if the memory could not be
+// allocated.
+//-----------------------------------------------------------------------------
+void * _ctmArenaAlloc(_CTMcontext * self, size_t aSize)
+{
+  _CTMarenablock * block;
+  size_t top;
+  void * ptr;
+
+  // Round the size up to the alignment (checking for overflow)
+  if(aSize > ((size_t) -1) - 2 * _CTM_ARENA_HEADER)
+    return (void *) 0;
+  if(!aSize)
+    aSize = 1;
+  aSize = (aSize + (_CTM_ARENA_ALIGN - 1)) & ~((size_t) _CTM_ARENA_ALIGN - 1);
+  top = self->mArenaTop;
+
+  if((top <= self->mArenaSize) && (aSize <= self->mArenaSize - top))
+  {
+    // Allocate from the arena
+    ptr = (void *) &self->mArena[top];
+  }
+  else
+  {
+    // Allocate from the heap
+    block = (_CTMarenablock *) _ctmAlloc(self, _CTM_ARENA_HEADER + aSize);
+    if(!block)
+      return (void *) 0;
+    block->mNext = (_CTMarenablock *) self->mArenaOverflow;
+    block->mTop = top;
+    self->mArenaOverflow = (void *) block;
+    ptr = (void *) (((unsigned char *) block) + _CTM_ARENA_HEADER);
+  }
+
+  // Update the arena top (it also counts the memory that did not fit in the
+  // arena, so that the next _ctmArenaReserve() makes room for it)
+  self->mArenaTop = top + aSize;
+  if(self->mArenaTop > self->mArenaPeak)
+    self->mArenaPeak = self->mArenaTop;
+
+  return ptr;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmArenaRelease() - Free all memory that has been allocated from the
+// scratch arena since the call to _ctmArenaMark() that returned aMark.
+//-----------------------------------------------------------------------------
+void _ctmArenaRelease(_CTMcontext * self, size_t aMark)
+{
+  _CTMarenablock * block;
+
+  // Free the heap blocks that were allocated after the mark
+  block = (_CTMarenablock *) self->mArenaOverflow;
+  while(block && (block->mTop >= aMark))
+  {
+    self->mArenaOverflow = (void *) block->mNext;
+    _ctmFree(self, (void *) block);
+    block = (_CTMarenablock *) self->mArenaOverflow;
+  }
+
+  if(aMark < self->mArenaTop)
+    self->mArenaTop = aMark;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmArenaFree() - Free the scratch arena of a context (it must not be in
+// use).
+//-----------------------------------------------------------------------------
+void _ctmArenaFree(_CTMcontext * self)
+{
+  _ctmArenaRelease(self, 0);
+  if(self->mArena)
+    _ctmFree(self, self->mArena);
+  self->mArena = (unsigned char *) 0;
+  self->mArenaSize = 0;
+  self->mArenaPeak = 0;
+}
@@ -42,10 +42,14 @@ static int _compareTriangle(const void * elem1, const void * elem2)
 {
   CTMuint * tri1 = (CTMuint *) elem1;
   CTMuint * tri2 = (CTMuint *) elem2;
+
+  // Note: the indices are compared rather than subtracted, since the
+  // difference of two indices does not always fit in an int
   if(tri1[0] != tri2[0])
-    return tri1[0] - tri2[0];
-  else
-    return tri1[1] - tri2[1];
+    return (tri1[0] < tri2[0]) ? -1 : 1;
+  if(tri1[1] != tri2[1])
+    return (tri1[1] < tri2[1]) ? -1 : 1;
+  return 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -54,7 +58,8 @@ static int _compareTriangle(const void * elem1, const void * elem2)
 //-----------------------------------------------------------------------------
 static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
 {
-  CTMuint * tri, tmp, i;
+  CTMuint * tri, tmp;
+  size_t i;
 
   // Step 1: Make sure that the first index of each triangle is the smallest
   // one (rotate triangle nodes if necessary)
@@ -77,8 +82,10 @@ static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
     }
   }
 
-  // Step 2: Sort the triangles based on the first triangle index
-  qsort((void *) aIndices, self->mTriangleCount, sizeof(CTMuint) * 3, _compareTriangle);
+  // Step 2: Sort the triangles based on the first triangle index (with a
+  // radix sort, or with qsort() if there is not enough memory for it)
+  if(!_ctmSortTriangles(self, aIndices, self->mTriangleCount))
+    qsort((void *) aIndices, self->mTriangleCount, sizeof(CTMuint) * 3, _compareTriangle);
 }
 
 //-----------------------------------------------------------------------------
@@ -87,8 +94,8 @@ static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
 //-----------------------------------------------------------------------------
 static void _ctmMakeIndexDeltas(_CTMcontext * self, CTMuint * aIndices)
 {
-  CTMint i;
-  for(i = self->mTriangleCount - 1; i >= 0; -- i)
+  size_t i;
+  for(i = self->mTriangleCount; i -- > 0; )
   {
     // Step 1: Calculate delta from second triangle index to the previous
     // second triangle index, if the previous triangle shares the same first
@@ -114,26 +121,41 @@ static void _ctmMakeIndexDeltas(_CTMcontext * self, CTMuint * aIndices)
 //-----------------------------------------------------------------------------
 static void _ctmRestoreIndices(_CTMcontext * self, CTMuint * aIndices)
 {
-  CTMuint i;
+  size_t i;
 
-  for(i = 0; i < self->mTriangleCount; ++ i)
-  {
-    // Step 1: Reverse derivative of the first triangle index
-    if(i >= 1)
-      aIndices[i * 3] += aIndices[(i - 1) * 3];
+  // Step 1: Reverse derivative of the first triangle index
+  _ctmPrefixSum(self, aIndices, self->mTriangleCount, 1, 3);
 
-    // Step 2: Reverse delta from third triangle index to the first triangle
-    // index
+  // Step 2: Reverse delta from third triangle index to the first triangle
+  // index
+  for(i = 0; i < self->mTriangleCount; ++ i)
     aIndices[i * 3 + 2] += aIndices[i * 3];
 
-    // Step 3: Reverse delta from second triangle index to the previous
-    // second triangle index, if the previous triangle shares the same first
-    // index, otherwise reverse the delta to the first triangle index
-    if((i >= 1) && (aIndices[i * 3] == aIndices[(i - 1) * 3]))
-      aIndices[i * 3 + 1] += aIndices[(i - 1) * 3 + 1];
-    else
-      aIndices[i * 3 + 1] += aIndices[i * 3];
-  }
+  // Step 3: Reverse delta from second triangle index to the previous
+  // second triangle index, if the previous triangle shares the same first
+  // index, otherwise reverse the delta to the first triangle index (i.e. a
+  // prefix sum within each run of triangles with the same first index)
+  _ctmSegmentedPrefixSum(self, &aIndices[1], aIndices, self->mTriangleCount, 3);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmScratchSize_MG1() - Estimate the amount of scratch arena memory that is
+// used by _ctmCompressMesh_MG1(): the sorted indices, or the largest array
+// (including the interleaved and packed arrays of _ctmStreamWritePackedInts()
+// and _ctmStreamWritePackedFloats()).
+//-----------------------------------------------------------------------------
+size_t _ctmScratchSize_MG1(_CTMcontext * self)
+{
+  size_t size;
+
+  // Triangle indices: indices + interleaved + packed
+  size = 3 * 3 * sizeof(CTMuint) * self->mTriangleCount;
+
+  // Vertices, normals and maps: interleaved + packed
+  if(size < 2 * 4 * sizeof(CTMfloat) * self->mVertexCount)
+    size = 2 * 4 * sizeof(CTMfloat) * self->mVertexCount;
+
+  return size + 1000 + 3 * _CTM_ARENA_ALIGN;
 }
 
 //-----------------------------------------------------------------------------
@@ -144,14 +166,18 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
 {
   CTMuint * indices;
   _CTMfloatmap * map;
-  CTMuint i;
+  size_t mark, i;
 
 #ifdef __DEBUG_
   printf("COMPRESSION METHOD: MG1\n");
 #endif
 
+  // Make room in the scratch arena for the temporary arrays
+  _ctmArenaReserve(self, _ctmScratchSize_MG1(self));
+
   // Perpare (sort) indices
-  indices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
+  mark = _ctmArenaMark(self);
+  indices = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * self->mTriangleCount * 3);
   if(!indices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
@@ -171,12 +197,12 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
   _ctmStreamWrite(self, (void *) "INDX", 4);
   if(!_ctmStreamWritePackedInts(self, (CTMint *) indices, self->mTriangleCount, 3, CTM_FALSE))
   {
-    free((void *) indices);
+    _ctmArenaRelease(self, mark);
     return CTM_FALSE;
   }
 
   // Free temporary resources
-  free((void *) indices);
+  _ctmArenaRelease(self, mark);
 
   // Write vertices
 #ifdef __DEBUG_
@@ -184,10 +210,7 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
 #endif
   _ctmStreamWrite(self, (void *) "VERT", 4);
   if(!_ctmStreamWritePackedFloats(self, self->mVertices, self->mVertexCount * 3, 1))
-  {
-    free((void *) indices);
     return CTM_FALSE;
-  }
 
   // Write normals
   if(self->mNormals)
@@ -233,59 +256,51 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmUncompressMesh_MG1() - Uncmpress the mesh from the input stream in the
-// CTM context, and store the resulting mesh in the CTM context.
+// _ctmReadArrays_MG1() - Read the packed arrays of an MG1 stream. The indices
+// are read in their delta form (see _ctmRestoreIndices()).
 //-----------------------------------------------------------------------------
-int _ctmUncompressMesh_MG1(_CTMcontext * self)
+static int _ctmReadArrays_MG1(_CTMcontext * self)
 {
-  CTMuint * indices;
   _CTMfloatmap * map;
-  CTMuint i;
-
-  // Allocate memory for the indices
-  indices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
-  if(!indices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
 
   // Read triangle indices
   if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
   {
     self->mError = CTM_BAD_FORMAT;
-    free(indices);
     return CTM_FALSE;
   }
-  if(!_ctmStreamReadPackedInts(self, (CTMint *) indices, self->mTriangleCount, 3, CTM_FALSE))
+  if(self->mIndices ?
+      !_ctmStreamReadPackedInts(self, (CTMint *) self->mIndices,
+                                self->mTriangleCount, 3, CTM_FALSE) :
+      !_ctmStreamSkipPacked(self))
     return CTM_FALSE;
 
-  // Restore indices
-  _ctmRestoreIndices(self, indices);
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    self->mIndices[i] = indices[i];
-
-  // Free temporary resources
-  free(indices);
-
   // Read vertices
   if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
   {
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  if(!_ctmStreamReadPackedFloats(self, self->mVertices, self->mVertexCount * 3, 1))
+  if(self->mVertices ?
+      !_ctmStreamReadPackedFloats(self, self->mVertices, self->mVertexCount * 3,
+                                  1, 3, self->mVertexStride) :
+      !_ctmStreamSkipPacked(self))
     return CTM_FALSE;
 
   // Read normals
-  if(self->mNormals)
+  if(self->mHasNormals)
   {
     if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
     {
       self->mError = CTM_BAD_FORMAT;
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedFloats(self, self->mNormals, self->mVertexCount, 3))
+    if(self->mNormalsPending)
+      self->mNormalsOffset = _ctmStreamTell(self);
+    if(self->mNormals ?
+        !_ctmStreamReadPackedFloats(self, self->mNormals, self->mVertexCount,
+                                    3, 3, self->mNormalStride) :
+        !_ctmStreamSkipPacked(self))
       return CTM_FALSE;
   }
 
@@ -300,7 +315,12 @@ int _ctmUncompressMesh_MG1(_CTMcontext * self)
     }
     _ctmStreamReadSTRING(self, &map->mName);
     _ctmStreamReadSTRING(self, &map->mFileName);
-    if(!_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount, 2))
+    if(map->mPending)
+      map->mOffset = _ctmStreamTell(self);
+    if(map->mValues ?
+        !_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount,
+                                    2, 2, map->mStride) :
+        !_ctmStreamSkipPacked(self))
       return CTM_FALSE;
     map = map->mNext;
   }
@@ -315,10 +335,71 @@ int _ctmUncompressMesh_MG1(_CTMcontext * self)
       return 0;
     }
     _ctmStreamReadSTRING(self, &map->mName);
-    if(!_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount, 4))
+    if(map->mPending)
+      map->mOffset = _ctmStreamTell(self);
+    if(map->mValues ?
+        !_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount,
+                                    4, 4, map->mStride) :
+        !_ctmStreamSkipPacked(self))
       return CTM_FALSE;
     map = map->mNext;
   }
 
   return CTM_TRUE;
 }
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressMesh_MG1() - Uncmpress the mesh from the input stream in the
+// CTM context, and store the resulting mesh in the CTM context. Arrays that
+// have not been allocated (header only mode, or skipped by the load options)
+// are skipped in the stream.
+//-----------------------------------------------------------------------------
+int _ctmUncompressMesh_MG1(_CTMcontext * self)
+{
+  CTMint multiThreaded, ok;
+
+  // With several threads, the packed arrays are located first, and then
+  // uncompressed concurrently
+  multiThreaded = (_ctmThreadCount(self) > 1) && !self->mHeaderOnly;
+  if(multiThreaded)
+    _ctmStreamBeginBatch(self);
+
+  // Read the arrays
+  ok = _ctmReadArrays_MG1(self);
+  if(multiThreaded && !_ctmStreamEndBatch(self, ok))
+    ok = CTM_FALSE;
+  if(!ok)
+    return CTM_FALSE;
+
+  // Restore indices
+  if(self->mIndices)
+    _ctmRestoreIndices(self, self->mIndices);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressArray_MG1() - Uncompress a single array (the normals, or the
+// values of a UV/attribute map) from the current stream position. aArray is
+// CTM_NORMALS, CTM_UV_MAP_1 or CTM_ATTRIB_MAP_1, and the destination array
+// must have been allocated. Used for arrays that are loaded on demand.
+//-----------------------------------------------------------------------------
+int _ctmUncompressArray_MG1(_CTMcontext * self, CTMenum aArray,
+  _CTMfloatmap * aMap)
+{
+  switch(aArray)
+  {
+    case CTM_NORMALS:
+      return _ctmStreamReadPackedFloats(self, self->mNormals, self->mVertexCount,
+                                        3, 3, self->mNormalStride);
+    case CTM_UV_MAP_1:
+      return _ctmStreamReadPackedFloats(self, aMap->mValues, self->mVertexCount,
+                                        2, 2, aMap->mStride);
+    case CTM_ATTRIB_MAP_1:
+      return _ctmStreamReadPackedFloats(self, aMap->mValues, self->mVertexCount,
+                                        4, 4, aMap->mStride);
+    default:
+      self->mError = CTM_INTERNAL_ERROR;
+      return CTM_FALSE;
+  }
+}
@@ -34,11 +34,38 @@
 #include <stdio.h>
 #endif
 
+// SSE2 is always available on x86-64, and can be enabled for 32-bit x86
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+  #define _CTM_USE_SSE2
+  #include <emmintrin.h>
+#endif
+
 // We need PI
 #ifndef PI
 #define PI 3.141592653589793238462643f
 #endif
 
+// Minimum number of vertices (or triangles) per job for the passes over all
+// vertices (or triangles) that are spread over several threads (smaller
+// meshes use fewer threads)
+#define _CTM_RANGE_MIN_JOB 65536
+
+// Number of triangles per block when the flat triangle normals are calculated
+// on the fly by the smooth normal pass
+#define _CTM_NORMAL_BLOCK 256
+
+// How many elements ahead the gathering passes prefetch the data that they
+// read (or write) through the vertex permutation
+#define _CTM_PREFETCH_DISTANCE 16
+#if defined(__GNUC__)
+  #define _CTM_PREFETCH(aPtr) __builtin_prefetch((const void *) (aPtr))
+#elif defined(_CTM_USE_SSE2)
+  #define _CTM_PREFETCH(aPtr) _mm_prefetch((const char *) (aPtr), _MM_HINT_T0)
+#else
+  #define _CTM_PREFETCH(aPtr)
+#endif
+
 
 //-----------------------------------------------------------------------------
 // _CTMgrid - 3D space subdivision grid.
@@ -69,33 +96,192 @@ typedef struct {
   CTMuint mOriginalIndex;
 } _CTMsortvertex;
 
+//-----------------------------------------------------------------------------
+// _CTMrangejob - A range of vertices (or triangles) for the passes over all
+// vertices (or triangles) of the mesh (see _ctmRunRangeJobs()).
+//-----------------------------------------------------------------------------
+typedef struct {
+  const CTMfloat * mVertices;     // Vertex array of the mesh
+  size_t mStart;                  // First vertex (triangle) of the range
+  size_t mEnd;                    // End of the range (exclusive)
+  const _CTMgrid * mGrid;         // Grid (grid index and vertex delta passes)
+  _CTMsortvertex * mSortVertices; // Sort vertices
+  CTMuint64 * mKeys;              // Optional sort keys (grid index pass)
+  CTMuint * mOrder;               // Optional sort values (grid index pass)
+  CTMfloat mMin[3];               // Bounding box of the range (bounds pass)
+  CTMfloat mMax[3];
+  const CTMuint * mIndices;       // Source indices (index passes)
+  CTMuint * mOutIndices;          // Destination indices (index passes)
+  CTMuint * mIndexLUT;            // Old to new vertex index (re-index pass)
+  const CTMfloat * mValues;       // UV coordinates or attributes
+  CTMint * mIntData;              // Integer deltas (delta passes)
+  CTMfloat mScale;                // Fixed point scaling factor (delta passes)
+  CTMuint mStride;                // Distance between vertices (normal passes)
+  size_t mTriangleCount;          // Number of triangles (normal passes)
+  CTMfloat * mFaceNormals;        // Optional flat triangle normals
+  const CTMuint * mVertexTriangles; // Optional triangles of each vertex
+  const CTMuint * mVertexTriEnd;  // End of the triangle list of each vertex
+  CTMfloat * mSmoothNormals;      // Smooth vertex normals
+} _CTMrangejob;
+
+//-----------------------------------------------------------------------------
+// _ctmRunRangeJobs() - Run aJobFn for aCount elements (vertices or
+// triangles), split into ranges that are handled by separate threads. aJob
+// holds the settings that are common to all jobs. Returns a pointer to the
+// jobs (which is valid until the scratch arena is released), and the number
+// of jobs in aJobCount.
+//-----------------------------------------------------------------------------
+static _CTMrangejob * _ctmRunRangeJobs(_CTMcontext * self, _CTMjobfn aJobFn,
+  _CTMrangejob * aJob, size_t aCount, CTMuint * aJobCount)
+{
+  _CTMrangejob * jobs;
+  CTMuint jobCount, j;
+  size_t chunk;
+
+  jobCount = _ctmThreadCount(self);
+  if(aCount / _CTM_RANGE_MIN_JOB < jobCount)
+    jobCount = (CTMuint) (aCount / _CTM_RANGE_MIN_JOB);
+  jobs = (jobCount > 1) ? (_CTMrangejob *) _ctmArenaAlloc(self,
+         sizeof(_CTMrangejob) * jobCount) : (_CTMrangejob *) 0;
+  if(!jobs)
+  {
+    // Run everything as one job in the calling thread
+    jobs = aJob;
+    jobCount = 1;
+  }
+
+  chunk = aCount / jobCount;
+  for(j = 0; j < jobCount; ++ j)
+  {
+    jobs[j] = *aJob;
+    jobs[j].mStart = j * chunk;
+    jobs[j].mEnd = (j == jobCount - 1) ? aCount : (j + 1) * chunk;
+  }
+  _ctmRunJobs(self, aJobFn, (void *) jobs, sizeof(_CTMrangejob), jobCount);
+
+  *aJobCount = jobCount;
+  return jobs;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmBoundsJob() - Calculate the bounding box of a range of vertices (the
+// sign of a zero bound is fixed by the caller, see _ctmSetupGrid()).
+//-----------------------------------------------------------------------------
+static void _ctmBoundsJob(void * aJob)
+{
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  const CTMfloat * v = job->mVertices;
+  size_t i, end = job->mEnd;
+  CTMuint j;
+
+  for(j = 0; j < 3; ++ j)
+    job->mMin[j] = job->mMax[j] = v[job->mStart * 3 + j];
+  i = job->mStart + 1;
+
+#ifdef _CTM_USE_SSE2
+  // Four vertices (three vectors) at a time. The components are at the same
+  // positions in every group of four vertices: a = x0 y0 z0 x1,
+  // b = y1 z1 x2 y2, c = z2 x3 y3 z3.
+  if(i + 4 <= end)
+  {
+    __m128 a, b, c, minA, minB, minC, maxA, maxB, maxC;
+    CTMfloat mn[12], mx[12];
+
+    minA = maxA = _mm_loadu_ps(&v[i * 3]);
+    minB = maxB = _mm_loadu_ps(&v[i * 3 + 4]);
+    minC = maxC = _mm_loadu_ps(&v[i * 3 + 8]);
+    for(i += 4; i + 4 <= end; i += 4)
+    {
+      a = _mm_loadu_ps(&v[i * 3]);
+      b = _mm_loadu_ps(&v[i * 3 + 4]);
+      c = _mm_loadu_ps(&v[i * 3 + 8]);
+      minA = _mm_min_ps(minA, a);
+      minB = _mm_min_ps(minB, b);
+      minC = _mm_min_ps(minC, c);
+      maxA = _mm_max_ps(maxA, a);
+      maxB = _mm_max_ps(maxB, b);
+      maxC = _mm_max_ps(maxC, c);
+    }
+    _mm_storeu_ps(&mn[0], minA);
+    _mm_storeu_ps(&mn[4], minB);
+    _mm_storeu_ps(&mn[8], minC);
+    _mm_storeu_ps(&mx[0], maxA);
+    _mm_storeu_ps(&mx[4], maxB);
+    _mm_storeu_ps(&mx[8], maxC);
+    for(j = 0; j < 12; ++ j)
+    {
+      if(mn[j] < job->mMin[j % 3])
+        job->mMin[j % 3] = mn[j];
+      if(mx[j] > job->mMax[j % 3])
+        job->mMax[j % 3] = mx[j];
+    }
+  }
+#endif
+
+  for(; i < end; ++ i)
+  {
+    for(j = 0; j < 3; ++ j)
+    {
+      if(v[i * 3 + j] < job->mMin[j])
+        job->mMin[j] = v[i * 3 + j];
+      if(v[i * 3 + j] > job->mMax[j])
+        job->mMax[j] = v[i * 3 + j];
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFirstZero() - Get the first zero value (+0 or -0) of component aComp of
+// the vertices. Only called when there is one.
+//-----------------------------------------------------------------------------
+static CTMfloat _ctmFirstZero(_CTMcontext * self, CTMuint aComp)
+{
+  size_t i;
+
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    if(self->mVertices[i * 3 + aComp] == 0.0f)
+      return self->mVertices[i * 3 + aComp];
+  }
+  return 0.0f;
+}
+
 //-----------------------------------------------------------------------------
 // _ctmSetupGrid() - Setup the 3D space subdivision grid.
 //-----------------------------------------------------------------------------
 static void _ctmSetupGrid(_CTMcontext * self, _CTMgrid * aGrid)
 {
-  CTMuint i;
+  _CTMrangejob job, * jobs;
+  CTMuint jobCount, j;
+  size_t i, mark;
   CTMfloat factor[3], sum, wantedGrids;
 
-  // Calculate the mesh bounding box
-  aGrid->mMin[0] = aGrid->mMax[0] = self->mVertices[0];
-  aGrid->mMin[1] = aGrid->mMax[1] = self->mVertices[1];
-  aGrid->mMin[2] = aGrid->mMax[2] = self->mVertices[2];
-  for(i = 1; i < self->mVertexCount; ++ i)
+  // Calculate the mesh bounding box (the ranges are combined in order)
+  mark = _ctmArenaMark(self);
+  job.mVertices = self->mVertices;
+  jobs = _ctmRunRangeJobs(self, _ctmBoundsJob, &job, self->mVertexCount,
+                          &jobCount);
+  for(i = 0; i < 3; ++ i)
   {
-    if(self->mVertices[i * 3] < aGrid->mMin[0])
-      aGrid->mMin[0] = self->mVertices[i * 3];
-    else if(self->mVertices[i * 3] > aGrid->mMax[0])
-      aGrid->mMax[0] = self->mVertices[i * 3];
-    if(self->mVertices[i * 3 + 1] < aGrid->mMin[1])
-      aGrid->mMin[1] = self->mVertices[i * 3 + 1];
-    else if(self->mVertices[i * 3 + 1] > aGrid->mMax[1])
-      aGrid->mMax[1] = self->mVertices[i * 3 + 1];
-    if(self->mVertices[i * 3 + 2] < aGrid->mMin[2])
-      aGrid->mMin[2] = self->mVertices[i * 3 + 2];
-    else if(self->mVertices[i * 3 + 2] > aGrid->mMax[2])
-      aGrid->mMax[2] = self->mVertices[i * 3 + 2];
+    aGrid->mMin[i] = jobs[0].mMin[i];
+    aGrid->mMax[i] = jobs[0].mMax[i];
+    for(j = 1; j < jobCount; ++ j)
+    {
+      if(jobs[j].mMin[i] < aGrid->mMin[i])
+        aGrid->mMin[i] = jobs[j].mMin[i];
+      if(jobs[j].mMax[i] > aGrid->mMax[i])
+        aGrid->mMax[i] = jobs[j].mMax[i];
+    }
+
+    // -0 and +0 are equal, so a zero bound could have either sign. Use the
+    // first zero, as when scanning the vertices in order (the bounds are
+    // stored in the file).
+    if(aGrid->mMin[i] == 0.0f)
+      aGrid->mMin[i] = _ctmFirstZero(self, (CTMuint) i);
+    if(aGrid->mMax[i] == 0.0f)
+      aGrid->mMax[i] = _ctmFirstZero(self, (CTMuint) i);
   }
+  _ctmArenaRelease(self, mark);
 
   // Determine optimal grid resolution, based on the number of vertices and
   // the bounding box.
@@ -111,12 +297,20 @@ static void _ctmSetupGrid(_CTMcontext * self, _CTMgrid * aGrid)
     for(i = 0; i < 3; ++ i)
       factor[i] *= sum;
     wantedGrids = powf(100.0f * self->mVertexCount, 1.0f / 3.0f);
-    for(i = 0; i < 3; ++ i)
+
+    // Note: the grid index of every box must fit in a CTMuint, so the grid
+    // of a very large mesh is made coarser until it does
+    do
     {
-      aGrid->mDivision[i] = (CTMuint) ceilf(wantedGrids * factor[i]);
-      if(aGrid->mDivision[i] < 1)
-        aGrid->mDivision[i] = 1;
-    }
+      for(i = 0; i < 3; ++ i)
+      {
+        aGrid->mDivision[i] = (CTMuint) ceilf(wantedGrids * factor[i]);
+        if(aGrid->mDivision[i] < 1)
+          aGrid->mDivision[i] = 1;
+      }
+      wantedGrids *= 0.9f;
+    } while((CTMuint64) aGrid->mDivision[0] * aGrid->mDivision[1] *
+            aGrid->mDivision[2] > 0xffffffff);
   }
   else
   {
@@ -136,7 +330,8 @@ static void _ctmSetupGrid(_CTMcontext * self, _CTMgrid * aGrid)
 //-----------------------------------------------------------------------------
 // _ctmPointToGridIdx() - Convert a point to a grid index.
 //-----------------------------------------------------------------------------
-static CTMuint _ctmPointToGridIdx(_CTMgrid * aGrid, CTMfloat * aPoint)
+static CTMuint _ctmPointToGridIdx(const _CTMgrid * aGrid,
+  const CTMfloat * aPoint)
 {
   CTMuint i, idx[3];
 
@@ -154,7 +349,7 @@ static CTMuint _ctmPointToGridIdx(_CTMgrid * aGrid, CTMfloat * aPoint)
 // _ctmGridIdxToPoint() - Convert a grid index to a point (the min x/y/z for
 // the given grid box).
 //-----------------------------------------------------------------------------
-static void _ctmGridIdxToPoint(_CTMgrid * aGrid, CTMuint aIdx, CTMfloat * aPoint)
+static void _ctmGridIdxToPoint(const _CTMgrid * aGrid, CTMuint aIdx, CTMfloat * aPoint)
 {
   CTMuint gridIdx[3], zdiv, ydiv, i;
 
@@ -172,18 +367,132 @@ static void _ctmGridIdxToPoint(_CTMgrid * aGrid, CTMuint aIdx, CTMfloat * aPoint
 }
 
 //-----------------------------------------------------------------------------
-// _compareVertex() - Comparator for the vertex sorting.
+// _ctmFloatSortKey() - Convert a floating point value to an unsigned integer
+// with the same order (-0 and +0 are equal, as when comparing the floats).
+//-----------------------------------------------------------------------------
+static CTMuint _ctmFloatSortKey(CTMfloat aValue)
+{
+  union {
+    CTMfloat f;
+    CTMuint i;
+  } u;
+  u.f = aValue;
+  if(aValue == 0.0f)
+    u.i = 0;
+  return (u.i & 0x80000000) ? ~u.i : (u.i | 0x80000000);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmGridIndexJob() - Assign a range of vertices to grid boxes (store them in
+// the sort vertex array), and optionally set up their sort keys (see
+// _ctmSortVertices()). The grid indices are exactly the same as with
+// _ctmPointToGridIdx().
+//-----------------------------------------------------------------------------
+static void _ctmGridIndexJob(void * aJob)
+{
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  const _CTMgrid * grid = job->mGrid;
+  const CTMfloat * v = job->mVertices;
+  _CTMsortvertex * sv = job->mSortVertices;
+  size_t i = job->mStart, end = job->mEnd;
+
+#ifdef _CTM_USE_SSE2
+  {
+    __m128 minX, minY, minZ, sizeX, sizeY, sizeZ;
+    __m128i lastX, lastY, lastZ, idxX, idxY, idxZ, bad;
+    CTMuint ix[4], iy[4], iz[4], k;
+
+    minX = _mm_set1_ps(grid->mMin[0]);
+    minY = _mm_set1_ps(grid->mMin[1]);
+    minZ = _mm_set1_ps(grid->mMin[2]);
+    sizeX = _mm_set1_ps(grid->mSize[0]);
+    sizeY = _mm_set1_ps(grid->mSize[1]);
+    sizeZ = _mm_set1_ps(grid->mSize[2]);
+    lastX = _mm_set1_epi32((int) (grid->mDivision[0] - 1));
+    lastY = _mm_set1_epi32((int) (grid->mDivision[1] - 1));
+    lastZ = _mm_set1_epi32((int) (grid->mDivision[2] - 1));
+    for(; i + 4 <= end; i += 4)
+    {
+      // Box coordinates (the same division as in _ctmPointToGridIdx(), and
+      // truncation is the same as floorf() for non-negative values)
+      idxX = _mm_cvttps_epi32(_mm_div_ps(_mm_sub_ps(_mm_setr_ps(v[i * 3],
+             v[i * 3 + 3], v[i * 3 + 6], v[i * 3 + 9]), minX), sizeX));
+      idxY = _mm_cvttps_epi32(_mm_div_ps(_mm_sub_ps(_mm_setr_ps(v[i * 3 + 1],
+             v[i * 3 + 4], v[i * 3 + 7], v[i * 3 + 10]), minY), sizeY));
+      idxZ = _mm_cvttps_epi32(_mm_div_ps(_mm_sub_ps(_mm_setr_ps(v[i * 3 + 2],
+             v[i * 3 + 5], v[i * 3 + 8], v[i * 3 + 11]), minZ), sizeZ));
+
+      // Values that do not fit in an int (or NaN, for empty boxes) give
+      // 0x80000000: leave such (rare) vertices to _ctmPointToGridIdx()
+      bad = _mm_or_si128(_mm_or_si128(idxX, idxY), idxZ);
+      if(_mm_movemask_ps(_mm_castsi128_ps(bad)))
+      {
+        for(k = 0; k < 4; ++ k)
+        {
+          sv[i + k].x = v[(i + k) * 3];
+          sv[i + k].mGridIndex = _ctmPointToGridIdx(grid, &v[(i + k) * 3]);
+          sv[i + k].mOriginalIndex = (CTMuint) (i + k);
+        }
+        continue;
+      }
+
+      // Clamp to the last box
+      idxX = _mm_or_si128(_mm_andnot_si128(_mm_cmpgt_epi32(idxX, lastX), idxX),
+                          _mm_and_si128(_mm_cmpgt_epi32(idxX, lastX), lastX));
+      idxY = _mm_or_si128(_mm_andnot_si128(_mm_cmpgt_epi32(idxY, lastY), idxY),
+                          _mm_and_si128(_mm_cmpgt_epi32(idxY, lastY), lastY));
+      idxZ = _mm_or_si128(_mm_andnot_si128(_mm_cmpgt_epi32(idxZ, lastZ), idxZ),
+                          _mm_and_si128(_mm_cmpgt_epi32(idxZ, lastZ), lastZ));
+      _mm_storeu_si128((__m128i *) ix, idxX);
+      _mm_storeu_si128((__m128i *) iy, idxY);
+      _mm_storeu_si128((__m128i *) iz, idxZ);
+      for(k = 0; k < 4; ++ k)
+      {
+        sv[i + k].x = v[(i + k) * 3];
+        sv[i + k].mGridIndex = ix[k] + grid->mDivision[0] *
+                               (iy[k] + grid->mDivision[1] * iz[k]);
+        sv[i + k].mOriginalIndex = (CTMuint) (i + k);
+      }
+    }
+  }
+#endif
+
+  for(; i < end; ++ i)
+  {
+    sv[i].x = v[i * 3];
+    sv[i].mGridIndex = _ctmPointToGridIdx(grid, &v[i * 3]);
+    sv[i].mOriginalIndex = (CTMuint) i;
+  }
+
+  // Sort keys: grid index in the upper half, x in the lower half
+  if(job->mKeys)
+  {
+    for(i = job->mStart; i < end; ++ i)
+    {
+      job->mKeys[i] = (((CTMuint64) sv[i].mGridIndex) << 32) |
+                      _ctmFloatSortKey(sv[i].x);
+      job->mOrder[i] = (CTMuint) i;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _compareVertex() - Comparator for the vertex sorting. Vertices with the same
+// grid index and x coordinate keep their original order, so that the result
+// is the same as with _ctmRadixSort().
 //-----------------------------------------------------------------------------
 static int _compareVertex(const void * elem1, const void * elem2)
 {
   _CTMsortvertex * v1 = (_CTMsortvertex *) elem1;
   _CTMsortvertex * v2 = (_CTMsortvertex *) elem2;
   if(v1->mGridIndex != v2->mGridIndex)
-    return v1->mGridIndex - v2->mGridIndex;
+    return (v1->mGridIndex < v2->mGridIndex) ? -1 : 1;
   else if(v1->x < v2->x)
     return -1;
   else if(v1->x > v2->x)
     return 1;
+  else if(v1->mOriginalIndex != v2->mOriginalIndex)
+    return (v1->mOriginalIndex < v2->mOriginalIndex) ? -1 : 1;
   else
     return 0;
 }
@@ -195,46 +504,119 @@ static int _compareVertex(const void * elem1, const void * elem2)
 static void _ctmSortVertices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
   _CTMgrid * aGrid)
 {
-  CTMuint i;
+  _CTMrangejob job;
+  CTMuint64 * keys;
+  CTMuint * order;
+  CTMuint jobCount;
+  size_t mark, i, idx;
+
+  // Prepare sort vertex array (and the keys for the radix sort below, if
+  // there is memory for them)
+  mark = _ctmArenaMark(self);
+  keys = (CTMuint64 *) _ctmArenaAlloc(self, sizeof(CTMuint64) * self->mVertexCount);
+  order = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * self->mVertexCount);
+  job.mVertices = self->mVertices;
+  job.mGrid = aGrid;
+  job.mSortVertices = aSortVertices;
+  job.mKeys = (keys && order) ? keys : (CTMuint64 *) 0;
+  job.mOrder = order;
+  _ctmRunRangeJobs(self, _ctmGridIndexJob, &job, self->mVertexCount,
+                   &jobCount);
 
-  // Prepare sort vertex array
-  for(i = 0; i < self->mVertexCount; ++ i)
+  // Sort vertices. The elements are first sorted by their grid indices, and
+  // scondly by their x coordinates. This is done with a radix sort of 64-bit
+  // keys (grid index in the upper half, x in the lower half).
+  if(keys && order)
   {
-    // Store vertex properties in the sort vertex array
-    aSortVertices[i].x = self->mVertices[i * 3];
-    aSortVertices[i].mGridIndex = _ctmPointToGridIdx(aGrid, &self->mVertices[i * 3]);
-    aSortVertices[i].mOriginalIndex = i;
+    if(_ctmRadixSort(self, keys, order, self->mVertexCount))
+    {
+      for(i = 0; i < self->mVertexCount; ++ i)
+      {
+        idx = order[i];
+        aSortVertices[i].x = self->mVertices[idx * 3];
+        aSortVertices[i].mGridIndex = (CTMuint) (keys[i] >> 32);
+        aSortVertices[i].mOriginalIndex = (CTMuint) idx;
+      }
+      _ctmArenaRelease(self, mark);
+      return;
+    }
   }
+  _ctmArenaRelease(self, mark);
 
-  // Sort vertices. The elements are first sorted by their grid indices, and
-  // scondly by their x coordinates.
+  // Not enough memory for the radix sort (the result is the same)
   qsort((void *) aSortVertices, self->mVertexCount, sizeof(_CTMsortvertex), _compareVertex);
 }
 
+//-----------------------------------------------------------------------------
+// _ctmIndexLUTJob() - Fill in the old to new vertex index lookup-array for a
+// range of sorted vertices.
+//-----------------------------------------------------------------------------
+static void _ctmIndexLUTJob(void * aJob)
+{
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  const _CTMsortvertex * sortVertices = job->mSortVertices;
+  CTMuint * indexLUT = job->mIndexLUT;
+  size_t i;
+
+  for(i = job->mStart; i < job->mEnd; ++ i)
+  {
+    if(i + _CTM_PREFETCH_DISTANCE < job->mEnd)
+      _CTM_PREFETCH(&indexLUT[sortVertices[i + _CTM_PREFETCH_DISTANCE].mOriginalIndex]);
+    indexLUT[sortVertices[i].mOriginalIndex] = (CTMuint) i;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReIndexJob() - Convert the old indices of a range of triangles to new
+// indices.
+//-----------------------------------------------------------------------------
+static void _ctmReIndexJob(void * aJob)
+{
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  const CTMuint * indices = job->mIndices, * indexLUT = job->mIndexLUT;
+  CTMuint * outIndices = job->mOutIndices;
+  size_t i, end;
+
+  end = job->mEnd * 3;
+  for(i = job->mStart * 3; i < end; ++ i)
+  {
+    if(i + _CTM_PREFETCH_DISTANCE < end)
+      _CTM_PREFETCH(&indexLUT[indices[i + _CTM_PREFETCH_DISTANCE]]);
+    outIndices[i] = indexLUT[indices[i]];
+  }
+}
+
 //-----------------------------------------------------------------------------
 // _ctmReIndexIndices() - Re-index all indices, based on the sorted vertices.
 //-----------------------------------------------------------------------------
 static int _ctmReIndexIndices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
   CTMuint * aIndices)
 {
-  CTMuint i, * indexLUT;
+  _CTMrangejob job;
+  CTMuint * indexLUT, jobCount;
+  size_t mark;
 
   // Create temporary lookup-array, O(n)
-  indexLUT = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
+  mark = _ctmArenaMark(self);
+  indexLUT = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * self->mVertexCount);
   if(!indexLUT)
   {
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
-  for(i = 0; i < self->mVertexCount; ++ i)
-    indexLUT[aSortVertices[i].mOriginalIndex] = i;
+  job.mSortVertices = aSortVertices;
+  job.mIndexLUT = indexLUT;
+  job.mIndices = self->mIndices;
+  job.mOutIndices = aIndices;
+  _ctmRunRangeJobs(self, _ctmIndexLUTJob, &job, self->mVertexCount,
+                   &jobCount);
 
   // Convert old indices to new indices, O(n)
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    aIndices[i] = indexLUT[self->mIndices[i]];
+  _ctmRunRangeJobs(self, _ctmReIndexJob, &job, self->mTriangleCount,
+                   &jobCount);
 
   // Free temporary lookup-array
-  free((void *) indexLUT);
+  _ctmArenaRelease(self, mark);
 
   return CTM_TRUE;
 }
@@ -246,10 +628,14 @@ static int _compareTriangle(const void * elem1, const void * elem2)
 {
   CTMuint * tri1 = (CTMuint *) elem1;
   CTMuint * tri2 = (CTMuint *) elem2;
+
+  // Note: the indices are compared rather than subtracted, since the
+  // difference of two indices does not always fit in an int
   if(tri1[0] != tri2[0])
-    return tri1[0] - tri2[0];
-  else
-    return tri1[1] - tri2[1];
+    return (tri1[0] < tri2[0]) ? -1 : 1;
+  if(tri1[1] != tri2[1])
+    return (tri1[1] < tri2[1]) ? -1 : 1;
+  return 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -258,7 +644,8 @@ static int _compareTriangle(const void * elem1, const void * elem2)
 //-----------------------------------------------------------------------------
 static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
 {
-  CTMuint * tri, tmp, i;
+  CTMuint * tri, tmp;
+  size_t i;
 
   // Step 1: Make sure that the first index of each triangle is the smallest
   // one (rotate triangle nodes if necessary)
@@ -281,100 +668,147 @@ static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
     }
   }
 
-  // Step 2: Sort the triangles based on the first triangle index
-  qsort((void *) aIndices, self->mTriangleCount, sizeof(CTMuint) * 3, _compareTriangle);
+  // Step 2: Sort the triangles based on the first triangle index (with a
+  // radix sort, or with qsort() if there is not enough memory for it)
+  if(!_ctmSortTriangles(self, aIndices, self->mTriangleCount))
+    qsort((void *) aIndices, self->mTriangleCount, sizeof(CTMuint) * 3, _compareTriangle);
 }
 
 //-----------------------------------------------------------------------------
-// _ctmMakeIndexDeltas() - Calculate various forms of derivatives in order to
-// reduce data entropy.
+// _ctmIndexDeltaJob() - Calculate the index deltas of a range of triangles
+// (see _ctmMakeIndexDeltas()).
 //-----------------------------------------------------------------------------
-static void _ctmMakeIndexDeltas(_CTMcontext * self, CTMuint * aIndices)
+static void _ctmIndexDeltaJob(void * aJob)
 {
-  CTMint i;
-  for(i = self->mTriangleCount - 1; i >= 0; -- i)
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  const CTMuint * tri;
+  CTMuint * delta;
+  size_t i;
+
+  for(i = job->mStart; i < job->mEnd; ++ i)
   {
+    tri = &job->mIndices[i * 3];
+    delta = &job->mOutIndices[i * 3];
+
     // Step 1: Calculate delta from second triangle index to the previous
     // second triangle index, if the previous triangle shares the same first
     // index, otherwise calculate the delta to the first triangle index
-    if((i >= 1) && (aIndices[i * 3] == aIndices[(i - 1) * 3]))
-      aIndices[i * 3 + 1] -= aIndices[(i - 1) * 3 + 1];
+    if((i >= 1) && (tri[0] == tri[-3]))
+      delta[1] = tri[1] - tri[-2];
     else
-      aIndices[i * 3 + 1] -= aIndices[i * 3];
+      delta[1] = tri[1] - tri[0];
 
     // Step 2: Calculate delta from third triangle index to the first triangle
     // index
-    aIndices[i * 3 + 2] -= aIndices[i * 3];
+    delta[2] = tri[2] - tri[0];
 
     // Step 3: Calculate derivative of the first triangle index
-    if(i >= 1)
-      aIndices[i * 3] -= aIndices[(i - 1) * 3];
+    delta[0] = (i >= 1) ? tri[0] - tri[-3] : tri[0];
   }
 }
 
+//-----------------------------------------------------------------------------
+// _ctmMakeIndexDeltas() - Calculate various forms of derivatives in order to
+// reduce data entropy. The deltas of aIndices are stored in aDeltaIndices.
+//-----------------------------------------------------------------------------
+static void _ctmMakeIndexDeltas(_CTMcontext * self, const CTMuint * aIndices,
+  CTMuint * aDeltaIndices)
+{
+  _CTMrangejob job;
+  CTMuint jobCount;
+  size_t mark;
+
+  mark = _ctmArenaMark(self);
+  job.mIndices = aIndices;
+  job.mOutIndices = aDeltaIndices;
+  _ctmRunRangeJobs(self, _ctmIndexDeltaJob, &job, self->mTriangleCount,
+                   &jobCount);
+  _ctmArenaRelease(self, mark);
+}
+
 //-----------------------------------------------------------------------------
 // _ctmRestoreIndices() - Restore original indices (inverse derivative
 // operation).
 //-----------------------------------------------------------------------------
 static void _ctmRestoreIndices(_CTMcontext * self, CTMuint * aIndices)
 {
-  CTMuint i;
+  size_t i;
 
-  for(i = 0; i < self->mTriangleCount; ++ i)
-  {
-    // Step 1: Reverse derivative of the first triangle index
-    if(i >= 1)
-      aIndices[i * 3] += aIndices[(i - 1) * 3];
+  // Step 1: Reverse derivative of the first triangle index
+  _ctmPrefixSum(self, aIndices, self->mTriangleCount, 1, 3);
 
-    // Step 2: Reverse delta from third triangle index to the first triangle
-    // index
+  // Step 2: Reverse delta from third triangle index to the first triangle
+  // index
+  for(i = 0; i < self->mTriangleCount; ++ i)
     aIndices[i * 3 + 2] += aIndices[i * 3];
 
-    // Step 3: Reverse delta from second triangle index to the previous
-    // second triangle index, if the previous triangle shares the same first
-    // index, otherwise reverse the delta to the first triangle index
-    if((i >= 1) && (aIndices[i * 3] == aIndices[(i - 1) * 3]))
-      aIndices[i * 3 + 1] += aIndices[(i - 1) * 3 + 1];
-    else
-      aIndices[i * 3 + 1] += aIndices[i * 3];
-  }
+  // Step 3: Reverse delta from second triangle index to the previous
+  // second triangle index, if the previous triangle shares the same first
+  // index, otherwise reverse the delta to the first triangle index (i.e. a
+  // prefix sum within each run of triangles with the same first index)
+  _ctmSegmentedPrefixSum(self, &aIndices[1], aIndices, self->mTriangleCount, 3);
 }
 
 //-----------------------------------------------------------------------------
-// _ctmMakeVertexDeltas() - Calculate various forms of derivatives in order to
-// reduce data entropy.
+// _ctmVertexDeltaJob() - Calculate the vertex deltas of a range of sorted
+// vertices (see _ctmMakeVertexDeltas()).
 //-----------------------------------------------------------------------------
-static void _ctmMakeVertexDeltas(_CTMcontext * self, CTMint * aIntVertices,
-  _CTMsortvertex * aSortVertices, _CTMgrid * aGrid)
+static void _ctmVertexDeltaJob(void * aJob)
 {
-  CTMuint i, gridIdx, prevGridIndex, oldIdx;
-  CTMfloat gridOrigin[3], scale;
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  const _CTMsortvertex * sortVertices = job->mSortVertices;
+  const CTMfloat * vertices = job->mVertices;
+  CTMint * intVertices = job->mIntData;
+  CTMuint gridIdx, prevGridIndex, originIdx;
+  size_t i, oldIdx;
+  CTMfloat gridOrigin[3], scale = job->mScale;
   CTMint deltaX, prevDeltaX;
 
-  // Vertex scaling factor
-  scale = 1.0f / self->mVertexPrecision;
+  if(job->mStart >= job->mEnd)
+    return;
 
+  // Start from the last vertex of the previous range (the X delta depends on
+  // it)
   prevGridIndex = 0x7fffffff;
   prevDeltaX = 0;
-  for(i = 0; i < self->mVertexCount; ++ i)
+  if(job->mStart > 0)
+  {
+    prevGridIndex = sortVertices[job->mStart - 1].mGridIndex;
+    oldIdx = sortVertices[job->mStart - 1].mOriginalIndex;
+    _ctmGridIdxToPoint(job->mGrid, prevGridIndex, gridOrigin);
+    prevDeltaX = (CTMint) floorf(scale * (vertices[oldIdx * 3] - gridOrigin[0]) + 0.5f);
+  }
+
+  // Get the first grid box origin (it only changes between runs of vertices
+  // in the same grid box)
+  originIdx = sortVertices[job->mStart].mGridIndex;
+  _ctmGridIdxToPoint(job->mGrid, originIdx, gridOrigin);
+
+  for(i = job->mStart; i < job->mEnd; ++ i)
   {
     // Get grid box origin
-    gridIdx = aSortVertices[i].mGridIndex;
-    _ctmGridIdxToPoint(aGrid, gridIdx, gridOrigin);
+    gridIdx = sortVertices[i].mGridIndex;
+    if(gridIdx != originIdx)
+    {
+      originIdx = gridIdx;
+      _ctmGridIdxToPoint(job->mGrid, gridIdx, gridOrigin);
+    }
 
     // Get old vertex coordinate index (before vertex sorting)
-    oldIdx = aSortVertices[i].mOriginalIndex;
+    oldIdx = sortVertices[i].mOriginalIndex;
+    if(i + _CTM_PREFETCH_DISTANCE < job->mEnd)
+      _CTM_PREFETCH(&vertices[sortVertices[i + _CTM_PREFETCH_DISTANCE].mOriginalIndex * 3]);
 
     // Store delta to the grid box origin in the integer vertex array. For the
     // X axis (which is sorted) we also do the delta to the previous coordinate
     // in the box.
-    deltaX = (CTMint) floorf(scale * (self->mVertices[oldIdx * 3] - gridOrigin[0]) + 0.5f);
+    deltaX = (CTMint) floorf(scale * (vertices[oldIdx * 3] - gridOrigin[0]) + 0.5f);
     if(gridIdx == prevGridIndex)
-      aIntVertices[i * 3] = deltaX - prevDeltaX;
+      intVertices[i * 3] = deltaX - prevDeltaX;
     else
-      aIntVertices[i * 3] = deltaX;
-    aIntVertices[i * 3 + 1] = (CTMint) floorf(scale * (self->mVertices[oldIdx * 3 + 1] - gridOrigin[1]) + 0.5f);
-    aIntVertices[i * 3 + 2] = (CTMint) floorf(scale * (self->mVertices[oldIdx * 3 + 2] - gridOrigin[2]) + 0.5f);
+      intVertices[i * 3] = deltaX;
+    intVertices[i * 3 + 1] = (CTMint) floorf(scale * (vertices[oldIdx * 3 + 1] - gridOrigin[1]) + 0.5f);
+    intVertices[i * 3 + 2] = (CTMint) floorf(scale * (vertices[oldIdx * 3 + 2] - gridOrigin[2]) + 0.5f);
 
     prevGridIndex = gridIdx;
     prevDeltaX = deltaX;
@@ -382,55 +816,187 @@ static void _ctmMakeVertexDeltas(_CTMcontext * self, CTMint * aIntVertices,
 }
 
 //-----------------------------------------------------------------------------
-// _ctmRestoreVertices() - Calculate inverse derivatives of the vertices.
+// _ctmMakeVertexDeltas() - Calculate various forms of derivatives in order to
+// reduce data entropy.
 //-----------------------------------------------------------------------------
-static void _ctmRestoreVertices(_CTMcontext * self, CTMint * aIntVertices,
-  CTMuint * aGridIndices, _CTMgrid * aGrid, CTMfloat * aVertices)
+static void _ctmMakeVertexDeltas(_CTMcontext * self, CTMint * aIntVertices,
+  _CTMsortvertex * aSortVertices, _CTMgrid * aGrid)
 {
-  CTMuint i, gridIdx, prevGridIndex;
-  CTMfloat gridOrigin[3], scale;
-  CTMint deltaX, prevDeltaX;
+  _CTMrangejob job;
+  CTMuint jobCount;
+  size_t mark;
 
-  scale = self->mVertexPrecision;
+  // Vertex scaling factor
+  job.mScale = 1.0f / self->mVertexPrecision;
+
+  mark = _ctmArenaMark(self);
+  job.mVertices = self->mVertices;
+  job.mGrid = aGrid;
+  job.mSortVertices = aSortVertices;
+  job.mIntData = aIntVertices;
+  _ctmRunRangeJobs(self, _ctmVertexDeltaJob, &job, self->mVertexCount,
+                   &jobCount);
+  _ctmArenaRelease(self, mark);
+}
 
-  prevGridIndex = 0x7fffffff;
-  prevDeltaX = 0;
-  for(i = 0; i < self->mVertexCount; ++ i)
+//-----------------------------------------------------------------------------
+// _ctmRestoreVertexRun() - Restore a run of aCount vertices that are in the
+// same grid box (with the origin aOrigin). The X coordinates are deltas to
+// the previous vertex of the run, so they are restored with a prefix sum.
+// The vertices are stored aStride floats apart in aVertices.
+//-----------------------------------------------------------------------------
+static void _ctmRestoreVertexRun(const CTMint * aIntVertices,
+  CTMfloat * aVertices, size_t aCount, CTMuint aStride, CTMfloat aScale,
+  const CTMfloat * aOrigin)
+{
+  size_t i = 0;
+  CTMint deltaX = 0;
+
+#ifdef _CTM_USE_SSE2
+  if(aCount >= 4)
   {
-    // Get grid box origin
-    gridIdx = aGridIndices[i];
-    _ctmGridIdxToPoint(aGrid, gridIdx, gridOrigin);
+    __m128i x, y, z, sumX;
+    __m128 scale, originX, originY, originZ;
+    CTMfloat fx[4], fy[4], fz[4];
+    const CTMint * src;
+    CTMfloat * dst;
+    CTMuint k;
+
+    scale = _mm_set1_ps(aScale);
+    originX = _mm_set1_ps(aOrigin[0]);
+    originY = _mm_set1_ps(aOrigin[1]);
+    originZ = _mm_set1_ps(aOrigin[2]);
+    sumX = _mm_setzero_si128();
+    for(; i + 4 <= aCount; i += 4)
+    {
+      src = &aIntVertices[i * 3];
+      x = _mm_setr_epi32(src[0], src[3], src[6], src[9]);
+      y = _mm_setr_epi32(src[1], src[4], src[7], src[10]);
+      z = _mm_setr_epi32(src[2], src[5], src[8], src[11]);
+
+      // Prefix sum of the X deltas (plus the sum of the earlier vertices)
+      x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+      x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+      x = _mm_add_epi32(x, sumX);
+      sumX = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+
+      // Same operations (and rounding) as in the scalar loop below
+      _mm_storeu_ps(fx, _mm_add_ps(_mm_mul_ps(scale, _mm_cvtepi32_ps(x)), originX));
+      _mm_storeu_ps(fy, _mm_add_ps(_mm_mul_ps(scale, _mm_cvtepi32_ps(y)), originY));
+      _mm_storeu_ps(fz, _mm_add_ps(_mm_mul_ps(scale, _mm_cvtepi32_ps(z)), originZ));
+      for(k = 0; k < 4; ++ k)
+      {
+        dst = &aVertices[(i + k) * aStride];
+        dst[0] = fx[k];
+        dst[1] = fy[k];
+        dst[2] = fz[k];
+      }
+    }
+    deltaX = _mm_cvtsi128_si32(sumX);
+  }
+#endif
 
-    // Restore original point
-    deltaX = aIntVertices[i * 3];
-    if(gridIdx == prevGridIndex)
-      deltaX += prevDeltaX;
-    aVertices[i * 3] = scale * deltaX + gridOrigin[0];
-    aVertices[i * 3 + 1] = scale * aIntVertices[i * 3 + 1] + gridOrigin[1];
-    aVertices[i * 3 + 2] = scale * aIntVertices[i * 3 + 2] + gridOrigin[2];
+  for(; i < aCount; ++ i)
+  {
+    deltaX += aIntVertices[i * 3];
+    aVertices[i * aStride] = aScale * deltaX + aOrigin[0];
+    aVertices[i * aStride + 1] = aScale * aIntVertices[i * 3 + 1] + aOrigin[1];
+    aVertices[i * aStride + 2] = aScale * aIntVertices[i * 3 + 2] + aOrigin[2];
+  }
+}
 
-    prevGridIndex = gridIdx;
-    prevDeltaX = deltaX;
+//-----------------------------------------------------------------------------
+// _ctmRestoreVertices() - Calculate inverse derivatives of the vertices. The
+// vertices are stored aStride floats apart in aVertices.
+//-----------------------------------------------------------------------------
+static void _ctmRestoreVertices(_CTMcontext * self, CTMint * aIntVertices,
+  CTMuint * aGridIndices, _CTMgrid * aGrid, CTMfloat * aVertices,
+  CTMuint aStride)
+{
+  CTMuint gridIdx;
+  size_t i, end;
+  CTMfloat gridOrigin[3];
+
+  // The vertices are sorted by grid index, so they come in runs of vertices
+  // in the same grid box. The box origin is calculated once per run.
+  for(i = 0; i < self->mVertexCount; i = end)
+  {
+    gridIdx = aGridIndices[i];
+    _ctmGridIdxToPoint(aGrid, gridIdx, gridOrigin);
+    end = i + 1;
+    while((end < self->mVertexCount) && (aGridIndices[end] == gridIdx))
+      ++ end;
+    _ctmRestoreVertexRun(&aIntVertices[i * 3], &aVertices[i * aStride],
+                         end - i, aStride, self->mVertexPrecision, gridOrigin);
   }
 }
 
 //-----------------------------------------------------------------------------
-// _ctmCalcSmoothNormals() - Calculate the smooth normals for a given mesh.
-// These are used as the nominal normals for normal deltas & reconstruction.
+// _ctmFlatNormals() - Calculate the flat (normalized) normals of aCount
+// triangles. The X, Y and Z components of the normals are stored in separate
+// arrays. The vertices are stored aStride floats apart in aVertices.
+// Note: The normals must be exactly the same as in the scalar code below (and
+//  as in earlier versions of the library), since the smooth normals that they
+//  add up to are used for coding the normals. SSE2 arithmetic is IEEE single
+//  precision, so the vectorized code gives the same result.
 //-----------------------------------------------------------------------------
-static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
-  CTMuint * aIndices, CTMfloat * aSmoothNormals)
+static void _ctmFlatNormals(const CTMfloat * aVertices, CTMuint aStride,
+  const CTMuint * aIndices, size_t aCount, CTMfloat * aNormalX,
+  CTMfloat * aNormalY, CTMfloat * aNormalZ)
 {
-  CTMuint i, j, k, tri[3];
+  size_t i, tri[3];
+  CTMuint j;
   CTMfloat len;
   CTMfloat v1[3], v2[3], n[3];
+#ifdef _CTM_USE_SSE2
+  CTMfloat p[3][3][4];
+  __m128 e1[3], e2[3], nx, ny, nz, l, mask, one, eps;
+
+  one = _mm_set1_ps(1.0f);
+  eps = _mm_set1_ps(1e-10f);
+  i = 0;
+  for(; i + 4 <= aCount; i += 4)
+  {
+    // Gather the corners of four triangles (one triangle per lane)
+    for(j = 0; j < 4; ++ j)
+    {
+      tri[0] = aIndices[(i + j) * 3] * (size_t) aStride;
+      tri[1] = aIndices[(i + j) * 3 + 1] * (size_t) aStride;
+      tri[2] = aIndices[(i + j) * 3 + 2] * (size_t) aStride;
+      p[0][0][j] = aVertices[tri[0]];
+      p[0][1][j] = aVertices[tri[0] + 1];
+      p[0][2][j] = aVertices[tri[0] + 2];
+      p[1][0][j] = aVertices[tri[1]];
+      p[1][1][j] = aVertices[tri[1] + 1];
+      p[1][2][j] = aVertices[tri[1] + 2];
+      p[2][0][j] = aVertices[tri[2]];
+      p[2][1][j] = aVertices[tri[2] + 1];
+      p[2][2][j] = aVertices[tri[2] + 2];
+    }
 
-  // Clear smooth normals array
-  for(i = 0; i < 3 * self->mVertexCount; ++ i)
-    aSmoothNormals[i] = 0.0f;
+    // Calculate the normalized cross product of two triangle edges
+    for(j = 0; j < 3; ++ j)
+    {
+      e1[j] = _mm_sub_ps(_mm_loadu_ps(p[1][j]), _mm_loadu_ps(p[0][j]));
+      e2[j] = _mm_sub_ps(_mm_loadu_ps(p[2][j]), _mm_loadu_ps(p[0][j]));
+    }
+    nx = _mm_sub_ps(_mm_mul_ps(e1[1], e2[2]), _mm_mul_ps(e1[2], e2[1]));
+    ny = _mm_sub_ps(_mm_mul_ps(e1[2], e2[0]), _mm_mul_ps(e1[0], e2[2]));
+    nz = _mm_sub_ps(_mm_mul_ps(e1[0], e2[1]), _mm_mul_ps(e1[1], e2[0]));
+    l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx),
+        _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+    mask = _mm_cmpgt_ps(l, eps);
+    l = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(one, l)),
+                  _mm_andnot_ps(mask, one));
+    _mm_storeu_ps(&aNormalX[i], _mm_mul_ps(nx, l));
+    _mm_storeu_ps(&aNormalY[i], _mm_mul_ps(ny, l));
+    _mm_storeu_ps(&aNormalZ[i], _mm_mul_ps(nz, l));
+  }
+#else
+  i = 0;
+#endif
 
-  // Calculate sums of all neigbouring triangle normals for each vertex
-  for(i = 0; i < self->mTriangleCount; ++ i)
+  for(; i < aCount; ++ i)
   {
     // Get triangle corner indices
     for(j = 0; j < 3; ++ j)
@@ -440,8 +1006,8 @@ static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
     // flat triangle normal)
     for(j = 0; j < 3; ++ j)
     {
-      v1[j] = aVertices[tri[1] * 3 + j] - aVertices[tri[0] * 3 + j];
-      v2[j] = aVertices[tri[2] * 3 + j] - aVertices[tri[0] * 3 + j];
+      v1[j] = aVertices[tri[1] * aStride + j] - aVertices[tri[0] * aStride + j];
+      v2[j] = aVertices[tri[2] * aStride + j] - aVertices[tri[0] * aStride + j];
     }
     n[0] = v1[1] * v2[2] - v1[2] * v2[1];
     n[1] = v1[2] * v2[0] - v1[0] * v2[2];
@@ -451,28 +1017,261 @@ static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
       len = 1.0f / len;
     else
       len = 1.0f;
-    for(j = 0; j < 3; ++ j)
-      n[j] *= len;
+    aNormalX[i] = n[0] * len;
+    aNormalY[i] = n[1] * len;
+    aNormalZ[i] = n[2] * len;
+  }
+}
 
-    // Add the flat normal to all three triangle vertices
-    for(k = 0; k < 3; ++ k)
-      for(j = 0; j < 3; ++ j)
-        aSmoothNormals[tri[k] * 3 + j] += n[j];
+//-----------------------------------------------------------------------------
+// _ctmFlatNormalJob() - Calculate the flat normals of a range of triangles.
+//-----------------------------------------------------------------------------
+static void _ctmFlatNormalJob(void * aJob)
+{
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  size_t n = job->mTriangleCount;
+
+  _ctmFlatNormals(job->mVertices, job->mStride, &job->mIndices[job->mStart * 3],
+                  job->mEnd - job->mStart, &job->mFaceNormals[job->mStart],
+                  &job->mFaceNormals[n + job->mStart],
+                  &job->mFaceNormals[2 * n + job->mStart]);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMapVertexTriangles() - Build a map from each vertex to the triangles
+// that use it (a triangle that uses a vertex twice is listed twice). The
+// triangles of vertex i are aTriangles[aEnd[i - 1]] to aTriangles[aEnd[i] - 1]
+// (starting at zero for the first vertex), in triangle order. Returns false
+// if there is not enough memory.
+//-----------------------------------------------------------------------------
+static int _ctmMapVertexTriangles(_CTMcontext * self, const CTMuint * aIndices,
+  CTMuint ** aTriangles, CTMuint ** aEnd)
+{
+  CTMuint * triangles, * end;
+  size_t i, n = self->mTriangleCount * 3;
+
+  // The list positions must fit in 32 bits
+  if((CTMuint64) n > 0xffffffff)
+    return CTM_FALSE;
+  end = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * (self->mVertexCount + 1));
+  triangles = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * n);
+  if(!end || !triangles)
+    return CTM_FALSE;
+
+  // Count the triangle corners of each vertex, and get the start of each
+  // list (end[i] is the start of the list of vertex i)
+  for(i = 0; i <= self->mVertexCount; ++ i)
+    end[i] = 0;
+  for(i = 0; i < n; ++ i)
+    ++ end[aIndices[i] + 1];
+  _ctmPrefixSum(self, end, self->mVertexCount + 1, 1, 1);
+
+  // Fill the lists in triangle order (this moves end[i] to the end of the
+  // list of vertex i)
+  for(i = 0; i < n; ++ i)
+    triangles[end[aIndices[i]] ++] = (CTMuint) (i / 3);
+
+  *aTriangles = triangles;
+  *aEnd = end;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSmoothNormalJob() - Calculate the smooth normals of a range of vertices.
+// Each normal is the sum of the flat normals of the triangles that use the
+// vertex, added up in triangle order. With a vertex to triangle map (see
+// _ctmMapVertexTriangles()), only the triangles of the vertices in the range
+// are visited. Otherwise the job must cover all vertices, and all triangles
+// are visited in order (if there is no array of flat normals, they are
+// calculated on the fly, block by block).
+//-----------------------------------------------------------------------------
+static void _ctmSmoothNormalJob(void * aJob)
+{
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  const CTMuint * indices = job->mIndices;
+  const CTMfloat * nx, * ny, * nz;
+  CTMfloat * normals = job->mSmoothNormals, block[3][_CTM_NORMAL_BLOCK];
+  CTMfloat sum[3];
+  size_t i, t, blockSize, n = job->mTriangleCount;
+  CTMuint k, idx, pos;
+#ifdef _CTM_USE_SSE2
+  __m128 a, b, c, x, y, z, l, mask, one, eps;
+#endif
+  CTMfloat len;
+
+  if(job->mVertexTriangles)
+  {
+    // Sum the flat normals of the triangles of each vertex
+    nx = job->mFaceNormals;
+    ny = &job->mFaceNormals[n];
+    nz = &job->mFaceNormals[2 * n];
+    pos = job->mStart ? job->mVertexTriEnd[job->mStart - 1] : 0;
+    for(i = job->mStart; i < job->mEnd; ++ i)
+    {
+      sum[0] = sum[1] = sum[2] = 0.0f;
+      for(; pos < job->mVertexTriEnd[i]; ++ pos)
+      {
+        t = job->mVertexTriangles[pos];
+        sum[0] += nx[t];
+        sum[1] += ny[t];
+        sum[2] += nz[t];
+      }
+      normals[i * 3] = sum[0];
+      normals[i * 3 + 1] = sum[1];
+      normals[i * 3 + 2] = sum[2];
+    }
+  }
+  else
+  {
+    // Clear smooth normals array
+    for(i = job->mStart * 3; i < job->mEnd * 3; ++ i)
+      normals[i] = 0.0f;
+
+    // Calculate sums of all neigbouring triangle normals for each vertex
+    for(t = 0; t < n; t += blockSize)
+    {
+      blockSize = (n - t < _CTM_NORMAL_BLOCK) ? n - t : _CTM_NORMAL_BLOCK;
+      if(job->mFaceNormals)
+      {
+        nx = &job->mFaceNormals[t];
+        ny = &job->mFaceNormals[n + t];
+        nz = &job->mFaceNormals[2 * n + t];
+      }
+      else
+      {
+        _ctmFlatNormals(job->mVertices, job->mStride, &indices[t * 3],
+                        blockSize, block[0], block[1], block[2]);
+        nx = block[0];
+        ny = block[1];
+        nz = block[2];
+      }
+
+      // Add the flat normals to the triangle vertices
+      for(i = 0; i < blockSize; ++ i)
+      {
+        for(k = 0; k < 3; ++ k)
+        {
+          idx = indices[(t + i) * 3 + k];
+          normals[idx * 3] += nx[i];
+          normals[idx * 3 + 1] += ny[i];
+          normals[idx * 3 + 2] += nz[i];
+        }
+      }
+    }
   }
 
   // Normalize the normal sums, which gives the unit length smooth normals
-  for(i = 0; i < self->mVertexCount; ++ i)
+  i = job->mStart;
+#ifdef _CTM_USE_SSE2
+  one = _mm_set1_ps(1.0f);
+  eps = _mm_set1_ps(1e-10f);
+  for(; i + 4 <= job->mEnd; i += 4)
+  {
+    // Transpose four XYZ normals (a = x0 y0 z0 x1, b = y1 z1 x2 y2,
+    // c = z2 x3 y3 z3) into one vector per component
+    a = _mm_loadu_ps(&normals[i * 3]);
+    b = _mm_loadu_ps(&normals[i * 3 + 4]);
+    c = _mm_loadu_ps(&normals[i * 3 + 8]);
+    x = _mm_shuffle_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 0, 0)),
+                       _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)),
+                       _MM_SHUFFLE(2, 0, 2, 0));
+    y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                       _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)),
+                       _MM_SHUFFLE(2, 0, 2, 0));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                       _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)),
+                       _MM_SHUFFLE(2, 0, 2, 0));
+
+    // Calculate the scaling factors, and scale the XYZ normals
+    l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+                               _mm_mul_ps(z, z)));
+    mask = _mm_cmpgt_ps(l, eps);
+    l = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(one, l)),
+                  _mm_andnot_ps(mask, one));
+    _mm_storeu_ps(&normals[i * 3], _mm_mul_ps(a,
+                  _mm_shuffle_ps(l, l, _MM_SHUFFLE(1, 0, 0, 0))));
+    _mm_storeu_ps(&normals[i * 3 + 4], _mm_mul_ps(b,
+                  _mm_shuffle_ps(l, l, _MM_SHUFFLE(2, 2, 1, 1))));
+    _mm_storeu_ps(&normals[i * 3 + 8], _mm_mul_ps(c,
+                  _mm_shuffle_ps(l, l, _MM_SHUFFLE(3, 3, 3, 2))));
+  }
+#endif
+  for(; i < job->mEnd; ++ i)
   {
-    len = sqrtf(aSmoothNormals[i * 3] * aSmoothNormals[i * 3] + 
-                aSmoothNormals[i * 3 + 1] * aSmoothNormals[i * 3 + 1] +
-                aSmoothNormals[i * 3 + 2] * aSmoothNormals[i * 3 + 2]);
+    len = sqrtf(normals[i * 3] * normals[i * 3] +
+                normals[i * 3 + 1] * normals[i * 3 + 1] +
+                normals[i * 3 + 2] * normals[i * 3 + 2]);
     if(len > 1e-10f)
       len = 1.0f / len;
     else
       len = 1.0f;
-    for(j = 0; j < 3; ++ j)
-      aSmoothNormals[i * 3 + j] *= len;
+    for(k = 0; k < 3; ++ k)
+      normals[i * 3 + k] *= len;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCalcSmoothNormals() - Calculate the smooth normals for a given mesh.
+// These are used as the nominal normals for normal deltas & reconstruction.
+// The vertices are stored aStride floats apart in aVertices.
+// With several threads (and enough memory), the flat triangle normals are
+// calculated first, and a map from each vertex to its triangles is built, so
+// that the smooth normals can be summed by several threads, each for a range
+// of vertices. Otherwise the calling thread sums them in one pass over the
+// triangles. Either way, the sums are added up in triangle order, as in
+// earlier versions of the library (the encoder and the decoder must get
+// exactly the same smooth normals).
+//-----------------------------------------------------------------------------
+static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
+  CTMuint aStride, CTMuint * aIndices, CTMfloat * aSmoothNormals)
+{
+  _CTMrangejob job;
+  CTMuint jobCount, * vertexTriangles, * vertexTriEnd;
+  size_t mark;
+
+  mark = _ctmArenaMark(self);
+  job.mVertices = aVertices;
+  job.mStride = aStride;
+  job.mIndices = aIndices;
+  job.mTriangleCount = self->mTriangleCount;
+  job.mSmoothNormals = aSmoothNormals;
+  job.mFaceNormals = (CTMfloat *) 0;
+  job.mVertexTriangles = (const CTMuint *) 0;
+  job.mVertexTriEnd = (const CTMuint *) 0;
+
+  // Calculate the flat triangle normals and map the vertices to their
+  // triangles (unless there is just one thread, which calculates the flat
+  // normals on the fly instead)
+  if((_ctmThreadCount(self) > 1) &&
+     (self->mVertexCount >= 2 * _CTM_RANGE_MIN_JOB) &&
+     (self->mTriangleCount <= ((size_t) -1) / (3 * sizeof(CTMfloat))))
+  {
+    job.mFaceNormals = (CTMfloat *) _ctmArenaAlloc(self, 3 * sizeof(CTMfloat) * self->mTriangleCount);
+    if(job.mFaceNormals)
+    {
+      _ctmRunRangeJobs(self, _ctmFlatNormalJob, &job, self->mTriangleCount,
+                       &jobCount);
+      if(_ctmMapVertexTriangles(self, aIndices, &vertexTriangles,
+                                &vertexTriEnd))
+      {
+        job.mVertexTriangles = vertexTriangles;
+        job.mVertexTriEnd = vertexTriEnd;
+      }
+    }
   }
+
+  // Sum and normalize the smooth normals
+  if(job.mVertexTriangles)
+    _ctmRunRangeJobs(self, _ctmSmoothNormalJob, &job, self->mVertexCount,
+                     &jobCount);
+  else
+  {
+    job.mStart = 0;
+    job.mEnd = self->mVertexCount;
+    _ctmSmoothNormalJob((void *) &job);
+  }
+
+  _ctmArenaRelease(self, mark);
 }
 
 //-----------------------------------------------------------------------------
@@ -528,12 +1327,15 @@ static void _ctmMakeNormalCoordSys(CTMfloat * aNormal, CTMfloat * aBasisAxes)
 static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
   CTMfloat * aVertices, CTMuint * aIndices, _CTMsortvertex * aSortVertices)
 {
-  CTMuint i, j, oldIdx, intPhi;
+  size_t i, oldIdx;
+  CTMuint j, intPhi;
   CTMfloat magn, phi, theta, scale, thetaScale;
   CTMfloat * smoothNormals, n[3], n2[3], basisAxes[9];
+  size_t mark;
 
   // Allocate temporary memory for the nominal vertex normals
-  smoothNormals = (CTMfloat *) malloc(3 * sizeof(CTMfloat) * self->mVertexCount);
+  mark = _ctmArenaMark(self);
+  smoothNormals = (CTMfloat *) _ctmArenaAlloc(self, 3 * sizeof(CTMfloat) * self->mVertexCount);
   if(!smoothNormals)
   {
     self->mError = CTM_OUT_OF_MEMORY;
@@ -542,7 +1344,7 @@ static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
 
   // Calculate smooth normals (Note: aVertices and aIndices use the sorted
   // index space, so smoothNormals will too)
-  _ctmCalcSmoothNormals(self, aVertices, aIndices, smoothNormals);
+  _ctmCalcSmoothNormals(self, aVertices, 3, aIndices, smoothNormals);
 
   // Normal scaling factor
   scale = 1.0f / self->mNormalPrecision;
@@ -601,7 +1403,7 @@ static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
   }
 
   // Free temporary resources
-  free(smoothNormals);
+  _ctmArenaRelease(self, mark);
 
   return CTM_TRUE;
 }
@@ -611,12 +1413,15 @@ static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
 //-----------------------------------------------------------------------------
 static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
 {
-  CTMuint i, j, intPhi;
+  size_t i;
+  CTMuint j, intPhi;
   CTMfloat magn, phi, theta, scale, thetaScale;
   CTMfloat * smoothNormals, n[3], n2[3], basisAxes[9];
+  size_t mark;
 
   // Allocate temporary memory for the nominal vertex normals
-  smoothNormals = (CTMfloat *) malloc(3 * sizeof(CTMfloat) * self->mVertexCount);
+  mark = _ctmArenaMark(self);
+  smoothNormals = (CTMfloat *) _ctmArenaAlloc(self, 3 * sizeof(CTMfloat) * self->mVertexCount);
   if(!smoothNormals)
   {
     self->mError = CTM_OUT_OF_MEMORY;
@@ -624,7 +1429,8 @@ static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
   }
 
   // Calculate smooth normals (nominal normals)
-  _ctmCalcSmoothNormals(self, self->mVertices, self->mIndices, smoothNormals);
+  _ctmCalcSmoothNormals(self, self->mVertices, self->mVertexStride,
+                        self->mIndices, smoothNormals);
 
   // Normal scaling factor
   scale = self->mNormalPrecision;
@@ -658,50 +1464,83 @@ static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
 
     // Apply normal magnitude, and output to the normals array
     for(j = 0; j < 3; ++ j)
-      self->mNormals[i * 3 + j] = n[j] * magn;
+      self->mNormals[i * self->mNormalStride + j] = n[j] * magn;
   }
 
   // Free temporary resources
-  free(smoothNormals);
+  _ctmArenaRelease(self, mark);
 
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmMakeUVCoordDeltas() - Calculate various forms of derivatives in order
-// to reduce data entropy.
+// _ctmUVCoordDeltaJob() - Calculate the UV coordinate deltas of a range of
+// sorted vertices (see _ctmMakeUVCoordDeltas()).
 //-----------------------------------------------------------------------------
-static void _ctmMakeUVCoordDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
-  CTMint * aIntUVCoords, _CTMsortvertex * aSortVertices)
+static void _ctmUVCoordDeltaJob(void * aJob)
 {
-  CTMuint i, oldIdx;
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  const _CTMsortvertex * sortVertices = job->mSortVertices;
+  const CTMfloat * values = job->mValues;
+  CTMint * intUVCoords = job->mIntData;
+  size_t i, oldIdx;
   CTMint u, v, prevU, prevV;
-  CTMfloat scale;
-
-  // UV coordinate scaling factor
-  scale = 1.0f / aMap->mPrecision;
+  CTMfloat scale = job->mScale;
 
+  // Start from the last UV coordinate of the previous range
   prevU = prevV = 0;
-  for(i = 0; i < self->mVertexCount; ++ i)
+  if(job->mStart > 0)
   {
-    // Get old UV coordinate index (before vertex sorting)
-    oldIdx = aSortVertices[i].mOriginalIndex;
+    oldIdx = sortVertices[job->mStart - 1].mOriginalIndex;
+    prevU = (CTMint) floorf(scale * values[oldIdx * 2] + 0.5f);
+    prevV = (CTMint) floorf(scale * values[oldIdx * 2 + 1] + 0.5f);
+  }
+
+  for(i = job->mStart; i < job->mEnd; ++ i)
+  {
+    // Get old UV coordinate index (before vertex sorting)
+    oldIdx = sortVertices[i].mOriginalIndex;
+    if(i + _CTM_PREFETCH_DISTANCE < job->mEnd)
+      _CTM_PREFETCH(&values[sortVertices[i + _CTM_PREFETCH_DISTANCE].mOriginalIndex * 2]);
 
     // Convert to fixed point
-    u = (CTMint) floorf(scale * aMap->mValues[oldIdx * 2] + 0.5f);
-    v = (CTMint) floorf(scale * aMap->mValues[oldIdx * 2 + 1] + 0.5f);
+    u = (CTMint) floorf(scale * values[oldIdx * 2] + 0.5f);
+    v = (CTMint) floorf(scale * values[oldIdx * 2 + 1] + 0.5f);
 
     // Calculate delta and store it in the converted array. NOTE: Here we rely
     // on the fact that vertices are sorted, and usually close to each other,
     // which means that UV coordinates should also be close to each other...
-    aIntUVCoords[i * 2] = u - prevU;
-    aIntUVCoords[i * 2 + 1] = v - prevV;
+    intUVCoords[i * 2] = u - prevU;
+    intUVCoords[i * 2 + 1] = v - prevV;
 
     prevU = u;
     prevV = v;
   }
 }
 
+//-----------------------------------------------------------------------------
+// _ctmMakeUVCoordDeltas() - Calculate various forms of derivatives in order
+// to reduce data entropy.
+//-----------------------------------------------------------------------------
+static void _ctmMakeUVCoordDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
+  CTMint * aIntUVCoords, _CTMsortvertex * aSortVertices)
+{
+  _CTMrangejob job;
+  CTMuint jobCount;
+  size_t mark;
+
+  // UV coordinate scaling factor
+  job.mScale = 1.0f / aMap->mPrecision;
+
+  mark = _ctmArenaMark(self);
+  job.mSortVertices = aSortVertices;
+  job.mValues = aMap->mValues;
+  job.mIntData = aIntUVCoords;
+  _ctmRunRangeJobs(self, _ctmUVCoordDeltaJob, &job, self->mVertexCount,
+                   &jobCount);
+  _ctmArenaRelease(self, mark);
+}
+
 //-----------------------------------------------------------------------------
 // _ctmRestoreUVCoords() - Calculate inverse derivatives of the UV
 // coordinates.
@@ -709,50 +1548,54 @@ static void _ctmMakeUVCoordDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
 static void _ctmRestoreUVCoords(_CTMcontext * self, _CTMfloatmap * aMap,
   CTMint * aIntUVCoords)
 {
-  CTMuint i;
-  CTMint u, v, prevU, prevV;
+  size_t i;
   CTMfloat scale;
 
   // UV coordinate scaling factor
   scale = aMap->mPrecision;
 
-  prevU = prevV = 0;
+  // Calculate inverse deltas
+  _ctmPrefixSum(self, (CTMuint *) aIntUVCoords, self->mVertexCount, 2, 2);
+
+  // Convert to floating point
   for(i = 0; i < self->mVertexCount; ++ i)
   {
-    // Calculate inverse delta
-    u = aIntUVCoords[i * 2] + prevU;
-    v = aIntUVCoords[i * 2 + 1] + prevV;
-
-    // Convert to floating point
-    aMap->mValues[i * 2] = (CTMfloat) u * scale;
-    aMap->mValues[i * 2 + 1] = (CTMfloat) v * scale;
-
-    prevU = u;
-    prevV = v;
+    aMap->mValues[i * aMap->mStride] = (CTMfloat) aIntUVCoords[i * 2] * scale;
+    aMap->mValues[i * aMap->mStride + 1] = (CTMfloat) aIntUVCoords[i * 2 + 1] * scale;
   }
 }
 
 //-----------------------------------------------------------------------------
-// _ctmMakeAttribDeltas() - Calculate various forms of derivatives in order
-// to reduce data entropy.
+// _ctmAttribDeltaJob() - Calculate the attribute deltas of a range of sorted
+// vertices (see _ctmMakeAttribDeltas()).
 //-----------------------------------------------------------------------------
-static void _ctmMakeAttribDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
-  CTMint * aIntAttribs, _CTMsortvertex * aSortVertices)
+static void _ctmAttribDeltaJob(void * aJob)
 {
-  CTMuint i, j, oldIdx;
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  const _CTMsortvertex * sortVertices = job->mSortVertices;
+  const CTMfloat * values = job->mValues;
+  CTMint * intAttribs = job->mIntData;
+  size_t i, oldIdx;
+  CTMuint j;
   CTMint value[4], prev[4];
-  CTMfloat scale;
-
-  // Attribute scaling factor
-  scale = 1.0f / aMap->mPrecision;
+  CTMfloat scale = job->mScale;
 
+  // Start from the last attribute of the previous range
   for(j = 0; j < 4; ++ j)
     prev[j] = 0;
+  if(job->mStart > 0)
+  {
+    oldIdx = sortVertices[job->mStart - 1].mOriginalIndex;
+    for(j = 0; j < 4; ++ j)
+      prev[j] = (CTMint) floorf(scale * values[oldIdx * 4 + j] + 0.5f);
+  }
 
-  for(i = 0; i < self->mVertexCount; ++ i)
+  for(i = job->mStart; i < job->mEnd; ++ i)
   {
     // Get old attribute index (before vertex sorting)
-    oldIdx = aSortVertices[i].mOriginalIndex;
+    oldIdx = sortVertices[i].mOriginalIndex;
+    if(i + _CTM_PREFETCH_DISTANCE < job->mEnd)
+      _CTM_PREFETCH(&values[sortVertices[i + _CTM_PREFETCH_DISTANCE].mOriginalIndex * 4]);
 
     // Convert to fixed point, and calculate delta and store it in the converted
     // array. NOTE: Here we rely on the fact that vertices are sorted, and
@@ -761,13 +1604,36 @@ static void _ctmMakeAttribDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
     // the geometry)...
     for(j = 0; j < 4; ++ j)
     {
-      value[j] = (CTMint) floorf(scale * aMap->mValues[oldIdx * 4 + j] + 0.5f);
-      aIntAttribs[i * 4 + j] = value[j] - prev[j];
+      value[j] = (CTMint) floorf(scale * values[oldIdx * 4 + j] + 0.5f);
+      intAttribs[i * 4 + j] = value[j] - prev[j];
       prev[j] = value[j];
     }
   }
 }
 
+//-----------------------------------------------------------------------------
+// _ctmMakeAttribDeltas() - Calculate various forms of derivatives in order
+// to reduce data entropy.
+//-----------------------------------------------------------------------------
+static void _ctmMakeAttribDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
+  CTMint * aIntAttribs, _CTMsortvertex * aSortVertices)
+{
+  _CTMrangejob job;
+  CTMuint jobCount;
+  size_t mark;
+
+  // Attribute scaling factor
+  job.mScale = 1.0f / aMap->mPrecision;
+
+  mark = _ctmArenaMark(self);
+  job.mSortVertices = aSortVertices;
+  job.mValues = aMap->mValues;
+  job.mIntData = aIntAttribs;
+  _ctmRunRangeJobs(self, _ctmAttribDeltaJob, &job, self->mVertexCount,
+                   &jobCount);
+  _ctmArenaRelease(self, mark);
+}
+
 //-----------------------------------------------------------------------------
 // _ctmRestoreAttribs() - Calculate inverse derivatives of the vertex
 // attributes.
@@ -775,81 +1641,86 @@ static void _ctmMakeAttribDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
 static void _ctmRestoreAttribs(_CTMcontext * self, _CTMfloatmap * aMap,
   CTMint * aIntAttribs)
 {
-  CTMuint i, j;
-  CTMint value[4], prev[4];
+  size_t i;
+  CTMuint j;
   CTMfloat scale;
 
   // Attribute scaling factor
   scale = aMap->mPrecision;
 
-  for(j = 0; j < 4; ++ j)
-    prev[j] = 0;
+  // Calculate inverse deltas
+  _ctmPrefixSum(self, (CTMuint *) aIntAttribs, self->mVertexCount, 4, 4);
 
+  // Convert to floating point
   for(i = 0; i < self->mVertexCount; ++ i)
   {
-    // Calculate inverse delta, and convert to floating point
     for(j = 0; j < 4; ++ j)
-    {
-      value[j] = aIntAttribs[i * 4 + j] + prev[j];
-      aMap->mValues[i * 4 + j] = (CTMfloat) value[j] * scale;
-      prev[j] = value[j];
-    }
+      aMap->mValues[i * aMap->mStride + j] = (CTMfloat) aIntAttribs[i * 4 + j] * scale;
   }
 }
 
 //-----------------------------------------------------------------------------
-// _ctmCompressMesh_MG2() - Compress the mesh that is stored in the CTM
-// context, and write it the the output stream in the CTM context.
+// _ctmScratchSize_MG2() - Estimate the amount of scratch arena memory that is
+// used by _ctmCompressMesh_MG2(): the sorted and restored vertices, plus the
+// largest set of temporary arrays that are used at the same time (including
+// the interleaved and packed arrays of _ctmStreamWritePackedInts()).
 //-----------------------------------------------------------------------------
-int _ctmCompressMesh_MG2(_CTMcontext * self)
+size_t _ctmScratchSize_MG2(_CTMcontext * self)
+{
+  size_t nv, nt, size;
+
+  nv = self->mVertexCount;
+  nt = self->mTriangleCount;
+
+  // Vertices & grid indices: intVertices + interleaved + packed
+  size = 36 * nv;
+
+  // Triangle indices: indices + deltaIndices + interleaved + packed
+  if(48 * nt > size)
+    size = 48 * nt;
+
+  // Normals and maps: indices + intNormals/intAttribs + interleaved + packed
+  if(12 * nt + 48 * nv > size)
+    size = 12 * nt + 48 * nv;
+
+  return sizeof(_CTMsortvertex) * nv + 12 * nv + size +
+         1000 + 16 * _CTM_ARENA_ALIGN;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmWriteArrays_MG2() - Convert the mesh arrays to the MG2 representation,
+// and write them to the output stream. The temporary arrays are allocated
+// from the scratch arena, and released by the caller.
+//-----------------------------------------------------------------------------
+static int _ctmWriteArrays_MG2(_CTMcontext * self, _CTMgrid * aGrid)
 {
-  _CTMgrid grid;
   _CTMsortvertex * sortVertices;
   _CTMfloatmap * map;
   CTMuint * indices, * deltaIndices, * gridIndices;
   CTMint * intVertices, * intNormals, * intUVCoords, * intAttribs;
   CTMfloat * restoredVertices;
-  CTMuint i;
-
-#ifdef __DEBUG_
-  printf("COMPRESSION METHOD: MG2\n");
-#endif
-
-  // Setup 3D space subdivision grid
-  _ctmSetupGrid(self, &grid);
+  size_t mark, i;
 
-  // Write MG2-specific header information to the stream
-  _ctmStreamWrite(self, (void *) "MG2H", 4);
-  _ctmStreamWriteFLOAT(self, self->mVertexPrecision);
-  _ctmStreamWriteFLOAT(self, self->mNormalPrecision);
-  _ctmStreamWriteFLOAT(self, grid.mMin[0]);
-  _ctmStreamWriteFLOAT(self, grid.mMin[1]);
-  _ctmStreamWriteFLOAT(self, grid.mMin[2]);
-  _ctmStreamWriteFLOAT(self, grid.mMax[0]);
-  _ctmStreamWriteFLOAT(self, grid.mMax[1]);
-  _ctmStreamWriteFLOAT(self, grid.mMax[2]);
-  _ctmStreamWriteUINT(self, grid.mDivision[0]);
-  _ctmStreamWriteUINT(self, grid.mDivision[1]);
-  _ctmStreamWriteUINT(self, grid.mDivision[2]);
-
-  // Prepare (sort) vertices
-  sortVertices = (_CTMsortvertex *) malloc(sizeof(_CTMsortvertex) * self->mVertexCount);
-  if(!sortVertices)
+  // Prepare (sort) vertices. The restored vertices are used throughout, so
+  // they are allocated here too (below the temporary vertex arrays).
+  sortVertices = (_CTMsortvertex *) _ctmArenaAlloc(self, sizeof(_CTMsortvertex) * self->mVertexCount);
+  restoredVertices = (CTMfloat *) _ctmArenaAlloc(self, sizeof(CTMfloat) * 3 * self->mVertexCount);
+  if(!sortVertices || !restoredVertices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
-  _ctmSortVertices(self, sortVertices, &grid);
+  _ctmSortVertices(self, sortVertices, aGrid);
 
   // Convert vertices to integers and calculate vertex deltas (entropy-reduction)
-  intVertices = (CTMint *) malloc(sizeof(CTMint) * 3 * self->mVertexCount);
+  mark = _ctmArenaMark(self);
+  intVertices = (CTMint *) _ctmArenaAlloc(self, sizeof(CTMint) * 3 * self->mVertexCount);
   if(!intVertices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) sortVertices);
     return CTM_FALSE;
   }
-  _ctmMakeVertexDeltas(self, intVertices, sortVertices, &grid);
+  _ctmMakeVertexDeltas(self, intVertices, sortVertices, aGrid);
 
   // Write vertices
 #ifdef __DEBUG_
@@ -857,19 +1728,13 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
 #endif
   _ctmStreamWrite(self, (void *) "VERT", 4);
   if(!_ctmStreamWritePackedInts(self, intVertices, self->mVertexCount, 3, CTM_FALSE))
-  {
-    free((void *) intVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
 
   // Prepare grid indices (deltas)
-  gridIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
+  gridIndices = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * self->mVertexCount);
   if(!gridIndices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) intVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
   }
   gridIndices[0] = sortVertices[0].mGridIndex;
@@ -882,65 +1747,39 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
 #endif
   _ctmStreamWrite(self, (void *) "GIDX", 4);
   if(!_ctmStreamWritePackedInts(self, (CTMint *) gridIndices, self->mVertexCount, 1, CTM_FALSE))
-  {
-    free((void *) gridIndices);
-    free((void *) intVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
 
   // Calculate the result of the compressed -> decompressed vertices, in order
   // to use the same vertex data for calculating nominal normals as the
   // decompression routine (i.e. compensate for the vertex error when
   // calculating the normals)
-  restoredVertices = (CTMfloat *) malloc(sizeof(CTMfloat) * 3 * self->mVertexCount);
-  if(!restoredVertices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) gridIndices);
-    free((void *) intVertices);
-    free((void *) sortVertices);
-    return CTM_FALSE;
-  }
-  for(i = 1; i < self->mVertexCount; ++ i)
-    gridIndices[i] += gridIndices[i - 1];
-  _ctmRestoreVertices(self, intVertices, gridIndices, &grid, restoredVertices);
+  _ctmPrefixSum(self, gridIndices, self->mVertexCount, 1, 1);
+  _ctmRestoreVertices(self, intVertices, gridIndices, aGrid, restoredVertices,
+                      3);
 
   // Free temporary resources
-  free((void *) gridIndices);
-  free((void *) intVertices);
+  _ctmArenaRelease(self, mark);
 
   // Perpare (sort) indices
-  indices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
+  indices = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * self->mTriangleCount * 3);
   if(!indices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
   }
   if(!_ctmReIndexIndices(self, sortVertices, indices))
-  {
-    free((void *) indices);
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
   _ctmReArrangeTriangles(self, indices);
 
   // Calculate index deltas (entropy-reduction)
-  deltaIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
-  if(!indices)
+  mark = _ctmArenaMark(self);
+  deltaIndices = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * self->mTriangleCount * 3);
+  if(!deltaIndices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) indices);
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
   }
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    deltaIndices[i] = indices[i];
-  _ctmMakeIndexDeltas(self, deltaIndices);
+  _ctmMakeIndexDeltas(self, indices, deltaIndices);
 
   // Write triangle indices
 #ifdef __DEBUG_
@@ -948,37 +1787,22 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
 #endif
   _ctmStreamWrite(self, (void *) "INDX", 4);
   if(!_ctmStreamWritePackedInts(self, (CTMint *) deltaIndices, self->mTriangleCount, 3, CTM_FALSE))
-  {
-    free((void *) deltaIndices);
-    free((void *) indices);
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
 
   // Free temporary data for the indices
-  free((void *) deltaIndices);
+  _ctmArenaRelease(self, mark);
 
   if(self->mNormals)
   {
     // Convert normals to integers and calculate deltas (entropy-reduction)
-    intNormals = (CTMint *) malloc(sizeof(CTMint) * 3 * self->mVertexCount);
+    intNormals = (CTMint *) _ctmArenaAlloc(self, sizeof(CTMint) * 3 * self->mVertexCount);
     if(!intNormals)
     {
       self->mError = CTM_OUT_OF_MEMORY;
-      free((void *) indices);
-      free((void *) restoredVertices);
-      free((void *) sortVertices);
       return CTM_FALSE;
     }
     if(!_ctmMakeNormalDeltas(self, intNormals, restoredVertices, indices, sortVertices))
-    {
-      free((void *) indices);
-      free((void *) intNormals);
-      free((void *) restoredVertices);
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
 
     // Write normals
 #ifdef __DEBUG_
@@ -986,32 +1810,21 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
 #endif
     _ctmStreamWrite(self, (void *) "NORM", 4);
     if(!_ctmStreamWritePackedInts(self, intNormals, self->mVertexCount, 3, CTM_FALSE))
-    {
-      free((void *) indices);
-      free((void *) intNormals);
-      free((void *) restoredVertices);
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
 
     // Free temporary normal data
-    free((void *) intNormals);
+    _ctmArenaRelease(self, mark);
   }
 
-  // Free restored indices and vertices
-  free((void *) indices);
-  free((void *) restoredVertices);
-
   // Write UV maps
   map = self->mUVMaps;
   while(map)
   {
     // Convert UV coordinates to integers and calculate deltas (entropy-reduction)
-    intUVCoords = (CTMint *) malloc(sizeof(CTMint) * 2 * self->mVertexCount);
+    intUVCoords = (CTMint *) _ctmArenaAlloc(self, sizeof(CTMint) * 2 * self->mVertexCount);
     if(!intUVCoords)
     {
       self->mError = CTM_OUT_OF_MEMORY;
-      free((void *) sortVertices);
       return CTM_FALSE;
     }
     _ctmMakeUVCoordDeltas(self, map, intUVCoords, sortVertices);
@@ -1025,14 +1838,10 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
     _ctmStreamWriteSTRING(self, map->mFileName);
     _ctmStreamWriteFLOAT(self, map->mPrecision);
     if(!_ctmStreamWritePackedInts(self, intUVCoords, self->mVertexCount, 2, CTM_TRUE))
-    {
-      free((void *) intUVCoords);
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
 
     // Free temporary UV coordinate data
-    free((void *) intUVCoords);
+    _ctmArenaRelease(self, mark);
 
     map = map->mNext;
   }
@@ -1042,11 +1851,10 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
   while(map)
   {
     // Convert vertex attributes to integers and calculate deltas (entropy-reduction)
-    intAttribs = (CTMint *) malloc(sizeof(CTMint) * 4 * self->mVertexCount);
+    intAttribs = (CTMint *) _ctmArenaAlloc(self, sizeof(CTMint) * 4 * self->mVertexCount);
     if(!intAttribs)
     {
       self->mError = CTM_OUT_OF_MEMORY;
-      free((void *) sortVertices);
       return CTM_FALSE;
     }
     _ctmMakeAttribDeltas(self, map, intAttribs, sortVertices);
@@ -1059,34 +1867,502 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteFLOAT(self, map->mPrecision);
     if(!_ctmStreamWritePackedInts(self, intAttribs, self->mVertexCount, 4, CTM_TRUE))
-    {
-      free((void *) intAttribs);
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
 
     // Free temporary vertex attribute data
-    free((void *) intAttribs);
+    _ctmArenaRelease(self, mark);
 
     map = map->mNext;
   }
 
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCompressMesh_MG2() - Compress the mesh that is stored in the CTM
+// context, and write it the the output stream in the CTM context.
+//-----------------------------------------------------------------------------
+int _ctmCompressMesh_MG2(_CTMcontext * self)
+{
+  _CTMgrid grid;
+  size_t mark;
+  int ok;
+
+#ifdef __DEBUG_
+  printf("COMPRESSION METHOD: MG2\n");
+#endif
+
+  // Setup 3D space subdivision grid
+  _ctmSetupGrid(self, &grid);
+
+  // Write MG2-specific header information to the stream
+  _ctmStreamWrite(self, (void *) "MG2H", 4);
+  _ctmStreamWriteFLOAT(self, self->mVertexPrecision);
+  _ctmStreamWriteFLOAT(self, self->mNormalPrecision);
+  _ctmStreamWriteFLOAT(self, grid.mMin[0]);
+  _ctmStreamWriteFLOAT(self, grid.mMin[1]);
+  _ctmStreamWriteFLOAT(self, grid.mMin[2]);
+  _ctmStreamWriteFLOAT(self, grid.mMax[0]);
+  _ctmStreamWriteFLOAT(self, grid.mMax[1]);
+  _ctmStreamWriteFLOAT(self, grid.mMax[2]);
+  _ctmStreamWriteUINT(self, grid.mDivision[0]);
+  _ctmStreamWriteUINT(self, grid.mDivision[1]);
+  _ctmStreamWriteUINT(self, grid.mDivision[2]);
+
+  // Write the arrays (all temporary memory is taken from the scratch arena,
+  // which is kept in the context for the next save)
+  _ctmArenaReserve(self, _ctmScratchSize_MG2(self));
+  mark = _ctmArenaMark(self);
+  ok = _ctmWriteArrays_MG2(self, &grid);
+  _ctmArenaRelease(self, mark);
+
+  return ok;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressArray_MG2() - Uncompress a single array (the normals, or the
+// values of a UV/attribute map) from the current stream position. aArray is
+// CTM_NORMALS, CTM_UV_MAP_1 or CTM_ATTRIB_MAP_1, and the destination array
+// must have been allocated. Used for arrays that are loaded on demand.
+//-----------------------------------------------------------------------------
+int _ctmUncompressArray_MG2(_CTMcontext * self, CTMenum aArray,
+  _CTMfloatmap * aMap)
+{
+  CTMint * intData;
+  CTMuint channels;
+  CTMint ok = CTM_TRUE;
+  size_t mark;
+
+  switch(aArray)
+  {
+    case CTM_NORMALS:
+      channels = 3;
+      break;
+    case CTM_UV_MAP_1:
+      channels = 2;
+      break;
+    case CTM_ATTRIB_MAP_1:
+      channels = 4;
+      break;
+    default:
+      self->mError = CTM_INTERNAL_ERROR;
+      return CTM_FALSE;
+  }
+
+  // Read the integer representation of the array (the normals also need
+  // the temporary smooth normals)
+  _ctmArenaReserve(self, (sizeof(CTMint) * channels + 3 * sizeof(CTMfloat)) *
+                   self->mVertexCount + 2 * _CTM_ARENA_ALIGN);
+  mark = _ctmArenaMark(self);
+  intData = (CTMint *) _ctmArenaAlloc(self, sizeof(CTMint) * self->mVertexCount * channels);
+  if(!intData)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  if(!_ctmStreamReadPackedInts(self, intData, self->mVertexCount, channels,
+                               aArray != CTM_NORMALS))
+  {
+    _ctmArenaRelease(self, mark);
+    return CTM_FALSE;
+  }
+
+  // Restore the array
+  switch(aArray)
+  {
+    case CTM_NORMALS:
+      ok = _ctmRestoreNormals(self, intData);
+      break;
+    case CTM_UV_MAP_1:
+      _ctmRestoreUVCoords(self, aMap, intData);
+      break;
+    default:
+      _ctmRestoreAttribs(self, aMap, intData);
+  }
+
   // Free temporary data
-  free((void *) sortVertices);
+  _ctmArenaRelease(self, mark);
+
+  return ok;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadArray_MG2() - Read the packed data of a normal/UV/attribute array.
+// If the array has not been allocated, it is skipped (its position is
+// remembered if it is loaded on demand).
+//-----------------------------------------------------------------------------
+static int _ctmReadArray_MG2(_CTMcontext * self, CTMenum aArray,
+  _CTMfloatmap * aMap)
+{
+  CTMint loaded, pending;
+  size_t * offset;
+
+  if(aArray == CTM_NORMALS)
+  {
+    loaded = self->mNormals ? CTM_TRUE : CTM_FALSE;
+    pending = self->mNormalsPending;
+    offset = &self->mNormalsOffset;
+  }
+  else
+  {
+    loaded = aMap->mValues ? CTM_TRUE : CTM_FALSE;
+    pending = aMap->mPending;
+    offset = &aMap->mOffset;
+  }
+
+  if(loaded)
+    return _ctmUncompressArray_MG2(self, aArray, aMap);
+
+  if(pending)
+    *offset = _ctmStreamTell(self);
+  return _ctmStreamSkipPacked(self);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSkipArrays_MG2() - Walk past the packed arrays of an MG2 stream without
+// uncompressing them (header only mode). The map names and precisions are
+// still read.
+//-----------------------------------------------------------------------------
+static int _ctmSkipArrays_MG2(_CTMcontext * self)
+{
+  _CTMfloatmap * map;
+  static const char * chunks[3] = { "VERT", "GIDX", "INDX" };
+  CTMuint i;
+
+  // Skip vertices, grid indices and triangle indices
+  for(i = 0; i < 3; ++ i)
+  {
+    if(_ctmStreamReadUINT(self) != FOURCC(chunks[i]))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(!_ctmStreamSkipPacked(self))
+      return CTM_FALSE;
+  }
+
+  // Skip normals
+  if(self->mHasNormals)
+  {
+    if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(!_ctmStreamSkipPacked(self))
+      return CTM_FALSE;
+  }
+
+  // Skip UV maps
+  map = self->mUVMaps;
+  while(map)
+  {
+    if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    _ctmStreamReadSTRING(self, &map->mFileName);
+    map->mPrecision = _ctmStreamReadFLOAT(self);
+    if(map->mPrecision <= 0.0f)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(!_ctmStreamSkipPacked(self))
+      return CTM_FALSE;
+    map = map->mNext;
+  }
+
+  // Skip vertex attribute maps
+  map = self->mAttribMaps;
+  while(map)
+  {
+    if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    map->mPrecision = _ctmStreamReadFLOAT(self);
+    if(map->mPrecision <= 0.0f)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(!_ctmStreamSkipPacked(self))
+      return CTM_FALSE;
+    map = map->mNext;
+  }
 
   return CTM_TRUE;
 }
 
+//-----------------------------------------------------------------------------
+// _ctmLocateArrays_MG2() - Read the packed arrays of an MG2 stream into the
+// integer arrays in aIntData (used together with _ctmStreamBeginBatch(), so
+// the arrays are not uncompressed yet). aIntData holds the vertices (3 ints
+// per vertex), the grid indices (1), and then the loaded normals (3), UV maps
+// (2) and attribute maps (4), in file order.
+//-----------------------------------------------------------------------------
+static int _ctmLocateArrays_MG2(_CTMcontext * self, CTMint * aIntData)
+{
+  _CTMfloatmap * map;
+  CTMint * intData = aIntData;
+
+  // Read vertices
+  if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  if(!_ctmStreamReadPackedInts(self, intData, self->mVertexCount, 3, CTM_FALSE))
+    return CTM_FALSE;
+  intData += self->mVertexCount * 3;
+
+  // Read grid indices
+  if(_ctmStreamReadUINT(self) != FOURCC("GIDX"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  if(!_ctmStreamReadPackedInts(self, intData, self->mVertexCount, 1, CTM_FALSE))
+    return CTM_FALSE;
+  intData += self->mVertexCount;
+
+  // Read triangle indices
+  if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  if(!_ctmStreamReadPackedInts(self, (CTMint *) self->mIndices, self->mTriangleCount, 3, CTM_FALSE))
+    return CTM_FALSE;
+
+  // Read normals
+  if(self->mHasNormals)
+  {
+    if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(self->mNormals)
+    {
+      if(!_ctmStreamReadPackedInts(self, intData, self->mVertexCount, 3, CTM_FALSE))
+        return CTM_FALSE;
+      intData += self->mVertexCount * 3;
+    }
+    else
+    {
+      if(self->mNormalsPending)
+        self->mNormalsOffset = _ctmStreamTell(self);
+      if(!_ctmStreamSkipPacked(self))
+        return CTM_FALSE;
+    }
+  }
+
+  // Read UV maps
+  map = self->mUVMaps;
+  while(map)
+  {
+    if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    _ctmStreamReadSTRING(self, &map->mFileName);
+    map->mPrecision = _ctmStreamReadFLOAT(self);
+    if(map->mPrecision <= 0.0f)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(map->mValues)
+    {
+      if(!_ctmStreamReadPackedInts(self, intData, self->mVertexCount, 2, CTM_TRUE))
+        return CTM_FALSE;
+      intData += self->mVertexCount * 2;
+    }
+    else
+    {
+      if(map->mPending)
+        map->mOffset = _ctmStreamTell(self);
+      if(!_ctmStreamSkipPacked(self))
+        return CTM_FALSE;
+    }
+    map = map->mNext;
+  }
+
+  // Read vertex attribute maps
+  map = self->mAttribMaps;
+  while(map)
+  {
+    if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    map->mPrecision = _ctmStreamReadFLOAT(self);
+    if(map->mPrecision <= 0.0f)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(map->mValues)
+    {
+      if(!_ctmStreamReadPackedInts(self, intData, self->mVertexCount, 4, CTM_TRUE))
+        return CTM_FALSE;
+      intData += self->mVertexCount * 4;
+    }
+    else
+    {
+      if(map->mPending)
+        map->mOffset = _ctmStreamTell(self);
+      if(!_ctmStreamSkipPacked(self))
+        return CTM_FALSE;
+    }
+    map = map->mNext;
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreArrays_MG2() - Restore the mesh arrays from the integer arrays
+// that were read by _ctmLocateArrays_MG2(). The vertices must be restored
+// before the normals, since the normals are relative to the smooth normals of
+// the mesh.
+//-----------------------------------------------------------------------------
+static int _ctmRestoreArrays_MG2(_CTMcontext * self, _CTMgrid * aGrid,
+  CTMint * aIntData)
+{
+  _CTMfloatmap * map;
+  CTMint * intVertices, * intData;
+  CTMuint * gridIndices;
+  size_t i;
+
+  intVertices = aIntData;
+  gridIndices = (CTMuint *) &aIntData[self->mVertexCount * 3];
+  intData = &aIntData[self->mVertexCount * 4];
+
+  // Restore grid indices (deltas)
+  _ctmPrefixSum(self, gridIndices, self->mVertexCount, 1, 1);
+
+  // Restore vertices
+  _ctmRestoreVertices(self, intVertices, gridIndices, aGrid, self->mVertices,
+                      self->mVertexStride);
+
+  // Restore indices
+  _ctmRestoreIndices(self, self->mIndices);
+
+  // Check that all indices are within range
+  for(i = 0; i < (self->mTriangleCount * 3); ++ i)
+  {
+    if(self->mIndices[i] >= self->mVertexCount)
+    {
+      self->mError = CTM_INVALID_MESH;
+      return CTM_FALSE;
+    }
+  }
+
+  // Restore normals
+  if(self->mNormals)
+  {
+    if(!_ctmRestoreNormals(self, intData))
+      return CTM_FALSE;
+    intData += self->mVertexCount * 3;
+  }
+
+  // Restore UV maps
+  for(map = self->mUVMaps; map; map = map->mNext)
+  {
+    if(map->mValues)
+    {
+      _ctmRestoreUVCoords(self, map, intData);
+      intData += self->mVertexCount * 2;
+    }
+  }
+
+  // Restore vertex attribute maps
+  for(map = self->mAttribMaps; map; map = map->mNext)
+  {
+    if(map->mValues)
+    {
+      _ctmRestoreAttribs(self, map, intData);
+      intData += self->mVertexCount * 4;
+    }
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressArrays_MG2() - Multi-threaded version of the array part of
+// _ctmUncompressMesh_MG2(). All the packed arrays are located first, then
+// they are uncompressed concurrently, and finally the mesh is restored. All
+// the integer arrays are kept in memory at the same time.
+//-----------------------------------------------------------------------------
+static int _ctmUncompressArrays_MG2(_CTMcontext * self, _CTMgrid * aGrid)
+{
+  _CTMfloatmap * map;
+  CTMint * intData;
+  size_t channels, mark;
+  CTMint ok;
+
+  // Count the integer channels (vertices + grid indices + loaded maps)
+  channels = 4;
+  if(self->mNormals)
+    channels += 3;
+  for(map = self->mUVMaps; map; map = map->mNext)
+    if(map->mValues)
+      channels += 2;
+  for(map = self->mAttribMaps; map; map = map->mNext)
+    if(map->mValues)
+      channels += 4;
+
+  // Allocate memory for all the integer arrays (and the smooth normals)
+  _ctmArenaReserve(self, (sizeof(CTMint) * channels + 3 * sizeof(CTMfloat)) *
+                   self->mVertexCount + 2 * _CTM_ARENA_ALIGN);
+  mark = _ctmArenaMark(self);
+  intData = (CTMint *) _ctmArenaAlloc(self, sizeof(CTMint) * self->mVertexCount * channels);
+  if(!intData)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+
+  // Locate & uncompress the packed arrays
+  _ctmStreamBeginBatch(self);
+  ok = _ctmLocateArrays_MG2(self, intData);
+  if(!_ctmStreamEndBatch(self, ok))
+    ok = CTM_FALSE;
+
+  // Restore the mesh
+  if(ok)
+    ok = _ctmRestoreArrays_MG2(self, aGrid, intData);
+
+  // Free temporary resources
+  _ctmArenaRelease(self, mark);
+
+  return ok;
+}
+
 //-----------------------------------------------------------------------------
 // _ctmUncompressMesh_MG2() - Uncmpress the mesh from the input stream in the
 // CTM context, and store the resulting mesh in the CTM context.
 //-----------------------------------------------------------------------------
 int _ctmUncompressMesh_MG2(_CTMcontext * self)
 {
-  CTMuint * gridIndices, i;
-  CTMint * intVertices, * intNormals, * intUVCoords, * intAttribs;
+  CTMuint * gridIndices;
+  size_t i;
+  CTMint * intVertices;
   _CTMfloatmap * map;
   _CTMgrid grid;
+  size_t mark;
 
   // Read MG2-specific header information from the stream
   if(_ctmStreamReadUINT(self) != FOURCC("MG2H"))
@@ -1128,17 +2404,36 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     return CTM_FALSE;
   }
 
+  // The grid bounds are the bounding box of the mesh
+  for(i = 0; i < 3; ++ i)
+  {
+    self->mAABB[i] = grid.mMin[i];
+    self->mAABB[i + 3] = grid.mMax[i];
+  }
+  self->mHasAABB = CTM_TRUE;
+
+  // In header only mode, we are done with the MG2 header
+  if(self->mHeaderOnly)
+    return _ctmSkipArrays_MG2(self);
+
   // Initialize 3D space subdivision grid
   for(i = 0; i < 3; ++ i)
     grid.mSize[i] = (grid.mMax[i] - grid.mMin[i]) / grid.mDivision[i];
 
+  // With several threads, the packed arrays are uncompressed concurrently
+  if(_ctmThreadCount(self) > 1)
+    return _ctmUncompressArrays_MG2(self, &grid);
+
   // Read vertices
   if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
   {
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  intVertices = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 3);
+  _ctmArenaReserve(self, 4 * sizeof(CTMint) * self->mVertexCount +
+                   2 * _CTM_ARENA_ALIGN);
+  mark = _ctmArenaMark(self);
+  intVertices = (CTMint *) _ctmArenaAlloc(self, sizeof(CTMint) * self->mVertexCount * 3);
   if(!intVertices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
@@ -1146,41 +2441,39 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
   }
   if(!_ctmStreamReadPackedInts(self, intVertices, self->mVertexCount, 3, CTM_FALSE))
   {
-    free((void *) intVertices);
+    _ctmArenaRelease(self, mark);
     return CTM_FALSE;
   }
 
   // Read grid indices
   if(_ctmStreamReadUINT(self) != FOURCC("GIDX"))
   {
-    free((void *) intVertices);
+    _ctmArenaRelease(self, mark);
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  gridIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
+  gridIndices = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * self->mVertexCount);
   if(!gridIndices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) intVertices);
+    _ctmArenaRelease(self, mark);
     return CTM_FALSE;
   }
   if(!_ctmStreamReadPackedInts(self, (CTMint *) gridIndices, self->mVertexCount, 1, CTM_FALSE))
   {
-    free((void *) gridIndices);
-    free((void *) intVertices);
+    _ctmArenaRelease(self, mark);
     return CTM_FALSE;
   }
 
   // Restore grid indices (deltas)
-  for(i = 1; i < self->mVertexCount; ++ i)
-    gridIndices[i] += gridIndices[i - 1];
+  _ctmPrefixSum(self, gridIndices, self->mVertexCount, 1, 1);
 
   // Restore vertices
-  _ctmRestoreVertices(self, intVertices, gridIndices, &grid, self->mVertices);
+  _ctmRestoreVertices(self, intVertices, gridIndices, &grid, self->mVertices,
+                      self->mVertexStride);
 
   // Free temporary resources
-  free((void *) gridIndices);
-  free((void *) intVertices);
+  _ctmArenaRelease(self, mark);
 
   // Read triangle indices
   if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
@@ -1205,51 +2498,24 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
   }
 
   // Read normals
-  if(self->mNormals)
+  if(self->mHasNormals)
   {
-    intNormals = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 3);
-    if(!intNormals)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
-    }
     if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intNormals);
-      return CTM_FALSE;
-    }
-    if(!_ctmStreamReadPackedInts(self, intNormals, self->mVertexCount, 3, CTM_FALSE))
-    {
-      free((void *) intNormals);
       return CTM_FALSE;
     }
-
-    // Restore normals
-    if(!_ctmRestoreNormals(self, intNormals))
-    {
-      free((void *) intNormals);
+    if(!_ctmReadArray_MG2(self, CTM_NORMALS, (_CTMfloatmap *) 0))
       return CTM_FALSE;
-    }
-
-    // Free temporary normals data
-    free((void *) intNormals);
   }
 
   // Read UV maps
   map = self->mUVMaps;
   while(map)
   {
-    intUVCoords = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 2);
-    if(!intUVCoords)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
-    }
     if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intUVCoords);
       return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
@@ -1258,21 +2524,10 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(map->mPrecision <= 0.0f)
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intUVCoords);
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedInts(self, intUVCoords, self->mVertexCount, 2, CTM_TRUE))
-    {
-      free((void *) intUVCoords);
+    if(!_ctmReadArray_MG2(self, CTM_UV_MAP_1, map))
       return CTM_FALSE;
-    }
-
-    // Restore UV coordinates
-    _ctmRestoreUVCoords(self, map, intUVCoords);
-
-    // Free temporary UV coordinate data
-    free((void *) intUVCoords);
-
     map = map->mNext;
   }
 
@@ -1280,16 +2535,9 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
   map = self->mAttribMaps;
   while(map)
   {
-    intAttribs = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 4);
-    if(!intAttribs)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
-    }
     if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intAttribs);
       return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
@@ -1297,21 +2545,10 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(map->mPrecision <= 0.0f)
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intAttribs);
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedInts(self, intAttribs, self->mVertexCount, 4, CTM_TRUE))
-    {
-      free((void *) intAttribs);
+    if(!_ctmReadArray_MG2(self, CTM_ATTRIB_MAP_1, map))
       return CTM_FALSE;
-    }
-
-    // Restore vertex attributes
-    _ctmRestoreAttribs(self, map, intAttribs);
-
-    // Free temporary vertex attribute data
-    free((void *) intAttribs);
-
     map = map->mNext;
   }
 
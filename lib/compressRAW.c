@@ -40,7 +40,6 @@
 //-----------------------------------------------------------------------------
 int _ctmCompressMesh_RAW(_CTMcontext * self)
 {
-  CTMuint i;
   _CTMfloatmap * map;
 
 #ifdef __DEBUG_
@@ -52,16 +51,14 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
   printf("Inidices: %d bytes\n", (CTMuint)(self->mTriangleCount * 3 * sizeof(CTMuint)));
 #endif
   _ctmStreamWrite(self, (void *) "INDX", 4);
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    _ctmStreamWriteUINT(self, self->mIndices[i]);
+  _ctmStreamWriteUINTArray(self, self->mIndices, self->mTriangleCount * 3);
 
   // Write vertices
 #ifdef __DEBUG_
   printf("Vertices: %d bytes\n", (CTMuint)(self->mVertexCount * 3 * sizeof(CTMfloat)));
 #endif
   _ctmStreamWrite(self, (void *) "VERT", 4);
-  for(i = 0; i < self->mVertexCount * 3; ++ i)
-    _ctmStreamWriteFLOAT(self, self->mVertices[i]);
+  _ctmStreamWriteFLOATArray(self, self->mVertices, self->mVertexCount * 3);
 
   // Write normals
   if(self->mNormals)
@@ -70,8 +67,7 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
     printf("Normals: %d bytes\n", (CTMuint)(self->mVertexCount * 3 * sizeof(CTMfloat)));
 #endif
     _ctmStreamWrite(self, (void *) "NORM", 4);
-    for(i = 0; i < self->mVertexCount * 3; ++ i)
-      _ctmStreamWriteFLOAT(self, self->mNormals[i]);
+    _ctmStreamWriteFLOATArray(self, self->mNormals, self->mVertexCount * 3);
   }
 
   // Write UV maps
@@ -84,8 +80,7 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
     _ctmStreamWrite(self, (void *) "TEXC", 4);
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteSTRING(self, map->mFileName);
-    for(i = 0; i < self->mVertexCount * 2; ++ i)
-      _ctmStreamWriteFLOAT(self, map->mValues[i]);
+    _ctmStreamWriteFLOATArray(self, map->mValues, self->mVertexCount * 2);
     map = map->mNext;
   }
 
@@ -98,22 +93,35 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
 #endif
     _ctmStreamWrite(self, (void *) "ATTR", 4);
     _ctmStreamWriteSTRING(self, map->mName);
-    for(i = 0; i < self->mVertexCount * 4; ++ i)
-      _ctmStreamWriteFLOAT(self, map->mValues[i]);
+    _ctmStreamWriteFLOATArray(self, map->mValues, self->mVertexCount * 4);
     map = map->mNext;
   }
 
   return 1;
 }
 
+//-----------------------------------------------------------------------------
+// _ctmReadFloatArray_RAW() - Read a float array with aWidth values per vertex.
+// Arrays in a caller provided buffer (aDest) are stored aStride values apart
+// per vertex, other arrays may be referenced in place in a memory mapped file.
+//-----------------------------------------------------------------------------
+static void _ctmReadFloatArray_RAW(_CTMcontext * self, CTMfloat ** aValues,
+  const CTMfloat * aDest, CTMuint aWidth, CTMuint aStride)
+{
+  if(aDest)
+    _ctmStreamReadFLOATRows(self, *aValues, self->mVertexCount, aWidth, aStride);
+  else
+    _ctmStreamReadMappedFLOATArray(self, aValues, self->mVertexCount * aWidth);
+}
+
 //-----------------------------------------------------------------------------
 // _ctmUncompressMesh_RAW() - Uncmpress the mesh from the input stream in the
 // CTM context using the RAW method, and store the resulting mesh in the CTM
-// context.
+// context. Arrays that have not been allocated (header only mode, or skipped
+// by the load options) are skipped in the stream.
 //-----------------------------------------------------------------------------
 int _ctmUncompressMesh_RAW(_CTMcontext * self)
 {
-  CTMuint i;
   _CTMfloatmap * map;
 
   // Read triangle indices
@@ -122,8 +130,13 @@ int _ctmUncompressMesh_RAW(_CTMcontext * self)
     self->mError = CTM_BAD_FORMAT;
     return 0;
   }
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    self->mIndices[i] = _ctmStreamReadUINT(self);
+  if(!self->mIndices)
+  {
+    if(!_ctmStreamSkip(self, (size_t) self->mTriangleCount * 12))
+      return 0;
+  }
+  else
+    _ctmStreamReadMappedUINTArray(self, &self->mIndices, self->mTriangleCount * 3);
 
   // Read vertices
   if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
@@ -131,19 +144,33 @@ int _ctmUncompressMesh_RAW(_CTMcontext * self)
     self->mError = CTM_BAD_FORMAT;
     return 0;
   }
-  for(i = 0; i < self->mVertexCount * 3; ++ i)
-    self->mVertices[i] = _ctmStreamReadFLOAT(self);
+  if(!self->mVertices)
+  {
+    if(!_ctmStreamSkip(self, (size_t) self->mVertexCount * 12))
+      return 0;
+  }
+  else
+    _ctmReadFloatArray_RAW(self, &self->mVertices, self->mVertexDest, 3,
+                           self->mVertexStride);
 
   // Read normals
-  if(self->mNormals)
+  if(self->mHasNormals)
   {
     if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
     {
       self->mError = CTM_BAD_FORMAT;
       return 0;
     }
-    for(i = 0; i < self->mVertexCount * 3; ++ i)
-      self->mNormals[i] = _ctmStreamReadFLOAT(self);
+    if(!self->mNormals)
+    {
+      if(self->mNormalsPending)
+        self->mNormalsOffset = _ctmStreamTell(self);
+      if(!_ctmStreamSkip(self, (size_t) self->mVertexCount * 12))
+        return 0;
+    }
+    else
+      _ctmReadFloatArray_RAW(self, &self->mNormals, self->mNormalDest, 3,
+                             self->mNormalStride);
   }
 
   // Read UV maps
@@ -157,8 +184,15 @@ int _ctmUncompressMesh_RAW(_CTMcontext * self)
     }
     _ctmStreamReadSTRING(self, &map->mName);
     _ctmStreamReadSTRING(self, &map->mFileName);
-    for(i = 0; i < self->mVertexCount * 2; ++ i)
-      map->mValues[i] = _ctmStreamReadFLOAT(self);
+    if(!map->mValues)
+    {
+      if(map->mPending)
+        map->mOffset = _ctmStreamTell(self);
+      if(!_ctmStreamSkip(self, (size_t) self->mVertexCount * 8))
+        return 0;
+    }
+    else
+      _ctmReadFloatArray_RAW(self, &map->mValues, map->mDest, 2, map->mStride);
     map = map->mNext;
   }
 
@@ -172,10 +206,46 @@ int _ctmUncompressMesh_RAW(_CTMcontext * self)
       return 0;
     }
     _ctmStreamReadSTRING(self, &map->mName);
-    for(i = 0; i < self->mVertexCount * 4; ++ i)
-      map->mValues[i] = _ctmStreamReadFLOAT(self);
+    if(!map->mValues)
+    {
+      if(map->mPending)
+        map->mOffset = _ctmStreamTell(self);
+      if(!_ctmStreamSkip(self, (size_t) self->mVertexCount * 16))
+        return 0;
+    }
+    else
+      _ctmReadFloatArray_RAW(self, &map->mValues, map->mDest, 4, map->mStride);
     map = map->mNext;
   }
 
   return 1;
 }
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressArray_RAW() - Read a single array (the normals, or the values
+// of a UV/attribute map) from the current stream position. aArray is
+// CTM_NORMALS, CTM_UV_MAP_1 or CTM_ATTRIB_MAP_1, and the destination array
+// must have been allocated. Used for arrays that are loaded on demand.
+//-----------------------------------------------------------------------------
+int _ctmUncompressArray_RAW(_CTMcontext * self, CTMenum aArray,
+  _CTMfloatmap * aMap)
+{
+  switch(aArray)
+  {
+    case CTM_NORMALS:
+      _ctmReadFloatArray_RAW(self, &self->mNormals, self->mNormalDest, 3,
+                             self->mNormalStride);
+      break;
+    case CTM_UV_MAP_1:
+      _ctmReadFloatArray_RAW(self, &aMap->mValues, aMap->mDest, 2, aMap->mStride);
+      break;
+    case CTM_ATTRIB_MAP_1:
+      _ctmReadFloatArray_RAW(self, &aMap->mValues, aMap->mDest, 4, aMap->mStride);
+      break;
+    default:
+      self->mError = CTM_INTERNAL_ERROR;
+      return 0;
+  }
+
+  return 1;
+}
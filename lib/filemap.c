@@ -0,0 +1,185 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        filemap.c
+// Description: Memory mapped file access (used by ctmLoadMapped()).
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#if defined(_WIN32)
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  // We need BSD/GNU extensions for MAP_POPULATE and madvise()
+  #define _DEFAULT_SOURCE
+  #define _BSD_SOURCE
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #include <sys/mman.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+#include "openctm.h"
+#include "internal.h"
+
+
+//-----------------------------------------------------------------------------
+// _ctmMapFile() - Map a file into memory (read only). The mapping is stored
+// in the CTM context, and stays valid until _ctmUnmapFile() is called.
+//-----------------------------------------------------------------------------
+int _ctmMapFile(_CTMcontext * self, const char * aFileName)
+{
+#if defined(_WIN32)
+  HANDLE file, map;
+  LARGE_INTEGER size;
+  void * data;
+
+  // Open the file
+  file = CreateFileA(aFileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                     OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if(file == INVALID_HANDLE_VALUE)
+  {
+    self->mError = CTM_FILE_ERROR;
+    return CTM_FALSE;
+  }
+  if(!GetFileSizeEx(file, &size) || ((ULONGLONG) size.QuadPart > (size_t) -1))
+  {
+    CloseHandle(file);
+    self->mError = CTM_FILE_ERROR;
+    return CTM_FALSE;
+  }
+  if(size.QuadPart == 0)
+  {
+    CloseHandle(file);
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+
+  // Map the file into memory
+  map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(!map)
+  {
+    CloseHandle(file);
+    self->mError = CTM_FILE_ERROR;
+    return CTM_FALSE;
+  }
+  data = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+  if(!data)
+  {
+    CloseHandle(map);
+    CloseHandle(file);
+    self->mError = CTM_FILE_ERROR;
+    return CTM_FALSE;
+  }
+
+  self->mFileMap = data;
+  self->mFileMapSize = (size_t) size.QuadPart;
+  self->mFileMapHandle = (void *) map;
+  self->mFileHandle = (void *) file;
+#else
+  int fd, flags;
+  struct stat st;
+  void * data;
+
+  // Open the file
+  fd = open(aFileName, O_RDONLY);
+  if(fd < 0)
+  {
+    self->mError = CTM_FILE_ERROR;
+    return CTM_FALSE;
+  }
+  if((fstat(fd, &st) != 0) || ((off_t) (size_t) st.st_size != st.st_size))
+  {
+    close(fd);
+    self->mError = CTM_FILE_ERROR;
+    return CTM_FALSE;
+  }
+  if(st.st_size == 0)
+  {
+    close(fd);
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+
+  // Map the file into memory (pre-fault the pages if we can, since we will
+  // read through the entire file anyway)
+  flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  flags |= MAP_POPULATE;
+#endif
+  data = mmap(NULL, (size_t) st.st_size, PROT_READ, flags, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+  {
+    self->mError = CTM_FILE_ERROR;
+    return CTM_FALSE;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+
+  self->mFileMap = data;
+  self->mFileMapSize = (size_t) st.st_size;
+#endif
+
+  self->mFileMapInUse = CTM_FALSE;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUnmapFile() - Release the memory mapped file (if any).
+//-----------------------------------------------------------------------------
+void _ctmUnmapFile(_CTMcontext * self)
+{
+  if(!self->mFileMap)
+    return;
+
+#if defined(_WIN32)
+  UnmapViewOfFile(self->mFileMap);
+  CloseHandle((HANDLE) self->mFileMapHandle);
+  CloseHandle((HANDLE) self->mFileHandle);
+  self->mFileMapHandle = (void *) 0;
+  self->mFileHandle = (void *) 0;
+#else
+  munmap(self->mFileMap, self->mFileMapSize);
+#endif
+
+  self->mFileMap = (void *) 0;
+  self->mFileMapSize = 0;
+  self->mFileMapInUse = CTM_FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmIsFileMapped() - Check if a pointer points into the memory mapped file
+// (i.e. it must not be freed).
+//-----------------------------------------------------------------------------
+int _ctmIsFileMapped(_CTMcontext * self, const void * aPtr)
+{
+  const unsigned char * p = (const unsigned char *) aPtr;
+  const unsigned char * start = (const unsigned char *) self->mFileMap;
+
+  if(!start || !p)
+    return CTM_FALSE;
+
+  return (p >= start) && (p < (start + self->mFileMapSize));
+}
@@ -0,0 +1,700 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        interleave.c
+// Description: Byte plane interleave/de-interleave kernels for packed arrays.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include "openctm.h"
+#include "internal.h"
+
+// SSE2 is always available on x86-64, and can be enabled for 32-bit x86
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+  #define _CTM_USE_SSE2
+  #include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled with per-function target attributes, and are
+// selected at run time (GCC and Clang only)
+#if defined(_CTM_USE_SSE2) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    ((__GNUC__ >= 5) || defined(__clang__))
+  #define _CTM_USE_AVX2
+  #include <immintrin.h>
+  #define _CTM_AVX2_FUNC __attribute__((target("avx2")))
+#endif
+
+// Number of elements per block. The array is processed in blocks, so that
+// the word buffers for all components of a block (4 x 512 words = 8 KB) stay
+// in the L1 cache while the byte planes are streamed through sequentially.
+#define _CTM_BLOCK_SIZE 512
+
+
+//-----------------------------------------------------------------------------
+// _ctmToSignedMagnitude() / _ctmFromSignedMagnitude() - Conversion between
+// two's complement and signed magnitude (LSB = sign) integer representation.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmToSignedMagnitude(CTMuint x)
+{
+  return (x << 1) ^ (0 - (x >> 31));
+}
+
+static CTMuint _ctmFromSignedMagnitude(CTMuint x)
+{
+  return (CTMuint) ((x & 1) ? -(CTMint)((x + 1) >> 1) : (CTMint)(x >> 1));
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMergePlanes_C() - Build aCount words from four byte planes (p0 holds
+// the most significant bytes), optionally converting from signed magnitude.
+//-----------------------------------------------------------------------------
+static void _ctmMergePlanes_C(const unsigned char * p0,
+  const unsigned char * p1, const unsigned char * p2,
+  const unsigned char * p3, CTMuint * aWords, size_t aCount,
+  CTMint aSignedInts)
+{
+  size_t i;
+  CTMuint x;
+  for(i = 0; i < aCount; ++ i)
+  {
+    x = ((CTMuint) p3[i]) |
+        (((CTMuint) p2[i]) << 8) |
+        (((CTMuint) p1[i]) << 16) |
+        (((CTMuint) p0[i]) << 24);
+    aWords[i] = aSignedInts ? _ctmFromSignedMagnitude(x) : x;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSplitPlanes_C() - Split aCount words into four byte planes (p0 gets
+// the most significant bytes), optionally converting to signed magnitude.
+//-----------------------------------------------------------------------------
+static void _ctmSplitPlanes_C(const CTMuint * aWords, unsigned char * p0,
+  unsigned char * p1, unsigned char * p2, unsigned char * p3,
+  size_t aCount, CTMint aSignedInts)
+{
+  size_t i;
+  CTMuint x;
+  for(i = 0; i < aCount; ++ i)
+  {
+    x = aSignedInts ? _ctmToSignedMagnitude(aWords[i]) : aWords[i];
+    p3[i] = (unsigned char) (x & 0x000000ff);
+    p2[i] = (unsigned char) ((x >> 8) & 0x000000ff);
+    p1[i] = (unsigned char) ((x >> 16) & 0x000000ff);
+    p0[i] = (unsigned char) ((x >> 24) & 0x000000ff);
+  }
+}
+
+#ifdef _CTM_USE_SSE2
+
+//-----------------------------------------------------------------------------
+// SSE2 versions of the signed magnitude conversions. Note: the decoder maps
+// 0xffffffff to zero, just like the scalar version does.
+//-----------------------------------------------------------------------------
+static __m128i _ctmToSignedMagnitude_SSE2(__m128i x)
+{
+  return _mm_xor_si128(_mm_slli_epi32(x, 1), _mm_srai_epi32(x, 31));
+}
+
+static __m128i _ctmFromSignedMagnitude_SSE2(__m128i x)
+{
+  __m128i sign, y;
+  sign = _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(x, _mm_set1_epi32(1)));
+  y = _mm_xor_si128(_mm_srli_epi32(x, 1), sign);
+  return _mm_andnot_si128(_mm_cmpeq_epi32(x, _mm_set1_epi32(-1)), y);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMergePlanes_SSE2() - SSE2 version of _ctmMergePlanes_C().
+//-----------------------------------------------------------------------------
+static void _ctmMergePlanes_SSE2(const unsigned char * p0,
+  const unsigned char * p1, const unsigned char * p2,
+  const unsigned char * p3, CTMuint * aWords, size_t aCount,
+  CTMint aSignedInts)
+{
+  size_t i;
+  __m128i b0, b1, b2, b3, lo, hi, w[4];
+  int j;
+
+  for(i = 0; i + 16 <= aCount; i += 16)
+  {
+    b0 = _mm_loadu_si128((const __m128i *) &p0[i]);
+    b1 = _mm_loadu_si128((const __m128i *) &p1[i]);
+    b2 = _mm_loadu_si128((const __m128i *) &p2[i]);
+    b3 = _mm_loadu_si128((const __m128i *) &p3[i]);
+
+    // Interleave bytes -> 16-bit halves -> 32-bit words
+    lo = _mm_unpacklo_epi8(b3, b2);
+    hi = _mm_unpacklo_epi8(b1, b0);
+    w[0] = _mm_unpacklo_epi16(lo, hi);
+    w[1] = _mm_unpackhi_epi16(lo, hi);
+    lo = _mm_unpackhi_epi8(b3, b2);
+    hi = _mm_unpackhi_epi8(b1, b0);
+    w[2] = _mm_unpacklo_epi16(lo, hi);
+    w[3] = _mm_unpackhi_epi16(lo, hi);
+
+    for(j = 0; j < 4; ++ j)
+    {
+      if(aSignedInts)
+        w[j] = _ctmFromSignedMagnitude_SSE2(w[j]);
+      _mm_storeu_si128((__m128i *) &aWords[i + j * 4], w[j]);
+    }
+  }
+
+  // Remaining elements
+  if(i < aCount)
+    _ctmMergePlanes_C(&p0[i], &p1[i], &p2[i], &p3[i], &aWords[i], aCount - i,
+                      aSignedInts);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSplitPlanes_SSE2() - SSE2 version of _ctmSplitPlanes_C().
+//-----------------------------------------------------------------------------
+static void _ctmSplitPlanes_SSE2(const CTMuint * aWords, unsigned char * p0,
+  unsigned char * p1, unsigned char * p2, unsigned char * p3,
+  size_t aCount, CTMint aSignedInts)
+{
+  size_t i;
+  __m128i w[4], mask, x[4];
+  unsigned char * planes[4];
+  int j, n;
+
+  planes[0] = p3;
+  planes[1] = p2;
+  planes[2] = p1;
+  planes[3] = p0;
+  mask = _mm_set1_epi32(0x000000ff);
+  for(i = 0; i + 16 <= aCount; i += 16)
+  {
+    for(j = 0; j < 4; ++ j)
+    {
+      w[j] = _mm_loadu_si128((const __m128i *) &aWords[i + j * 4]);
+      if(aSignedInts)
+        w[j] = _ctmToSignedMagnitude_SSE2(w[j]);
+    }
+
+    // Extract byte n of each word, and pack 16 bytes at a time
+    for(n = 0; n < 4; ++ n)
+    {
+      for(j = 0; j < 4; ++ j)
+        x[j] = _mm_and_si128(_mm_srli_epi32(w[j], 8 * n), mask);
+      _mm_storeu_si128((__m128i *) &planes[n][i],
+        _mm_packus_epi16(_mm_packs_epi32(x[0], x[1]),
+                         _mm_packs_epi32(x[2], x[3])));
+    }
+  }
+
+  // Remaining elements
+  if(i < aCount)
+    _ctmSplitPlanes_C(&aWords[i], &p0[i], &p1[i], &p2[i], &p3[i], aCount - i,
+                      aSignedInts);
+}
+
+#endif // _CTM_USE_SSE2
+
+#ifdef _CTM_USE_AVX2
+
+//-----------------------------------------------------------------------------
+// AVX2 versions of the signed magnitude conversions.
+//-----------------------------------------------------------------------------
+static _CTM_AVX2_FUNC __m256i _ctmToSignedMagnitude_AVX2(__m256i x)
+{
+  return _mm256_xor_si256(_mm256_slli_epi32(x, 1), _mm256_srai_epi32(x, 31));
+}
+
+static _CTM_AVX2_FUNC __m256i _ctmFromSignedMagnitude_AVX2(__m256i x)
+{
+  __m256i sign, y;
+  sign = _mm256_sub_epi32(_mm256_setzero_si256(),
+                          _mm256_and_si256(x, _mm256_set1_epi32(1)));
+  y = _mm256_xor_si256(_mm256_srli_epi32(x, 1), sign);
+  return _mm256_andnot_si256(_mm256_cmpeq_epi32(x, _mm256_set1_epi32(-1)), y);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMergePlanes_AVX2() - AVX2 version of _ctmMergePlanes_C().
+//-----------------------------------------------------------------------------
+static _CTM_AVX2_FUNC void _ctmMergePlanes_AVX2(const unsigned char * p0,
+  const unsigned char * p1, const unsigned char * p2,
+  const unsigned char * p3, CTMuint * aWords, size_t aCount,
+  CTMint aSignedInts)
+{
+  size_t i;
+  __m256i b0, b1, b2, b3, lo, hi, t[4], w[4];
+  int j;
+
+  for(i = 0; i + 32 <= aCount; i += 32)
+  {
+    b0 = _mm256_loadu_si256((const __m256i *) &p0[i]);
+    b1 = _mm256_loadu_si256((const __m256i *) &p1[i]);
+    b2 = _mm256_loadu_si256((const __m256i *) &p2[i]);
+    b3 = _mm256_loadu_si256((const __m256i *) &p3[i]);
+
+    // The unpack instructions work within 128-bit lanes, so t[0..3] hold
+    // elements (0-3, 16-19), (4-7, 20-23), (8-11, 24-27) and (12-15, 28-31)
+    lo = _mm256_unpacklo_epi8(b3, b2);
+    hi = _mm256_unpacklo_epi8(b1, b0);
+    t[0] = _mm256_unpacklo_epi16(lo, hi);
+    t[1] = _mm256_unpackhi_epi16(lo, hi);
+    lo = _mm256_unpackhi_epi8(b3, b2);
+    hi = _mm256_unpackhi_epi8(b1, b0);
+    t[2] = _mm256_unpacklo_epi16(lo, hi);
+    t[3] = _mm256_unpackhi_epi16(lo, hi);
+
+    // Restore element order across the lanes
+    w[0] = _mm256_permute2x128_si256(t[0], t[1], 0x20);
+    w[1] = _mm256_permute2x128_si256(t[2], t[3], 0x20);
+    w[2] = _mm256_permute2x128_si256(t[0], t[1], 0x31);
+    w[3] = _mm256_permute2x128_si256(t[2], t[3], 0x31);
+
+    for(j = 0; j < 4; ++ j)
+    {
+      if(aSignedInts)
+        w[j] = _ctmFromSignedMagnitude_AVX2(w[j]);
+      _mm256_storeu_si256((__m256i *) &aWords[i + j * 8], w[j]);
+    }
+  }
+
+  // Remaining elements
+  if(i < aCount)
+    _ctmMergePlanes_SSE2(&p0[i], &p1[i], &p2[i], &p3[i], &aWords[i],
+                         aCount - i, aSignedInts);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSplitPlanes_AVX2() - AVX2 version of _ctmSplitPlanes_C().
+//-----------------------------------------------------------------------------
+static _CTM_AVX2_FUNC void _ctmSplitPlanes_AVX2(const CTMuint * aWords,
+  unsigned char * p0, unsigned char * p1, unsigned char * p2,
+  unsigned char * p3, size_t aCount, CTMint aSignedInts)
+{
+  size_t i;
+  __m256i w[4], mask, order, x[4], packed;
+  unsigned char * planes[4];
+  int j, n;
+
+  planes[0] = p3;
+  planes[1] = p2;
+  planes[2] = p1;
+  planes[3] = p0;
+  mask = _mm256_set1_epi32(0x000000ff);
+  order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  for(i = 0; i + 32 <= aCount; i += 32)
+  {
+    for(j = 0; j < 4; ++ j)
+    {
+      w[j] = _mm256_loadu_si256((const __m256i *) &aWords[i + j * 8]);
+      if(aSignedInts)
+        w[j] = _ctmToSignedMagnitude_AVX2(w[j]);
+    }
+
+    // Extract byte n of each word, pack (within lanes), and restore the
+    // element order across the lanes
+    for(n = 0; n < 4; ++ n)
+    {
+      for(j = 0; j < 4; ++ j)
+        x[j] = _mm256_and_si256(_mm256_srli_epi32(w[j], 8 * n), mask);
+      packed = _mm256_packus_epi16(_mm256_packs_epi32(x[0], x[1]),
+                                   _mm256_packs_epi32(x[2], x[3]));
+      _mm256_storeu_si256((__m256i *) &planes[n][i],
+        _mm256_permutevar8x32_epi32(packed, order));
+    }
+  }
+
+  // Remaining elements
+  if(i < aCount)
+    _ctmSplitPlanes_SSE2(&aWords[i], &p0[i], &p1[i], &p2[i], &p3[i],
+                         aCount - i, aSignedInts);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmHasAVX2() - Check if the CPU supports AVX2.
+//-----------------------------------------------------------------------------
+static int _ctmHasAVX2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+#endif // _CTM_USE_AVX2
+
+//-----------------------------------------------------------------------------
+// Kernel selection.
+//-----------------------------------------------------------------------------
+typedef void (* _CTMmergefn)(const unsigned char *, const unsigned char *,
+  const unsigned char *, const unsigned char *, CTMuint *, size_t, CTMint);
+typedef void (* _CTMsplitfn)(const CTMuint *, unsigned char *,
+  unsigned char *, unsigned char *, unsigned char *, size_t, CTMint);
+
+static _CTMmergefn _ctmGetMergeFn(void)
+{
+#ifdef _CTM_USE_AVX2
+  if(_ctmHasAVX2())
+    return _ctmMergePlanes_AVX2;
+#endif
+#ifdef _CTM_USE_SSE2
+  return _ctmMergePlanes_SSE2;
+#else
+  return _ctmMergePlanes_C;
+#endif
+}
+
+static _CTMsplitfn _ctmGetSplitFn(void)
+{
+#ifdef _CTM_USE_AVX2
+  if(_ctmHasAVX2())
+    return _ctmSplitPlanes_AVX2;
+#endif
+#ifdef _CTM_USE_SSE2
+  return _ctmSplitPlanes_SSE2;
+#else
+  return _ctmSplitPlanes_C;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmScatterBlock() - Store the component words of a block (one row of
+// aBlock per component) as aCount consecutive elements of aSize components.
+//-----------------------------------------------------------------------------
+static void _ctmScatterBlock(CTMuint aBlock[4][_CTM_BLOCK_SIZE],
+  CTMuint * aData, CTMuint aCount, CTMuint aSize)
+{
+  CTMuint i, k;
+#ifdef _CTM_USE_SSE2
+  __m128i a, b, c, d, t0, t1, t2, t3;
+#endif
+
+  i = 0;
+  switch(aSize)
+  {
+    case 2:
+#ifdef _CTM_USE_SSE2
+      for(; i + 4 <= aCount; i += 4)
+      {
+        a = _mm_loadu_si128((const __m128i *) &aBlock[0][i]);
+        b = _mm_loadu_si128((const __m128i *) &aBlock[1][i]);
+        _mm_storeu_si128((__m128i *) &aData[i * 2], _mm_unpacklo_epi32(a, b));
+        _mm_storeu_si128((__m128i *) &aData[i * 2 + 4], _mm_unpackhi_epi32(a, b));
+      }
+#endif
+      for(; i < aCount; ++ i)
+      {
+        aData[i * 2] = aBlock[0][i];
+        aData[i * 2 + 1] = aBlock[1][i];
+      }
+      break;
+
+    case 3:
+      for(; i < aCount; ++ i)
+      {
+        aData[i * 3] = aBlock[0][i];
+        aData[i * 3 + 1] = aBlock[1][i];
+        aData[i * 3 + 2] = aBlock[2][i];
+      }
+      break;
+
+    case 4:
+#ifdef _CTM_USE_SSE2
+      // 4x4 word transpose
+      for(; i + 4 <= aCount; i += 4)
+      {
+        a = _mm_loadu_si128((const __m128i *) &aBlock[0][i]);
+        b = _mm_loadu_si128((const __m128i *) &aBlock[1][i]);
+        c = _mm_loadu_si128((const __m128i *) &aBlock[2][i]);
+        d = _mm_loadu_si128((const __m128i *) &aBlock[3][i]);
+        t0 = _mm_unpacklo_epi32(a, b);
+        t1 = _mm_unpacklo_epi32(c, d);
+        t2 = _mm_unpackhi_epi32(a, b);
+        t3 = _mm_unpackhi_epi32(c, d);
+        _mm_storeu_si128((__m128i *) &aData[i * 4], _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *) &aData[i * 4 + 4], _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *) &aData[i * 4 + 8], _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i *) &aData[i * 4 + 12], _mm_unpackhi_epi64(t2, t3));
+      }
+#endif
+      for(; i < aCount; ++ i)
+      {
+        aData[i * 4] = aBlock[0][i];
+        aData[i * 4 + 1] = aBlock[1][i];
+        aData[i * 4 + 2] = aBlock[2][i];
+        aData[i * 4 + 3] = aBlock[3][i];
+      }
+      break;
+
+    default:
+      for(; i < aCount; ++ i)
+        for(k = 0; k < aSize; ++ k)
+          aData[i * aSize + k] = aBlock[k][i];
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmGatherBlock() - Inverse of _ctmScatterBlock(): split aCount elements of
+// aSize components into one row of aBlock per component.
+//-----------------------------------------------------------------------------
+static void _ctmGatherBlock(const CTMuint * aData,
+  CTMuint aBlock[4][_CTM_BLOCK_SIZE], CTMuint aCount, CTMuint aSize)
+{
+  CTMuint i, k;
+#ifdef _CTM_USE_SSE2
+  __m128i a, b, c, d, t0, t1, t2, t3;
+#endif
+
+  i = 0;
+  switch(aSize)
+  {
+    case 2:
+#ifdef _CTM_USE_SSE2
+      for(; i + 4 <= aCount; i += 4)
+      {
+        // (x0 y0 x1 y1), (x2 y2 x3 y3) -> (x0 x1 x2 x3), (y0 y1 y2 y3)
+        a = _mm_loadu_si128((const __m128i *) &aData[i * 2]);
+        b = _mm_loadu_si128((const __m128i *) &aData[i * 2 + 4]);
+        t0 = _mm_unpacklo_epi32(a, b);
+        t1 = _mm_unpackhi_epi32(a, b);
+        _mm_storeu_si128((__m128i *) &aBlock[0][i], _mm_unpacklo_epi32(t0, t1));
+        _mm_storeu_si128((__m128i *) &aBlock[1][i], _mm_unpackhi_epi32(t0, t1));
+      }
+#endif
+      for(; i < aCount; ++ i)
+      {
+        aBlock[0][i] = aData[i * 2];
+        aBlock[1][i] = aData[i * 2 + 1];
+      }
+      break;
+
+    case 3:
+      for(; i < aCount; ++ i)
+      {
+        aBlock[0][i] = aData[i * 3];
+        aBlock[1][i] = aData[i * 3 + 1];
+        aBlock[2][i] = aData[i * 3 + 2];
+      }
+      break;
+
+    case 4:
+#ifdef _CTM_USE_SSE2
+      // 4x4 word transpose
+      for(; i + 4 <= aCount; i += 4)
+      {
+        a = _mm_loadu_si128((const __m128i *) &aData[i * 4]);
+        b = _mm_loadu_si128((const __m128i *) &aData[i * 4 + 4]);
+        c = _mm_loadu_si128((const __m128i *) &aData[i * 4 + 8]);
+        d = _mm_loadu_si128((const __m128i *) &aData[i * 4 + 12]);
+        t0 = _mm_unpacklo_epi32(a, b);
+        t1 = _mm_unpacklo_epi32(c, d);
+        t2 = _mm_unpackhi_epi32(a, b);
+        t3 = _mm_unpackhi_epi32(c, d);
+        _mm_storeu_si128((__m128i *) &aBlock[0][i], _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *) &aBlock[1][i], _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i *) &aBlock[2][i], _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i *) &aBlock[3][i], _mm_unpackhi_epi64(t2, t3));
+      }
+#endif
+      for(; i < aCount; ++ i)
+      {
+        aBlock[0][i] = aData[i * 4];
+        aBlock[1][i] = aData[i * 4 + 1];
+        aBlock[2][i] = aData[i * 4 + 2];
+        aBlock[3][i] = aData[i * 4 + 3];
+      }
+      break;
+
+    default:
+      for(; i < aCount; ++ i)
+        for(k = 0; k < aSize; ++ k)
+          aBlock[k][i] = aData[i * aSize + k];
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDeinterleaveWords() - Convert an interleaved byte plane array (as
+// stored in packed arrays) to aCount elements of aSize 32-bit words.
+// Byte n (0 = most significant byte) of component k of element i is found at
+// aPlanes[i + k * aCount + n * aCount * aSize].
+//-----------------------------------------------------------------------------
+void _ctmDeinterleaveWords(const unsigned char * aPlanes, CTMuint * aData,
+  size_t aCount, CTMuint aSize, CTMint aSignedInts)
+{
+  CTMuint block[4][_CTM_BLOCK_SIZE];
+  CTMuint k, count;
+  size_t i, planeSize, offset;
+  _CTMmergefn merge;
+
+  merge = _ctmGetMergeFn();
+  planeSize = aCount * aSize;
+
+  // Single component arrays need no transposing
+  if(aSize == 1)
+  {
+    merge(aPlanes, &aPlanes[planeSize], &aPlanes[2 * planeSize],
+          &aPlanes[3 * planeSize], aData, aCount, aSignedInts);
+    return;
+  }
+
+  // Generic case: more than 4 components are handled one component at a time
+  if(aSize > 4)
+  {
+    for(i = 0; i < aCount; i += count)
+    {
+      count = (CTMuint) (aCount - i < _CTM_BLOCK_SIZE ? aCount - i : _CTM_BLOCK_SIZE);
+      for(k = 0; k < aSize; ++ k)
+      {
+        offset = (size_t) k * aCount + i;
+        merge(&aPlanes[offset], &aPlanes[offset + planeSize],
+              &aPlanes[offset + 2 * planeSize], &aPlanes[offset + 3 * planeSize],
+              block[0], count, aSignedInts);
+        for(offset = 0; offset < count; ++ offset)
+          aData[(i + offset) * aSize + k] = block[0][offset];
+      }
+    }
+    return;
+  }
+
+  // Merge one block of each component, then transpose it to the output
+  for(i = 0; i < aCount; i += count)
+  {
+    count = (CTMuint) (aCount - i < _CTM_BLOCK_SIZE ? aCount - i : _CTM_BLOCK_SIZE);
+    for(k = 0; k < aSize; ++ k)
+    {
+      offset = (size_t) k * aCount + i;
+      merge(&aPlanes[offset], &aPlanes[offset + planeSize],
+            &aPlanes[offset + 2 * planeSize], &aPlanes[offset + 3 * planeSize],
+            block[k], count, aSignedInts);
+    }
+    _ctmScatterBlock(block, &aData[i * aSize], count, aSize);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDeinterleaveWordsStrided() - Like _ctmDeinterleaveWords() (for unsigned
+// words), but the output words are stored in rows of aWidth words, and the
+// rows start aStride words apart (e.g. aWidth = 3 for the x, y, z of each
+// vertex in an interleaved vertex buffer). aSize must be at most 4, and
+// aCount * aSize must be a multiple of aWidth.
+//-----------------------------------------------------------------------------
+void _ctmDeinterleaveWordsStrided(const unsigned char * aPlanes,
+  CTMuint * aData, size_t aCount, CTMuint aSize, CTMuint aWidth,
+  CTMuint aStride)
+{
+  CTMuint block[4][_CTM_BLOCK_SIZE];
+  CTMuint j, k, count, col;
+  size_t i, planeSize, offset;
+  CTMuint * row;
+  _CTMmergefn merge;
+
+  // Tightly packed output?
+  if(aStride == aWidth)
+  {
+    _ctmDeinterleaveWords(aPlanes, aData, aCount, aSize, CTM_FALSE);
+    return;
+  }
+
+  merge = _ctmGetMergeFn();
+  planeSize = aCount * aSize;
+
+  // Merge one block of each component, then store the words row by row
+  row = aData;
+  col = 0;
+  for(i = 0; i < aCount; i += count)
+  {
+    count = (CTMuint) (aCount - i < _CTM_BLOCK_SIZE ? aCount - i : _CTM_BLOCK_SIZE);
+    for(k = 0; k < aSize; ++ k)
+    {
+      offset = (size_t) k * aCount + i;
+      merge(&aPlanes[offset], &aPlanes[offset + planeSize],
+            &aPlanes[offset + 2 * planeSize], &aPlanes[offset + 3 * planeSize],
+            block[k], count, CTM_FALSE);
+    }
+    for(j = 0; j < count; ++ j)
+    {
+      for(k = 0; k < aSize; ++ k)
+      {
+        row[col] = block[k][j];
+        if(++ col == aWidth)
+        {
+          row += aStride;
+          col = 0;
+        }
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmInterleaveWords() - Convert aCount elements of aSize 32-bit words to an
+// interleaved byte plane array (the inverse of _ctmDeinterleaveWords()).
+//-----------------------------------------------------------------------------
+void _ctmInterleaveWords(const CTMuint * aData, unsigned char * aPlanes,
+  size_t aCount, CTMuint aSize, CTMint aSignedInts)
+{
+  CTMuint block[4][_CTM_BLOCK_SIZE];
+  CTMuint k, count;
+  size_t i, planeSize, offset;
+  _CTMsplitfn split;
+
+  split = _ctmGetSplitFn();
+  planeSize = aCount * aSize;
+
+  // Single component arrays need no transposing
+  if(aSize == 1)
+  {
+    split(aData, aPlanes, &aPlanes[planeSize], &aPlanes[2 * planeSize],
+          &aPlanes[3 * planeSize], aCount, aSignedInts);
+    return;
+  }
+
+  // Generic case: more than 4 components are handled one component at a time
+  if(aSize > 4)
+  {
+    for(i = 0; i < aCount; i += count)
+    {
+      count = (CTMuint) (aCount - i < _CTM_BLOCK_SIZE ? aCount - i : _CTM_BLOCK_SIZE);
+      for(k = 0; k < aSize; ++ k)
+      {
+        for(offset = 0; offset < count; ++ offset)
+          block[0][offset] = aData[(i + offset) * aSize + k];
+        offset = (size_t) k * aCount + i;
+        split(block[0], &aPlanes[offset], &aPlanes[offset + planeSize],
+              &aPlanes[offset + 2 * planeSize], &aPlanes[offset + 3 * planeSize],
+              count, aSignedInts);
+      }
+    }
+    return;
+  }
+
+  // Transpose one block to per-component rows, then split each row
+  for(i = 0; i < aCount; i += count)
+  {
+    count = (CTMuint) (aCount - i < _CTM_BLOCK_SIZE ? aCount - i : _CTM_BLOCK_SIZE);
+    _ctmGatherBlock(&aData[i * aSize], block, count, aSize);
+    for(k = 0; k < aSize; ++ k)
+    {
+      offset = (size_t) k * aCount + i;
+      split(block[k], &aPlanes[offset], &aPlanes[offset + planeSize],
+            &aPlanes[offset + 2 * planeSize], &aPlanes[offset + 3 * planeSize],
+            count, aSignedInts);
+    }
+  }
+}
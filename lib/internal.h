@@ -31,12 +31,37 @@
 //-----------------------------------------------------------------------------
 // Constants
 //-----------------------------------------------------------------------------
-// OpenCTM file format version (v5).
-#define _CTM_FORMAT_VERSION  0x00000005
+// OpenCTM file format version (v6). Version 5 files (where every packed
+// array is a single LZMA block) can still be read, and are still written when
+// no packed array is large enough to be split into blocks. Version 7 files
+// are version 6 files with 64-bit vertex and triangle counts, and are only
+// written when a count does not fit in 32 bits.
+#define _CTM_FORMAT_VERSION  0x00000006
+#define _CTM_FORMAT_VERSION_5 0x00000005
+#define _CTM_FORMAT_VERSION_7 0x00000007
 
 // Flags for the Mesh flags field of the file header
 #define _CTM_HAS_NORMALS_BIT 0x00000001
 
+// Default size of the stream buffer (in bytes)
+#define _CTM_STREAM_BUFFER_SIZE 65536
+
+// Largest number of bytes that are passed to a read/write function in a
+// single call (larger transfers are split, see _ctmStreamRead())
+#define _CTM_STREAM_MAX_TRANSFER 0x40000000
+
+// Size of the LZMA blocks that large packed arrays are split into (in bytes
+// of uncompressed data), so that they can be uncompressed concurrently
+#define _CTM_PACKED_BLOCK_SIZE 0x00800000
+
+// Alignment of the memory that is allocated from the scratch arena (in bytes,
+// must be a power of two, see _ctmArenaAlloc())
+#define _CTM_ARENA_ALIGN 16
+
+// Number of caller provided load destinations (vertices, normals, 8 UV maps
+// and 8 attribute maps, see ctmLoadDestination())
+#define _CTM_LOAD_DEST_COUNT 18
+
 //-----------------------------------------------------------------------------
 // _CTMfloatmap - Internal representation of a floating point based vertex map
 // (used for UV maps and attribute maps).
@@ -47,9 +72,75 @@ struct _CTMfloatmap_struct {
   char * mFileName;     // File name reference (used only for UV maps)
   CTMfloat mPrecision;  // Precision for this map
   CTMfloat * mValues;   // Attribute/UV coordinate values (per vertex)
+  CTMuint mStride;      // Distance between vertices in mValues (in floats)
+  CTMfloat * mDest;     // Caller provided buffer for the values (if any)
+  CTMint mPending;      // The values are loaded on demand (CTM_LAZY_LOAD)
+  size_t mOffset;       // Stream position of the values (if pending)
   _CTMfloatmap * mNext; // Pointer to the next map in the list (linked list)
 };
 
+//-----------------------------------------------------------------------------
+// _CTMdest - A caller provided destination buffer for a float array (see
+// ctmLoadDestination()).
+//-----------------------------------------------------------------------------
+typedef struct {
+  CTMfloat * mData;     // First value of the first vertex (null = not used)
+  size_t mSize;         // Size of the buffer (in bytes, counted from mData)
+  CTMuint mStride;      // Distance between vertices (in floats)
+} _CTMdest;
+
+//-----------------------------------------------------------------------------
+// _CTMpackedarray - A packed array that has been located in the input stream
+// but not yet uncompressed, or an array that is to be compressed and written
+// to the output stream (see _ctmStreamBeginBatch()).
+//-----------------------------------------------------------------------------
+typedef struct {
+  CTMuint * mData;      // Destination array (reading)
+  size_t mCount;        // Number of elements
+  CTMuint mSize;        // Number of words per element
+  CTMint mSignedInts;   // Signed integer array (see _ctmDeinterleaveWords())
+  CTMuint mWidth;       // Row width of a float array (0 = integer array)
+  CTMuint mStride;      // Row stride of a float array
+  unsigned char * mInterleaved; // Interleaved array (when writing, or when
+                                // it is shared by several blocks)
+  CTMuint mBlockCount;  // Number of LZMA blocks
+  size_t mOffset;       // Position in the batch data (writing)
+  CTMuint mLevel;       // Compression level (writing)
+  CTMuint mLzmaThreads; // Number of LZMA encoder threads (writing)
+  void * mContext;      // The context (only used for memory allocation)
+} _CTMpackedarray;
+
+//-----------------------------------------------------------------------------
+// _CTMpackedblock - One LZMA block of a packed array in a batch. The blocks
+// of an array cover consecutive ranges of its interleaved array.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const unsigned char * mPacked; // Packed data
+  size_t mPackedSize;   // Size of the packed data (in bytes)
+  unsigned char mProps[5]; // LZMA compression props
+  unsigned char * mBuffer; // Packed data that is owned by the block (a copy
+                           // of the stream data)
+  unsigned char * mJobBuffer; // Buffer of the job that runs the block (the
+                              // compressed data, or the interleaved data of
+                              // a whole array), see _ctmStreamEndBatch()
+  size_t mStart;        // Start of the block in the interleaved array
+  size_t mSize;         // Size of the block in the interleaved array
+  CTMuint mArrayIndex;  // The array that the block belongs to
+  _CTMpackedarray * mArray; // Same as mArrayIndex (set when the batch ends)
+  CTMenum mError;       // Error code (set by the thread that runs the block)
+} _CTMpackedblock;
+
+//-----------------------------------------------------------------------------
+// _CTMjobfn - A job function for _ctmRunJobs().
+//-----------------------------------------------------------------------------
+typedef void (* _CTMjobfn)(void * aJob);
+
+//-----------------------------------------------------------------------------
+// _CTMseekfn - Internal seek function for input streams (seek to an absolute
+// position). Returns non-zero on success.
+//-----------------------------------------------------------------------------
+typedef int (* _CTMseekfn)(size_t aOffset, void * aUserData);
+
 //-----------------------------------------------------------------------------
 // _CTMcontext - Internal CTM context structure.
 //-----------------------------------------------------------------------------
@@ -57,16 +148,37 @@ typedef struct {
   // Context mode (import or export)
   CTMenum mMode;
 
+  // Memory allocator (see ctmAllocator() - null = malloc()/free())
+  CTMallocfn mAllocFn;
+  CTMfreefn mFreeFn;
+  void * mAllocUserData;
+
+  // Memory accounting (see alloc.c). mMemoryUsed and mMemoryPeak are the
+  // current and largest number of allocated bytes, and mMemoryLimit is the
+  // limit set by ctmMemoryLimit() (0 = no limit). mLowMemory is set when
+  // the current load/save operation uses the low memory strategy.
+  size_t mMemoryUsed;
+  size_t mMemoryPeak;
+  size_t mMemoryLimit;
+  CTMint mLowMemory;
+
   // Vertices
   CTMfloat * mVertices;
-  CTMuint mVertexCount;
+  size_t mVertexCount;
+  CTMuint mVertexStride;  // Distance between vertices (in floats)
+  CTMfloat * mVertexDest; // Caller provided buffer for the vertices (if any)
 
   // Indices
   CTMuint * mIndices;
-  CTMuint mTriangleCount;
+  size_t mTriangleCount;
 
   // Normals (optional)
   CTMfloat * mNormals;
+  CTMint mHasNormals;   // Set when loading (the mesh has normals)
+  CTMuint mNormalStride;  // Distance between normals (in floats)
+  CTMfloat * mNormalDest; // Caller provided buffer for the normals (if any)
+  CTMint mNormalsPending; // The normals are loaded on demand (CTM_LAZY_LOAD)
+  size_t mNormalsOffset;  // Stream position of the normals (if pending)
 
   // Multiple sets of UV coordinate maps (optional)
   CTMuint mUVMapCount;
@@ -79,12 +191,18 @@ typedef struct {
   // Last error code
   CTMenum mError;
 
+  // Format version of the file that is being loaded/saved
+  CTMuint mFormatVersion;
+
   // The selected compression method
   CTMenum mMethod;
 
   // The selected compression level
   CTMuint mCompressionLevel;
 
+  // Number of threads used by the LZMA encoder (see ctmCompressionThreads())
+  CTMuint mCompressionThreads;
+
   // Vertex coordinate precision
   CTMfloat mVertexPrecision;
 
@@ -94,14 +212,108 @@ typedef struct {
   // File comment
   char * mFileComment;
 
+  // Load options (CTM_SKIP_NORMALS etc)
+  CTMuint mLoadOptions;
+
+  // Caller provided destinations for the loaded float arrays (vertices,
+  // normals, UV maps 1-8, attribute maps 1-8)
+  _CTMdest mLoadDest[_CTM_LOAD_DEST_COUNT];
+
+  // Number of arrays that are loaded on demand. The input stream is kept
+  // open until they have all been loaded (or the mesh is cleared), and
+  // mPendingFile is the file that was opened by ctmLoad() (if any).
+  CTMuint mPendingCount;
+  void * mPendingFile;
+
+  // Only the header (and array properties) was loaded - no mesh arrays
+  CTMint mHeaderOnly;
+
+  // Axis aligned bounding box (min x, y, z, max x, y, z). mHasAABB is set
+  // when it is known from the file (MG2 header).
+  CTMfloat mAABB[6];
+  CTMint mHasAABB;
+
   // Read() function pointer
   CTMreadfn mReadFn;
 
   // Write() function pointer
   CTMwritefn mWriteFn;
 
+  // Seek() function pointer (optional, for input streams)
+  _CTMseekfn mSeekFn;
+
   // User data (for stream read/write - usually the stream handle)
   void * mUserData;
+
+  // Stream buffer (batches calls to the read/write functions). When reading,
+  // bytes mStreamBufPos..mStreamBufLen-1 of mStreamData are unread, where
+  // mStreamData is either mStreamBuf or a caller provided memory block, and
+  // mStreamBase is the stream position of mStreamData[0]. When writing, bytes
+  // 0..mStreamBufPos-1 of mStreamBuf are waiting to be written. Unless
+  // mStreamReadAhead is set, the buffer is only filled with the bytes that
+  // are needed (so that a custom stream is not read past the OpenCTM data).
+  CTMuint mStreamBufferSize;
+  CTMint mStreamReadAhead;
+  unsigned char * mStreamBuf;
+  CTMuint mStreamBufCapacity;
+  const unsigned char * mStreamData;
+  size_t mStreamBase;
+  size_t mStreamBufPos;
+  size_t mStreamBufLen;
+
+  // Memory mapped input file (see ctmLoadMapped()). The handles are only used
+  // on Windows. mFileMapInUse is set when mesh arrays point into the mapping.
+  void * mFileMap;
+  size_t mFileMapSize;
+  void * mFileMapHandle;
+  void * mFileHandle;
+  CTMint mFileMapInUse;
+
+  // Scratch buffer for packed array decoding (reused between the arrays of a
+  // load)
+  unsigned char * mScratch;
+  size_t mScratchSize;
+
+  // Scratch arena for temporary arrays, reused between save operations (it
+  // is freed after each load, see _ctmArenaAlloc()). mArenaTop is the amount
+  // of memory that is in use, including memory that did not fit in the arena
+  // and was allocated from the heap (mArenaOverflow), and mArenaPeak is the
+  // largest mArenaTop so far.
+  unsigned char * mArena;
+  size_t mArenaSize;
+  size_t mArenaTop;
+  size_t mArenaPeak;
+  void * mArenaOverflow;
+
+  // LZMA encoder (CLzmaEncHandle) and LZMA decoder (CLzmaDec), reused between
+  // packed arrays and between load/save operations (see stream.c)
+  void * mLzmaEnc;
+  void * mLzmaDec;
+
+  // Number of threads to use (0 = one per processor, see ctmThreadCount())
+  CTMuint mThreadCount;
+
+  // Thread state of the context (see thread.c), created when jobs are first
+  // run by several threads. mJobsRunning is set while worker threads are
+  // running jobs (only then is the memory accounting locked).
+  void * mThreads;
+  CTMint mJobsRunning;
+
+  // Packed arrays that have been located but not yet uncompressed (or that
+  // are not yet compressed), and their LZMA blocks. While mBatchActive is
+  // set, packed arrays are collected here instead of being uncompressed/
+  // compressed when they are read/written, and all other written data is
+  // kept in mBatchData (see _ctmStreamBeginBatch()).
+  CTMint mBatchActive;
+  _CTMpackedarray * mBatchArrays;
+  CTMuint mBatchArrayCount;
+  CTMuint mBatchArrayCapacity;
+  _CTMpackedblock * mBatchBlocks;
+  CTMuint mBatchBlockCount;
+  CTMuint mBatchBlockCapacity;
+  unsigned char * mBatchData;
+  size_t mBatchDataSize;
+  size_t mBatchDataCapacity;
 } _CTMcontext;
 
 //-----------------------------------------------------------------------------
@@ -110,38 +322,116 @@ typedef struct {
 #define FOURCC(str) (((CTMuint) str[0]) | (((CTMuint) str[1]) << 8) | \
                     (((CTMuint) str[2]) << 16) | (((CTMuint) str[3]) << 24))
 
+//-----------------------------------------------------------------------------
+// Funcion prototypes for alloc.c
+//-----------------------------------------------------------------------------
+void * _ctmAlloc(_CTMcontext * self, size_t aSize);
+void * _ctmCalloc(_CTMcontext * self, size_t aCount, size_t aSize);
+void * _ctmRealloc(_CTMcontext * self, void * aPtr, size_t aOldSize, size_t aNewSize);
+void _ctmFree(_CTMcontext * self, void * aPtr);
+size_t _ctmMemoryAvailable(_CTMcontext * self);
+void _ctmArenaReserve(_CTMcontext * self, size_t aSize);
+size_t _ctmArenaMark(_CTMcontext * self);
+void * _ctmArenaAlloc(_CTMcontext * self, size_t aSize);
+void _ctmArenaRelease(_CTMcontext * self, size_t aMark);
+void _ctmArenaFree(_CTMcontext * self);
+
 //-----------------------------------------------------------------------------
 // Funcion prototypes for stream.c
 //-----------------------------------------------------------------------------
-CTMuint _ctmStreamRead(_CTMcontext * self, void * aBuf, CTMuint aCount);
-CTMuint _ctmStreamWrite(_CTMcontext * self, void * aBuf, CTMuint aCount);
+void _ctmStreamInit(_CTMcontext * self);
+void _ctmStreamInitMemory(_CTMcontext * self, const void * aData, size_t aSize);
+void _ctmStreamFlush(_CTMcontext * self);
+size_t _ctmStreamRead(_CTMcontext * self, void * aBuf, size_t aCount);
+size_t _ctmStreamWrite(_CTMcontext * self, void * aBuf, size_t aCount);
+int _ctmStreamSkip(_CTMcontext * self, size_t aCount);
+int _ctmStreamSkipPacked(_CTMcontext * self);
+size_t _ctmStreamTell(_CTMcontext * self);
+int _ctmStreamIsSeekable(_CTMcontext * self);
+int _ctmStreamSeek(_CTMcontext * self, size_t aOffset);
 CTMuint _ctmStreamReadUINT(_CTMcontext * self);
 void _ctmStreamWriteUINT(_CTMcontext * self, CTMuint aValue);
+CTMuint64 _ctmStreamReadUINT64(_CTMcontext * self);
+void _ctmStreamWriteUINT64(_CTMcontext * self, CTMuint64 aValue);
 CTMfloat _ctmStreamReadFLOAT(_CTMcontext * self);
 void _ctmStreamWriteFLOAT(_CTMcontext * self, CTMfloat aValue);
+void _ctmStreamReadUINTArray(_CTMcontext * self, CTMuint * aData, size_t aCount);
+void _ctmStreamWriteUINTArray(_CTMcontext * self, const CTMuint * aData, size_t aCount);
+void _ctmStreamReadFLOATArray(_CTMcontext * self, CTMfloat * aData, size_t aCount);
+void _ctmStreamReadFLOATRows(_CTMcontext * self, CTMfloat * aData, size_t aRows, CTMuint aWidth, CTMuint aStride);
+void _ctmStreamWriteFLOATArray(_CTMcontext * self, const CTMfloat * aData, size_t aCount);
+void _ctmStreamReadMappedUINTArray(_CTMcontext * self, CTMuint ** aData, size_t aCount);
+void _ctmStreamReadMappedFLOATArray(_CTMcontext * self, CTMfloat ** aData, size_t aCount);
 void _ctmStreamReadSTRING(_CTMcontext * self, char ** aValue);
 void _ctmStreamWriteSTRING(_CTMcontext * self, const char * aValue);
-int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData, CTMuint aCount, CTMuint aSize, CTMint aSignedInts);
-int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData, CTMuint aCount, CTMuint aSize, CTMint aSignedInts);
-int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData, CTMuint aCount, CTMuint aSize);
-int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData, CTMuint aCount, CTMuint aSize);
+int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData, size_t aCount, CTMuint aSize, CTMint aSignedInts);
+int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData, size_t aCount, CTMuint aSize, CTMint aSignedInts);
+int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData, size_t aCount, CTMuint aSize, CTMuint aWidth, CTMuint aStride);
+int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData, size_t aCount, CTMuint aSize);
+void _ctmStreamBeginBatch(_CTMcontext * self);
+int _ctmStreamEndBatch(_CTMcontext * self, CTMint aFinish);
+size_t _ctmStreamBatchScratchSize(_CTMcontext * self, size_t aTotal, CTMint aWriting);
+CTMuint _ctmStreamPackedBlockCount(size_t aSize);
+void _ctmStreamFreeLZMA(_CTMcontext * self);
+size_t _ctmStreamEncoderMemory(_CTMcontext * self, size_t aSize, CTMuint aThreads);
+size_t _ctmStreamDecoderMemory(void);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for interleave.c
+//-----------------------------------------------------------------------------
+void _ctmInterleaveWords(const CTMuint * aData, unsigned char * aPlanes, size_t aCount, CTMuint aSize, CTMint aSignedInts);
+void _ctmDeinterleaveWords(const unsigned char * aPlanes, CTMuint * aData, size_t aCount, CTMuint aSize, CTMint aSignedInts);
+void _ctmDeinterleaveWordsStrided(const unsigned char * aPlanes, CTMuint * aData, size_t aCount, CTMuint aSize, CTMuint aWidth, CTMuint aStride);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for thread.c
+//-----------------------------------------------------------------------------
+void _ctmMemoryLock(_CTMcontext * self);
+void _ctmMemoryUnlock(_CTMcontext * self);
+void _ctmFreeThreads(_CTMcontext * self);
+CTMuint _ctmThreadCount(_CTMcontext * self);
+void _ctmRunJobs(_CTMcontext * self, _CTMjobfn aJobFn, void * aJobs, size_t aJobSize, CTMuint aJobCount);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for sort.c
+//-----------------------------------------------------------------------------
+int _ctmRadixSort(_CTMcontext * self, CTMuint64 * aKeys, CTMuint * aValues, size_t aCount);
+int _ctmSortTriangles(_CTMcontext * self, CTMuint * aIndices, size_t aTriangleCount);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for scan.c
+//-----------------------------------------------------------------------------
+void _ctmPrefixSum(_CTMcontext * self, CTMuint * aData, size_t aCount, CTMuint aWidth, CTMuint aStride);
+void _ctmSegmentedPrefixSum(_CTMcontext * self, CTMuint * aData, const CTMuint * aKeys, size_t aCount, CTMuint aStride);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for filemap.c
+//-----------------------------------------------------------------------------
+int _ctmMapFile(_CTMcontext * self, const char * aFileName);
+void _ctmUnmapFile(_CTMcontext * self);
+int _ctmIsFileMapped(_CTMcontext * self, const void * aPtr);
 
 //-----------------------------------------------------------------------------
 // Funcion prototypes for compressRAW.c
 //-----------------------------------------------------------------------------
 int _ctmCompressMesh_RAW(_CTMcontext * self);
 int _ctmUncompressMesh_RAW(_CTMcontext * self);
+int _ctmUncompressArray_RAW(_CTMcontext * self, CTMenum aArray, _CTMfloatmap * aMap);
 
 //-----------------------------------------------------------------------------
 // Funcion prototypes for compressMG1.c
 //-----------------------------------------------------------------------------
+size_t _ctmScratchSize_MG1(_CTMcontext * self);
 int _ctmCompressMesh_MG1(_CTMcontext * self);
 int _ctmUncompressMesh_MG1(_CTMcontext * self);
+int _ctmUncompressArray_MG1(_CTMcontext * self, CTMenum aArray, _CTMfloatmap * aMap);
 
 //-----------------------------------------------------------------------------
 // Funcion prototypes for compressMG2.c
 //-----------------------------------------------------------------------------
+size_t _ctmScratchSize_MG2(_CTMcontext * self);
 int _ctmCompressMesh_MG2(_CTMcontext * self);
 int _ctmUncompressMesh_MG2(_CTMcontext * self);
+int _ctmUncompressArray_MG2(_CTMcontext * self, CTMenum aArray, _CTMfloatmap * aMap);
 
 #endif // __OPENCTM_INTERNAL_H_
@@ -20,6 +20,7 @@ static void LzInWindow_Free(CMatchFinder *p, ISzAlloc *alloc)
   {
     alloc->Free(alloc, p->bufferBase);
     p->bufferBase = 0;
+    p->bufferSize = 0;
   }
 }
 
@@ -33,12 +34,16 @@ static int LzInWindow_Create(CMatchFinder *p, UInt32 keepSizeReserv, ISzAlloc *a
     p->blockSize = blockSize;
     return 1;
   }
-  if (p->bufferBase == 0 || p->blockSize != blockSize)
+  /* OpenCTM: keep the buffer if it is large enough (the encoder is reused
+     for arrays of different sizes) */
+  if (p->bufferBase == 0 || p->bufferSize < blockSize)
   {
     LzInWindow_Free(p, alloc);
-    p->blockSize = blockSize;
     p->bufferBase = (Byte *)alloc->Alloc(alloc, (size_t)blockSize);
+    if (p->bufferBase != 0)
+      p->bufferSize = blockSize;
   }
+  p->blockSize = blockSize;
   return (p->bufferBase != 0);
 }
 
@@ -123,8 +128,10 @@ void MatchFinder_Construct(CMatchFinder *p)
 {
   UInt32 i;
   p->bufferBase = 0;
+  p->bufferSize = 0;
   p->directInput = 0;
   p->hash = 0;
+  p->numRefs = 0;
   MatchFinder_SetDefaultSettings(p);
 
   for (i = 0; i < 256; i++)
@@ -141,6 +148,7 @@ static void MatchFinder_FreeThisClassMemory(CMatchFinder *p, ISzAlloc *alloc)
 {
   alloc->Free(alloc, p->hash);
   p->hash = 0;
+  p->numRefs = 0;
 }
 
 void MatchFinder_Free(CMatchFinder *p, ISzAlloc *alloc)
@@ -211,19 +219,23 @@ int MatchFinder_Create(CMatchFinder *p, UInt32 historySize,
     }
 
     {
-      UInt32 prevSize = p->hashSizeSum + p->numSons;
       UInt32 newSize;
       p->historySize = historySize;
       p->hashSizeSum = hs;
       p->cyclicBufferSize = newCyclicBufferSize;
       p->numSons = (p->btMode ? newCyclicBufferSize * 2 : newCyclicBufferSize);
       newSize = p->hashSizeSum + p->numSons;
-      if (p->hash != 0 && prevSize == newSize)
+      /* OpenCTM: keep the table if it is large enough */
+      if (p->hash != 0 && newSize <= p->numRefs)
+      {
+        p->son = p->hash + p->hashSizeSum;
         return 1;
+      }
       MatchFinder_FreeThisClassMemory(p, alloc);
       p->hash = AllocRefs(newSize, alloc);
       if (p->hash != 0)
       {
+        p->numRefs = newSize;
         p->son = p->hash + p->hashSizeSum;
         return 1;
       }
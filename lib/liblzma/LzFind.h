@@ -42,6 +42,8 @@ typedef struct _CMatchFinder
   UInt32 fixedHashSize;
   UInt32 hashSizeSum;
   UInt32 numSons;
+  UInt32 bufferSize; /* allocated size of bufferBase (OpenCTM: a larger buffer is reused) */
+  UInt32 numRefs;    /* allocated size of hash (OpenCTM: a larger table is reused) */
   SRes result;
   UInt32 crc[256];
 } CMatchFinder;
@@ -37,6 +37,13 @@
 #define Hc3Zip_MatchFinder_Skip _ctm_Hc3Zip_MatchFinder_Skip
 #define MatchFinder_CreateVTable _ctm_MatchFinder_CreateVTable
 
+/* LzFindMt.c */
+#define MatchFinderMt_Construct _ctm_MatchFinderMt_Construct
+#define MatchFinderMt_Destruct _ctm_MatchFinderMt_Destruct
+#define MatchFinderMt_Create _ctm_MatchFinderMt_Create
+#define MatchFinderMt_CreateVTable _ctm_MatchFinderMt_CreateVTable
+#define MatchFinderMt_ReleaseStream _ctm_MatchFinderMt_ReleaseStream
+
 /* LzmaDec.c */
 #define LzmaDec_InitDicAndState _ctm_LzmaDec_InitDicAndState
 #define LzmaDec_Init _ctm_LzmaDec_Init
@@ -79,6 +86,25 @@
 #define LzmaCompress _ctm_LzmaCompress
 #define LzmaUncompress _ctm_LzmaUncompress
 
+/* Threads.c */
+#define Thread_Create _ctm_Thread_Create
+#define Thread_Wait _ctm_Thread_Wait
+#define Thread_Close _ctm_Thread_Close
+#define ManualResetEvent_Create _ctm_ManualResetEvent_Create
+#define ManualResetEvent_CreateNotSignaled _ctm_ManualResetEvent_CreateNotSignaled
+#define AutoResetEvent_Create _ctm_AutoResetEvent_Create
+#define AutoResetEvent_CreateNotSignaled _ctm_AutoResetEvent_CreateNotSignaled
+#define Event_Set _ctm_Event_Set
+#define Event_Reset _ctm_Event_Reset
+#define Event_Wait _ctm_Event_Wait
+#define Event_Close _ctm_Event_Close
+#define Semaphore_Create _ctm_Semaphore_Create
+#define Semaphore_ReleaseN _ctm_Semaphore_ReleaseN
+#define Semaphore_Release1 _ctm_Semaphore_Release1
+#define Semaphore_Wait _ctm_Semaphore_Wait
+#define Semaphore_Close _ctm_Semaphore_Close
+#define CriticalSection_Init _ctm_CriticalSection_Init
+
 #endif /* LZMA_PREFIX_CTM */
 
 #endif /* __7Z_NAMEMANGLE_H */
@@ -25,6 +25,14 @@
 //     distribution.
 //-----------------------------------------------------------------------------
 
+#if !defined(_WIN32)
+  // We need POSIX fseeko() with 64-bit file offsets (see _ctmFileSeek())
+  #define _DEFAULT_SOURCE
+  #define _BSD_SOURCE
+  #define _FILE_OFFSET_BITS 64
+  #include <sys/types.h>
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -51,45 +59,134 @@ static void _ctmFreeMapList(_CTMcontext * self, _CTMfloatmap * aMapList)
   while(map)
   {
     // Free internally allocated array (if we are in import mode)
-    if((self->mMode == CTM_IMPORT) && map->mValues)
-      free(map->mValues);
+    if((self->mMode == CTM_IMPORT) && map->mValues && !map->mDest &&
+       !_ctmIsFileMapped(self, map->mValues))
+      _ctmFree(self, map->mValues);
 
     // Free map name
     if(map->mName)
-      free(map->mName);
+      _ctmFree(self, map->mName);
 
     // Free file name
     if(map->mFileName)
-      free(map->mFileName);
+      _ctmFree(self, map->mFileName);
 
     nextMap = map->mNext;
-    free(map);
+    _ctmFree(self, map);
     map = nextMap;
   }
 }
 
+//-----------------------------------------------------------------------------
+// _ctmReleasePendingStream() - Release the input stream that was kept open
+// for loading arrays on demand (see CTM_LAZY_LOAD).
+//-----------------------------------------------------------------------------
+static void _ctmReleasePendingStream(_CTMcontext * self)
+{
+  self->mPendingCount = 0;
+
+  // Close the file that was opened by ctmLoad()
+  if(self->mPendingFile)
+  {
+    fclose((FILE *) self->mPendingFile);
+    self->mPendingFile = (void *) 0;
+  }
+
+  // Detach the stream (and the memory mapped file, unless the mesh arrays
+  // refer to it)
+  _ctmStreamInitMemory(self, (const void *) 0, 0);
+  if(!self->mFileMapInUse)
+    _ctmUnmapFile(self);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFreeScratch() - Free the scratch buffer for packed array decoding. It
+// is as large as the largest packed array, so it is not kept after a load.
+//-----------------------------------------------------------------------------
+static void _ctmFreeScratch(_CTMcontext * self)
+{
+  if(self->mScratch)
+    _ctmFree(self, self->mScratch);
+  self->mScratch = (unsigned char *) 0;
+  self->mScratchSize = 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFreeTemporaries() - Free the temporary buffers that a context keeps
+// between load/save operations (they are reallocated when needed).
+//-----------------------------------------------------------------------------
+static void _ctmFreeTemporaries(_CTMcontext * self)
+{
+  // Free the scratch buffer
+  _ctmFreeScratch(self);
+
+  // Free the scratch arena
+  _ctmArenaFree(self);
+
+  // Free the LZMA encoder/decoder
+  _ctmStreamFreeLZMA(self);
+
+  // Free the packed array batch
+  if(self->mBatchArrays)
+    _ctmFree(self, self->mBatchArrays);
+  self->mBatchArrays = (_CTMpackedarray *) 0;
+  self->mBatchArrayCapacity = 0;
+  if(self->mBatchBlocks)
+    _ctmFree(self, self->mBatchBlocks);
+  self->mBatchBlocks = (_CTMpackedblock *) 0;
+  self->mBatchBlockCapacity = 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFreeWorkBuffers() - Free all the buffers that a context keeps between
+// load/save operations.
+//-----------------------------------------------------------------------------
+static void _ctmFreeWorkBuffers(_CTMcontext * self)
+{
+  // Free the temporary buffers
+  _ctmFreeTemporaries(self);
+
+  // Free the stream buffer
+  if(self->mStreamBuf)
+    _ctmFree(self, self->mStreamBuf);
+  self->mStreamBuf = (unsigned char *) 0;
+  self->mStreamBufCapacity = 0;
+}
+
 //-----------------------------------------------------------------------------
 // _ctmClearMesh() - Clear the mesh in a CTM context.
 //-----------------------------------------------------------------------------
 static void _ctmClearMesh(_CTMcontext * self)
 {
-  // Free internally allocated mesh arrays
+  // Free internally allocated mesh arrays (arrays that point into a memory
+  // mapped file are released together with the mapping, and caller provided
+  // buffers are left alone)
   if(self->mMode == CTM_IMPORT)
   {
-    if(self->mVertices)
-      free(self->mVertices);
-    if(self->mIndices)
-      free(self->mIndices);
-    if(self->mNormals)
-      free(self->mNormals);
+    if(self->mVertices && !self->mVertexDest &&
+       !_ctmIsFileMapped(self, self->mVertices))
+      _ctmFree(self, self->mVertices);
+    if(self->mIndices && !_ctmIsFileMapped(self, self->mIndices))
+      _ctmFree(self, self->mIndices);
+    if(self->mNormals && !self->mNormalDest &&
+       !_ctmIsFileMapped(self, self->mNormals))
+      _ctmFree(self, self->mNormals);
   }
 
   // Clear externally assigned mesh arrays
   self->mVertices = (CTMfloat *) 0;
   self->mVertexCount = 0;
+  self->mVertexStride = 3;
+  self->mVertexDest = (CTMfloat *) 0;
   self->mIndices = (CTMuint *) 0;
   self->mTriangleCount = 0;
   self->mNormals = (CTMfloat *) 0;
+  self->mNormalStride = 3;
+  self->mNormalDest = (CTMfloat *) 0;
+  self->mHasNormals = CTM_FALSE;
+  self->mNormalsPending = CTM_FALSE;
+  self->mHeaderOnly = CTM_FALSE;
+  self->mHasAABB = CTM_FALSE;
 
   // Free UV coordinate map list
   _ctmFreeMapList(self, self->mUVMaps);
@@ -100,6 +197,37 @@ static void _ctmClearMesh(_CTMcontext * self)
   _ctmFreeMapList(self, self->mAttribMaps);
   self->mAttribMaps = (_CTMfloatmap *) 0;
   self->mAttribMapCount = 0;
+
+  // Release the input stream that was kept for arrays that are loaded on
+  // demand (if any)
+  if(self->mPendingCount > 0)
+    _ctmReleasePendingStream(self);
+
+  // Release the memory mapped file (if any)
+  _ctmUnmapFile(self);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmIsFiniteArray() - Check that all values of a per vertex float array
+// (aWidth values per vertex, stored aStride values apart) are finite
+// (non-NaN, non-inf).
+//-----------------------------------------------------------------------------
+static CTMint _ctmIsFiniteArray(_CTMcontext * self, const CTMfloat * aValues,
+  CTMuint aWidth, CTMuint aStride)
+{
+  size_t i;
+  CTMuint j;
+
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    for(j = 0; j < aWidth; ++ j)
+    {
+      if(!isfinite(aValues[i * aStride + j]))
+        return CTM_FALSE;
+    }
+  }
+
+  return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -109,7 +237,7 @@ static void _ctmClearMesh(_CTMcontext * self)
 
 static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
 {
-  CTMuint i;
+  size_t i;
   _CTMfloatmap * map;
 
   // Check that we have all the mandatory data
@@ -129,36 +257,25 @@ static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
   }
 
   // Check that all vertices are finite (non-NaN, non-inf)
-  for(i = 0; i < self->mVertexCount * 3; ++ i)
+  if(!_ctmIsFiniteArray(self, self->mVertices, 3, self->mVertexStride))
   {
-    if(!isfinite(self->mVertices[i]))
-    {
-      return CTM_FALSE;
-    }
+    return CTM_FALSE;
   }
 
   // Check that all normals are finite (non-NaN, non-inf)
-  if(self->mNormals)
+  if(self->mNormals &&
+     !_ctmIsFiniteArray(self, self->mNormals, 3, self->mNormalStride))
   {
-    for(i = 0; i < self->mVertexCount * 3; ++ i)
-    {
-      if(!isfinite(self->mNormals[i]))
-      {
-        return CTM_FALSE;
-      }
-    }
+    return CTM_FALSE;
   }
 
   // Check that all UV maps are finite (non-NaN, non-inf)
   map = self->mUVMaps;
   while(map)
   {
-    for(i = 0; i < self->mVertexCount * 2; ++ i)
+    if(map->mValues && !_ctmIsFiniteArray(self, map->mValues, 2, map->mStride))
     {
-      if(!isfinite(map->mValues[i]))
-      {
-        return CTM_FALSE;
-      }
+      return CTM_FALSE;
     }
     map = map->mNext;
   }
@@ -167,19 +284,362 @@ static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
   map = self->mAttribMaps;
   while(map)
   {
-    for(i = 0; i < self->mVertexCount * 4; ++ i)
+    if(map->mValues && !_ctmIsFiniteArray(self, map->mValues, 4, map->mStride))
+    {
+      return CTM_FALSE;
+    }
+    map = map->mNext;
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmGetAABB() - Get the axis aligned bounding box of the mesh. It is
+// calculated from the vertices if we have them, otherwise we use the bounding
+// box from the file header (if any).
+//-----------------------------------------------------------------------------
+static const CTMfloat * _ctmGetAABB(_CTMcontext * self)
+{
+  size_t i;
+  CTMuint j;
+  CTMfloat * aabb = self->mAABB;
+  const CTMfloat * p;
+
+  if(self->mVertices && (self->mVertexCount > 0))
+  {
+    for(j = 0; j < 3; ++ j)
+      aabb[j] = aabb[j + 3] = self->mVertices[j];
+    for(i = 1; i < self->mVertexCount; ++ i)
     {
-      if(!isfinite(map->mValues[i]))
+      p = &self->mVertices[i * self->mVertexStride];
+      for(j = 0; j < 3; ++ j)
       {
-        return CTM_FALSE;
+        if(p[j] < aabb[j])
+          aabb[j] = p[j];
+        else if(p[j] > aabb[j + 3])
+          aabb[j + 3] = p[j];
       }
     }
-    map = map->mNext;
+    return aabb;
+  }
+
+  if(self->mHasAABB)
+    return aabb;
+
+  return (CTMfloat *) 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAddPackedArray() - Add a packed array of aSize bytes to the sums of
+// _ctmPackedArraysSize().
+//-----------------------------------------------------------------------------
+static void _ctmAddPackedArray(_CTMcontext * self, size_t aSize,
+  size_t * aTotal, size_t * aLargest, size_t * aUnsplit)
+{
+  *aTotal += aSize;
+  if(aSize > *aLargest)
+    *aLargest = aSize;
+  if(aUnsplit && ((self->mFormatVersion < _CTM_FORMAT_VERSION) ||
+                  (_ctmStreamPackedBlockCount(aSize) == 1)))
+    *aUnsplit += aSize;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPackedArraysSize() - Get the total size of the packed arrays of the mesh
+// in a context (in bytes, uncompressed), and the size of the largest one in
+// *aLargest. When loading, only the arrays that are loaded right away are
+// counted (not the skipped arrays, or the arrays that are loaded on demand),
+// and if aUnsplit is not null, the total size of the arrays that are stored
+// as a single LZMA block is returned in *aUnsplit.
+//-----------------------------------------------------------------------------
+static size_t _ctmPackedArraysSize(_CTMcontext * self, size_t * aLargest,
+  size_t * aUnsplit)
+{
+  _CTMfloatmap * map;
+  size_t nv, total, largest;
+
+  nv = self->mVertexCount;
+  total = largest = 0;
+  if(aUnsplit)
+    *aUnsplit = 0;
+
+  // Indices and vertices (and grid indices, for MG2)
+  _ctmAddPackedArray(self, self->mTriangleCount * 3 * 4, &total, &largest,
+                     aUnsplit);
+  _ctmAddPackedArray(self, nv * 3 * 4, &total, &largest, aUnsplit);
+  if(self->mMethod == CTM_METHOD_MG2)
+    _ctmAddPackedArray(self, nv * 4, &total, &largest, aUnsplit);
+
+  // Normals
+  if(self->mNormals)
+    _ctmAddPackedArray(self, nv * 3 * 4, &total, &largest, aUnsplit);
+
+  // UV and attribute maps
+  for(map = self->mUVMaps; map; map = map->mNext)
+    if(map->mValues)
+      _ctmAddPackedArray(self, nv * 2 * 4, &total, &largest, aUnsplit);
+  for(map = self->mAttribMaps; map; map = map->mNext)
+    if(map->mValues)
+      _ctmAddPackedArray(self, nv * 4 * 4, &total, &largest, aUnsplit);
+
+  *aLargest = largest;
+  return total;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSelectMemoryMode() - Select the memory strategy of a load/save
+// operation, given the estimated amount of memory that it needs with the
+// normal strategy (aNormalSize) and with the low memory strategy (aLowSize).
+// Without a memory limit (see ctmMemoryLimit()), the normal strategy is
+// always used. Otherwise the low memory strategy is used if the normal one
+// would exceed the limit, and if neither of them fits, CTM_OUT_OF_MEMORY is
+// reported before anything is allocated. Returns false on failure.
+//-----------------------------------------------------------------------------
+static CTMint _ctmSelectMemoryMode(_CTMcontext * self, size_t aNormalSize,
+  size_t aLowSize)
+{
+  size_t available;
+
+  self->mLowMemory = CTM_FALSE;
+  if(!self->mMemoryLimit)
+    return CTM_TRUE;
+
+  available = _ctmMemoryAvailable(self);
+  if(aNormalSize <= available)
+    return CTM_TRUE;
+  if(aLowSize > available)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
   }
+  self->mLowMemory = CTM_TRUE;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPlanSave() - Select the memory strategy for saving the mesh in a
+// context (see _ctmSelectMemoryMode()). With the normal strategy, the packed
+// arrays are compressed concurrently (all of them are kept in memory), and
+// the LZMA encoder uses the default dictionary size. With the low memory
+// strategy, one array at a time is compressed, and the dictionary is as large
+// as the memory allows. With several threads, the scratch arena is made large
+// enough for the job buffers of the batch (see _ctmStreamEndBatch()).
+//-----------------------------------------------------------------------------
+static CTMint _ctmPlanSave(_CTMcontext * self)
+{
+  size_t base, total, largest, scratch, batch, normal, low;
+  CTMuint threads;
+
+  // The temporary buffers of earlier operations are not counted as
+  // available memory, so free them
+  if(self->mMemoryLimit)
+    _ctmFreeTemporaries(self);
+  self->mLowMemory = CTM_FALSE;
+
+  // Stream buffer
+  base = 0;
+  if(self->mStreamBufCapacity != self->mStreamBufferSize)
+    base = self->mStreamBufferSize;
+
+  // The RAW method has no packed arrays
+  if(self->mMethod == CTM_METHOD_RAW)
+    return _ctmSelectMemoryMode(self, base, base);
+
+  // Temporary arrays of the compression method (in the scratch arena)
+  total = _ctmPackedArraysSize(self, &largest, (size_t *) 0);
+  if(self->mMethod == CTM_METHOD_MG1)
+    scratch = _ctmScratchSize_MG1(self);
+  else
+    scratch = _ctmScratchSize_MG2(self);
+
+  // Low memory strategy: one encoder with the smallest dictionary
+  low = base + scratch + _ctmStreamEncoderMemory(self, 0, 1);
+
+  // Normal strategy: one encoder per thread, and with several threads, the
+  // interleaved copies of all the arrays and the packed data of all the
+  // blocks (the latter in the scratch arena, which the compression method
+  // is done with by then)
+  threads = _ctmThreadCount(self);
+  if(largest > _CTM_PACKED_BLOCK_SIZE)
+    largest = _CTM_PACKED_BLOCK_SIZE;
+  normal = base + threads * _ctmStreamEncoderMemory(self, largest,
+                                                    self->mCompressionThreads);
+  batch = 0;
+  if(threads > 1)
+  {
+    normal += total;
+    batch = _ctmStreamBatchScratchSize(self, total, CTM_TRUE);
+  }
+  if(batch < scratch)
+    batch = scratch;
+  normal += batch;
+
+  if(!_ctmSelectMemoryMode(self, normal, low))
+    return CTM_FALSE;
+  if(!self->mLowMemory && (threads > 1))
+    _ctmArenaReserve(self, batch);
+  return CTM_TRUE;
+}
 
+//-----------------------------------------------------------------------------
+// _ctmPlanLoad() - Select the memory strategy for loading a mesh (when the
+// mesh arrays have been allocated, see _ctmSelectMemoryMode()). With the
+// normal strategy, the packed arrays are uncompressed concurrently (all of
+// them are kept in memory). With the low memory strategy, one array at a
+// time is uncompressed. With several threads, the scratch arena is made
+// large enough for the job buffers of the batch (see _ctmStreamEndBatch()),
+// on top of the integer arrays of the MG2 method.
+//-----------------------------------------------------------------------------
+static CTMint _ctmPlanLoad(_CTMcontext * self)
+{
+  _CTMfloatmap * map;
+  size_t total, largest, unsplit, batch, normal, low, words;
+  CTMuint threads;
+
+  // The temporary buffers of earlier operations are not counted as
+  // available memory, so free them
+  if(self->mMemoryLimit)
+    _ctmFreeTemporaries(self);
+  self->mLowMemory = CTM_FALSE;
+
+  // The RAW method has no packed arrays
+  if(self->mMethod == CTM_METHOD_RAW)
+    return CTM_TRUE;
+
+  // Low memory strategy: the interleaved array, and for MG2 the integer
+  // arrays of the vertices and grid indices (four words per vertex), or of
+  // one map (and three words per vertex for the smooth normals)
+  total = _ctmPackedArraysSize(self, &largest, &unsplit);
+  low = largest + _ctmStreamDecoderMemory();
+  if(self->mMethod == CTM_METHOD_MG2)
+  {
+    words = 4;
+    for(map = self->mUVMaps; map; map = map->mNext)
+      if(map->mValues && (words < 2 + 3))
+        words = 2 + 3;
+    if(self->mNormals && (words < 3 + 3))
+      words = 3 + 3;
+    for(map = self->mAttribMaps; map; map = map->mNext)
+      if(map->mValues)
+        words = 4 + 3;
+    low += self->mVertexCount * words * 4;
+  }
+
+  // Normal strategy: with several threads, the integer, interleaved and
+  // packed copies of all the arrays (the interleaved data of the arrays that
+  // are stored as a single block is in the job buffers), and one decoder per
+  // thread
+  normal = low;
+  batch = 0;
+  threads = _ctmThreadCount(self);
+  if(threads > 1)
+  {
+    batch = _ctmStreamBatchScratchSize(self, unsplit, CTM_FALSE);
+    normal = 3 * total - unsplit + batch +
+             threads * _ctmStreamDecoderMemory();
+    if(self->mMethod == CTM_METHOD_MG2)
+      batch += total;
+  }
+
+  if(!_ctmSelectMemoryMode(self, normal, low))
+    return CTM_FALSE;
+  if(!self->mLowMemory && (threads > 1))
+    _ctmArenaReserve(self, batch);
   return CTM_TRUE;
 }
 
+//-----------------------------------------------------------------------------
+// _ctmLoadPendingArray() - Load an array that was not loaded together with the
+// mesh (see CTM_LAZY_LOAD). aArray is CTM_NORMALS (aMap is NULL),
+// CTM_UV_MAP_1 or CTM_ATTRIB_MAP_1.
+//-----------------------------------------------------------------------------
+static void _ctmLoadPendingArray(_CTMcontext * self, CTMenum aArray,
+  _CTMfloatmap * aMap)
+{
+  CTMfloat ** values, * dest;
+  CTMuint channels, stride;
+  size_t offset;
+  int ok = CTM_FALSE;
+
+  if(aArray == CTM_NORMALS)
+  {
+    values = &self->mNormals;
+    dest = self->mNormalDest;
+    channels = 3;
+    stride = self->mNormalStride;
+    offset = self->mNormalsOffset;
+    self->mNormalsPending = CTM_FALSE;
+  }
+  else
+  {
+    values = &aMap->mValues;
+    dest = aMap->mDest;
+    channels = (aArray == CTM_UV_MAP_1) ? 2 : 4;
+    stride = aMap->mStride;
+    offset = aMap->mOffset;
+    aMap->mPending = CTM_FALSE;
+  }
+
+  // Allocate memory for the array (unless it goes to a caller provided
+  // buffer)
+  if(dest)
+    *values = dest;
+  else
+    *values = (CTMfloat *) _ctmCalloc(self, self->mVertexCount, channels * sizeof(CTMfloat));
+  if(!*values)
+    self->mError = CTM_OUT_OF_MEMORY;
+  else if(offset == 0)
+  {
+    // The array was never reached when loading the mesh
+    self->mError = CTM_BAD_FORMAT;
+  }
+  else if(_ctmStreamSeek(self, offset))
+  {
+    // Uncompress the array
+    switch(self->mMethod)
+    {
+      case CTM_METHOD_RAW:
+        ok = _ctmUncompressArray_RAW(self, aArray, aMap);
+        break;
+
+      case CTM_METHOD_MG1:
+        ok = _ctmUncompressArray_MG1(self, aArray, aMap);
+        break;
+
+      case CTM_METHOD_MG2:
+        ok = _ctmUncompressArray_MG2(self, aArray, aMap);
+        break;
+
+      default:
+        self->mError = CTM_INTERNAL_ERROR;
+    }
+
+    // Check that all values are finite (non-NaN, non-inf)
+    if(ok && !_ctmIsFiniteArray(self, *values, channels, stride))
+    {
+      self->mError = CTM_INVALID_MESH;
+      ok = CTM_FALSE;
+    }
+  }
+  if(!ok && *values)
+  {
+    if(!dest && !_ctmIsFileMapped(self, *values))
+      _ctmFree(self, *values);
+    *values = (CTMfloat *) 0;
+  }
+
+  // The decoding scratch buffer and the scratch arena are not kept after the
+  // load
+  _ctmFreeScratch(self);
+  _ctmArenaFree(self);
+
+  // Release the input stream when all the pending arrays have been loaded
+  -- self->mPendingCount;
+  if(self->mPendingCount == 0)
+    _ctmReleasePendingStream(self);
+}
+
 //-----------------------------------------------------------------------------
 // ctmNewContext()
 //-----------------------------------------------------------------------------
@@ -196,8 +656,13 @@ CTMEXPORT CTMcontext CTMCALL ctmNewContext(CTMenum aMode)
   self->mError = CTM_NONE;
   self->mMethod = CTM_METHOD_MG1;
   self->mCompressionLevel = 1;
+  self->mCompressionThreads = 1;
   self->mVertexPrecision = 1.0f / 1024.0f;
   self->mNormalPrecision = 1.0f / 256.0f;
+  self->mStreamBufferSize = _CTM_STREAM_BUFFER_SIZE;
+  self->mVertexStride = 3;
+  self->mNormalStride = 3;
+  self->mThreadCount = 1;
 
   return (CTMcontext) self;
 }
@@ -215,7 +680,13 @@ CTMEXPORT void CTMCALL ctmFreeContext(CTMcontext aContext)
 
   // Free the file comment
   if(self->mFileComment)
-    free(self->mFileComment);
+    _ctmFree(self, self->mFileComment);
+
+  // Free the buffers that are kept between load/save operations
+  _ctmFreeWorkBuffers(self);
+
+  // Free the thread state
+  _ctmFreeThreads(self);
 
   // Free the context
   free(self);
@@ -273,6 +744,18 @@ CTMEXPORT const char * CTMCALL ctmErrorString(CTMenum aError)
 // ctmGetInteger()
 //-----------------------------------------------------------------------------
 CTMEXPORT CTMuint CTMCALL ctmGetInteger(CTMcontext aContext, CTMenum aProperty)
+{
+  CTMuint64 value;
+
+  value = ctmGetInteger64(aContext, aProperty);
+  return (value < 0xffffffff) ? (CTMuint) value : 0xffffffff;
+}
+
+//-----------------------------------------------------------------------------
+// ctmGetInteger64()
+//-----------------------------------------------------------------------------
+CTMEXPORT CTMuint64 CTMCALL ctmGetInteger64(CTMcontext aContext,
+  CTMenum aProperty)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
   if(!self) return 0;
@@ -280,10 +763,10 @@ CTMEXPORT CTMuint CTMCALL ctmGetInteger(CTMcontext aContext, CTMenum aProperty)
   switch(aProperty)
   {
     case CTM_VERTEX_COUNT:
-      return self->mVertexCount;
+      return (CTMuint64) self->mVertexCount;
 
     case CTM_TRIANGLE_COUNT:
-      return self->mTriangleCount;
+      return (CTMuint64) self->mTriangleCount;
 
     case CTM_UV_MAP_COUNT:
       return self->mUVMapCount;
@@ -292,11 +775,32 @@ CTMEXPORT CTMuint CTMCALL ctmGetInteger(CTMcontext aContext, CTMenum aProperty)
       return self->mAttribMapCount;
 
     case CTM_HAS_NORMALS:
-      return self->mNormals ? CTM_TRUE : CTM_FALSE;
+      return (self->mNormals || self->mHasNormals) ? CTM_TRUE : CTM_FALSE;
 
     case CTM_COMPRESSION_METHOD:
       return (CTMuint) self->mMethod;
 
+    case CTM_STREAM_BUFFER_SIZE:
+      return self->mStreamBufferSize;
+
+    case CTM_LOAD_OPTIONS:
+      return self->mLoadOptions;
+
+    case CTM_THREAD_COUNT:
+      return self->mThreadCount;
+
+    case CTM_COMPRESSION_THREADS:
+      return self->mCompressionThreads;
+
+    case CTM_MEMORY_USAGE:
+      return (CTMuint64) self->mMemoryUsed;
+
+    case CTM_PEAK_MEMORY:
+      return (CTMuint64) self->mMemoryPeak;
+
+    case CTM_MEMORY_LIMIT:
+      return (CTMuint64) self->mMemoryLimit;
+
     default:
       self->mError = CTM_INVALID_ARGUMENT;
   }
@@ -375,6 +879,8 @@ CTMEXPORT const CTMfloat * CTMCALL ctmGetFloatArray(CTMcontext aContext,
       self->mError = CTM_INTERNAL_ERROR;
       return (CTMfloat *) 0;
     }
+    if(map->mPending)
+      _ctmLoadPendingArray(self, CTM_UV_MAP_1, map);
     return map->mValues;
   }
 
@@ -394,6 +900,8 @@ CTMEXPORT const CTMfloat * CTMCALL ctmGetFloatArray(CTMcontext aContext,
       self->mError = CTM_INTERNAL_ERROR;
       return (CTMfloat *) 0;
     }
+    if(map->mPending)
+      _ctmLoadPendingArray(self, CTM_ATTRIB_MAP_1, map);
     return map->mValues;
   }
 
@@ -403,8 +911,13 @@ CTMEXPORT const CTMfloat * CTMCALL ctmGetFloatArray(CTMcontext aContext,
       return self->mVertices;
 
     case CTM_NORMALS:
+      if(self->mNormalsPending)
+        _ctmLoadPendingArray(self, CTM_NORMALS, (_CTMfloatmap *) 0);
       return self->mNormals;
 
+    case CTM_AABB:
+      return _ctmGetAABB(self);
+
     default:
       self->mError = CTM_INVALID_ARGUMENT;
   }
@@ -693,6 +1206,33 @@ CTMEXPORT void CTMCALL ctmCompressionLevel(CTMcontext aContext,
   self->mCompressionLevel = aLevel;
 }
 
+//-----------------------------------------------------------------------------
+// ctmCompressionThreads()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmCompressionThreads(CTMcontext aContext,
+  CTMuint aThreads)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments (the LZMA encoder supports one or two threads)
+  if((aThreads < 1) || (aThreads > 2))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Set the number of LZMA encoder threads
+  self->mCompressionThreads = aThreads;
+}
+
 //-----------------------------------------------------------------------------
 // ctmVertexPrecision()
 //-----------------------------------------------------------------------------
@@ -728,7 +1268,8 @@ CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
   CTMfloat avgEdgeLength, * p1, * p2;
-  CTMuint edgeCount, i, j;
+  size_t edgeCount, i;
+  CTMuint j;
   if(!self) return;
 
   // You are only allowed to change compression attributes in export mode
@@ -751,10 +1292,10 @@ CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
   edgeCount = 0;
   for(i = 0; i < self->mTriangleCount; ++ i)
   {
-    p1 = &self->mVertices[self->mIndices[i * 3 + 2] * 3];
+    p1 = &self->mVertices[(size_t) self->mIndices[i * 3 + 2] * 3];
     for(j = 0; j < 3; ++ j)
     {
-      p2 = &self->mVertices[self->mIndices[i * 3 + j] * 3];
+      p2 = &self->mVertices[(size_t) self->mIndices[i * 3 + j] * 3];
       avgEdgeLength += sqrtf((p2[0] - p1[0]) * (p2[0] - p1[0]) +
                              (p2[1] - p1[1]) * (p2[1] - p1[1]) +
                              (p2[2] - p1[2]) * (p2[2] - p1[2]));
@@ -906,7 +1447,7 @@ CTMEXPORT void CTMCALL ctmFileComment(CTMcontext aContext,
   // Free the old comment string, if necessary
   if(self->mFileComment)
   {
-    free(self->mFileComment);
+    _ctmFree(self, self->mFileComment);
     self->mFileComment = (char *) 0;
   }
 
@@ -918,7 +1459,7 @@ CTMEXPORT void CTMCALL ctmFileComment(CTMcontext aContext,
     return;
 
   // Copy the string
-  self->mFileComment = (char *) malloc(len + 1);
+  self->mFileComment = (char *) _ctmAlloc(self, len + 1);
   if(!self->mFileComment)
   {
     self->mError = CTM_OUT_OF_MEMORY;
@@ -928,75 +1469,269 @@ CTMEXPORT void CTMCALL ctmFileComment(CTMcontext aContext,
 }
 
 //-----------------------------------------------------------------------------
-// ctmDefineMesh()
+// ctmStreamBufferSize()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmDefineMesh(CTMcontext aContext,
-  const CTMfloat * aVertices, CTMuint aVertexCount, const CTMuint * aIndices,
-  CTMuint aTriangleCount, const CTMfloat * aNormals)
+CTMEXPORT void CTMCALL ctmStreamBufferSize(CTMcontext aContext,
+  CTMuint aSize)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
   if(!self) return;
 
-  // You are only allowed to (re)define the mesh in export mode
-  if(self->mMode != CTM_EXPORT)
+  // The new size takes effect at the next load/save operation
+  self->mStreamBufferSize = aSize;
+}
+
+//-----------------------------------------------------------------------------
+// ctmThreadCount()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmThreadCount(CTMcontext aContext, CTMuint aCount)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // The new count takes effect at the next load/save operation
+  self->mThreadCount = aCount;
+}
+
+//-----------------------------------------------------------------------------
+// ctmAllocator()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmAllocator(CTMcontext aContext, CTMallocfn aAllocFn,
+  CTMfreefn aFreeFn, void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // Check arguments (either both functions or none)
+  if((!aAllocFn) != (!aFreeFn))
   {
-    self->mError = CTM_INVALID_OPERATION;
+    self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Check arguments
-  if(!aVertices || !aIndices || !aVertexCount || !aTriangleCount)
+  // The memory that the context holds must be freed by the allocator that
+  // allocated it, so the allocator can not be changed while there is a mesh
+  // or a file comment in the context
+  if(self->mVertices || self->mIndices || self->mNormals || self->mUVMaps ||
+     self->mAttribMaps || self->mFileComment || self->mPendingCount)
   {
-    self->mError = CTM_INVALID_ARGUMENT;
+    self->mError = CTM_INVALID_OPERATION;
     return;
   }
 
-  // Clear the old mesh, if any
-  _ctmClearMesh(self);
+  // Free the remaining buffers with the old allocator
+  _ctmFreeWorkBuffers(self);
 
-  // Set vertex array pointer
-  self->mVertices = (CTMfloat *) aVertices;
-  self->mVertexCount = aVertexCount;
+  self->mAllocFn = aAllocFn;
+  self->mFreeFn = aFreeFn;
+  self->mAllocUserData = aUserData;
+}
 
-  // Set index array pointer
-  self->mIndices = (CTMuint *) aIndices;
-  self->mTriangleCount = aTriangleCount;
+//-----------------------------------------------------------------------------
+// ctmMemoryLimit()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmMemoryLimit(CTMcontext aContext, size_t aLimit)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
 
-  // Set normal array pointer
-  self->mNormals = (CTMfloat *) aNormals;
+  // The new limit takes effect at the next allocation (memory that has
+  // already been allocated is not affected)
+  self->mMemoryLimit = aLimit;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmAddFloatMap()
+// ctmLoadOptions()
 //-----------------------------------------------------------------------------
-static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
-  const CTMfloat * aValues, const char * aName, const char * aFileName,
-  _CTMfloatmap ** aList)
+CTMEXPORT void CTMCALL ctmLoadOptions(CTMcontext aContext, CTMuint aOptions)
 {
-  _CTMfloatmap * map;
-  CTMuint len;
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
 
-  // Allocate memory for a new map list item and append it to the list
-  if(!*aList)
-  {
-    *aList = (_CTMfloatmap *) malloc(sizeof(_CTMfloatmap));
-    map = *aList;
-  }
-  else
+  // You are only allowed to change load options in import mode
+  if(self->mMode != CTM_IMPORT)
   {
-    map = *aList;
-    while(map->mNext)
-      map = map->mNext;
-    map->mNext = (_CTMfloatmap *) malloc(sizeof(_CTMfloatmap));
-    map = map->mNext;
+    self->mError = CTM_INVALID_OPERATION;
+    return;
   }
-  if(!map)
+
+  // Check arguments
+  if(aOptions & ~(CTM_SKIP_NORMALS | CTM_SKIP_UV_MAPS | CTM_SKIP_ATTRIBS |
+                  CTM_LAZY_LOAD))
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return (_CTMfloatmap *) 0;
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
   }
 
-  // Init the map item
+  // Set options
+  self->mLoadOptions = aOptions;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadDestination()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadDestination(CTMcontext aContext, CTMenum aArray,
+  void * aBuffer, size_t aSize, CTMuint aStride, CTMuint aOffset)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  _CTMdest * dest;
+  CTMuint width;
+  if(!self) return;
+
+  // You are only allowed to set load destinations in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Which array?
+  if(aArray == CTM_VERTICES)
+  {
+    dest = &self->mLoadDest[0];
+    width = 3;
+  }
+  else if(aArray == CTM_NORMALS)
+  {
+    dest = &self->mLoadDest[1];
+    width = 3;
+  }
+  else if((aArray >= CTM_UV_MAP_1) && (aArray <= CTM_UV_MAP_8))
+  {
+    dest = &self->mLoadDest[2 + aArray - CTM_UV_MAP_1];
+    width = 2;
+  }
+  else if((aArray >= CTM_ATTRIB_MAP_1) && (aArray <= CTM_ATTRIB_MAP_8))
+  {
+    dest = &self->mLoadDest[10 + aArray - CTM_ATTRIB_MAP_1];
+    width = 4;
+  }
+  else
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Remove the destination?
+  if(!aBuffer)
+  {
+    dest->mData = (CTMfloat *) 0;
+    dest->mSize = 0;
+    dest->mStride = width;
+    return;
+  }
+
+  // Check arguments
+  if(aStride == 0)
+    aStride = width * sizeof(CTMfloat);
+  if((aStride % sizeof(CTMfloat)) || (aStride < width * sizeof(CTMfloat)) ||
+     (aOffset % sizeof(CTMfloat)) || (aOffset >= aSize) ||
+     (((size_t) aBuffer) % sizeof(CTMfloat)))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Set the destination
+  dest->mData = (CTMfloat *) ((unsigned char *) aBuffer + aOffset);
+  dest->mSize = aSize - aOffset;
+  dest->mStride = aStride / sizeof(CTMfloat);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmIsValidCount() - Check that a vertex or triangle count is small enough
+// that the per vertex/triangle arrays (at most 16 bytes per element) can be
+// addressed with a size_t.
+//-----------------------------------------------------------------------------
+static CTMint _ctmIsValidCount(CTMuint64 aCount)
+{
+  return (aCount <= (CTMuint64) (((size_t) -1) / 16)) ? CTM_TRUE : CTM_FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// ctmDefineMesh()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmDefineMesh(CTMcontext aContext,
+  const CTMfloat * aVertices, CTMuint aVertexCount, const CTMuint * aIndices,
+  CTMuint aTriangleCount, const CTMfloat * aNormals)
+{
+  ctmDefineMesh64(aContext, aVertices, (CTMuint64) aVertexCount, aIndices,
+                  (CTMuint64) aTriangleCount, aNormals);
+}
+
+//-----------------------------------------------------------------------------
+// ctmDefineMesh64()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmDefineMesh64(CTMcontext aContext,
+  const CTMfloat * aVertices, CTMuint64 aVertexCount,
+  const CTMuint * aIndices, CTMuint64 aTriangleCount,
+  const CTMfloat * aNormals)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to (re)define the mesh in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments (every vertex must be reachable with a 32-bit index)
+  if(!aVertices || !aIndices || !aVertexCount || !aTriangleCount ||
+     (aVertexCount > ((CTMuint64) 1 << 32)) ||
+     !_ctmIsValidCount(aVertexCount) || !_ctmIsValidCount(aTriangleCount))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Clear the old mesh, if any
+  _ctmClearMesh(self);
+
+  // Set vertex array pointer
+  self->mVertices = (CTMfloat *) aVertices;
+  self->mVertexCount = (size_t) aVertexCount;
+
+  // Set index array pointer
+  self->mIndices = (CTMuint *) aIndices;
+  self->mTriangleCount = (size_t) aTriangleCount;
+
+  // Set normal array pointer
+  self->mNormals = (CTMfloat *) aNormals;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAddFloatMap()
+//-----------------------------------------------------------------------------
+static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
+  const CTMfloat * aValues, const char * aName, const char * aFileName,
+  _CTMfloatmap ** aList)
+{
+  _CTMfloatmap * map;
+  CTMuint len;
+
+  // Allocate memory for a new map list item and append it to the list
+  if(!*aList)
+  {
+    *aList = (_CTMfloatmap *) _ctmAlloc(self, sizeof(_CTMfloatmap));
+    map = *aList;
+  }
+  else
+  {
+    map = *aList;
+    while(map->mNext)
+      map = map->mNext;
+    map->mNext = (_CTMfloatmap *) _ctmAlloc(self, sizeof(_CTMfloatmap));
+    map = map->mNext;
+  }
+  if(!map)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return (_CTMfloatmap *) 0;
+  }
+
+  // Init the map item
   memset(map, 0, sizeof(_CTMfloatmap));
   map->mPrecision = 1.0f / 1024.0f;
   map->mValues = (CTMfloat *) aValues;
@@ -1009,11 +1744,11 @@ static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
     if(len)
     {
       // Copy the string
-      map->mName = (char *) malloc(len + 1);
+      map->mName = (char *) _ctmAlloc(self, len + 1);
       if(!map->mName)
       {
         self->mError = CTM_OUT_OF_MEMORY;
-        free(map);
+        _ctmFree(self, map);
         return (_CTMfloatmap *) 0;
       }
       strcpy(map->mName, aName);
@@ -1028,13 +1763,13 @@ static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
     if(len)
     {
       // Copy the string
-      map->mFileName = (char *) malloc(len + 1);
+      map->mFileName = (char *) _ctmAlloc(self, len + 1);
       if(!map->mFileName)
       {
         self->mError = CTM_OUT_OF_MEMORY;
         if(map->mName)
-          free(map->mName);
-        free(map);
+          _ctmFree(self, map->mName);
+        _ctmFree(self, map);
         return (_CTMfloatmap *) 0;
       }
       strcpy(map->mFileName, aFileName);
@@ -1062,6 +1797,7 @@ CTMEXPORT CTMenum CTMCALL ctmAddUVMap(CTMcontext aContext,
   {
     // The default UV coordinate precision is 2^-12
     map->mPrecision = 1.0f / 4096.0f;
+    map->mStride = 2;
     ++ self->mUVMapCount;
     return CTM_UV_MAP_1 + self->mUVMapCount - 1;
   }
@@ -1086,6 +1822,7 @@ CTMEXPORT CTMenum CTMCALL ctmAddAttribMap(CTMcontext aContext,
   {
     // The default vertex attribute precision is 2^-8
     map->mPrecision = 1.0f / 256.0f;
+    map->mStride = 4;
     ++ self->mAttribMapCount;
     return CTM_ATTRIB_MAP_1 + self->mAttribMapCount - 1;
   }
@@ -1101,66 +1838,124 @@ static CTMuint CTMCALL _ctmDefaultRead(void * aBuf, CTMuint aCount,
 }
 
 //-----------------------------------------------------------------------------
-// ctmLoad()
+// _ctmFileSeek() - Move to an absolute position in a file. fseek() takes a
+// long, which is only 32 bits on Windows and on 32-bit systems, so 64-bit
+// offsets are used where available. Returns zero on success.
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName)
+static int _ctmFileSeek(FILE * aFile, size_t aOffset)
 {
-  _CTMcontext * self = (_CTMcontext *) aContext;
-  FILE * f;
-  if(!self) return;
+#if defined(_MSC_VER) || defined(__MINGW32__)
+  return _fseeki64(aFile, (__int64) aOffset, SEEK_SET);
+#elif defined(_WIN32)
+  if(aOffset > 0x7fffffff)
+    return -1;
+  return fseek(aFile, (long) aOffset, SEEK_SET);
+#else
+  if(((off_t) aOffset < 0) || ((size_t) (off_t) aOffset != aOffset))
+    return -1;
+  return fseeko(aFile, (off_t) aOffset, SEEK_SET);
+#endif
+}
 
-  // You are only allowed to load data in import mode
-  if(self->mMode != CTM_IMPORT)
-  {
-    self->mError = CTM_INVALID_OPERATION;
-    return;
-  }
+//-----------------------------------------------------------------------------
+// _ctmDefaultSeek()
+//-----------------------------------------------------------------------------
+static int _ctmDefaultSeek(size_t aOffset, void * aUserData)
+{
+  FILE * f = (FILE *) aUserData;
+
+  // Seeking past the end of a file is not an error, so read the last skipped
+  // byte to make sure that the data is really there
+  if(aOffset == 0)
+    return _ctmFileSeek(f, 0) == 0;
+  if(_ctmFileSeek(f, aOffset - 1) != 0)
+    return 0;
+  return getc(f) != EOF;
+}
 
-  // Open file stream
-  f = fopen(aFileName, "rb");
-  if(!f)
+//-----------------------------------------------------------------------------
+// _ctmGetLoadDest() - Get the caller provided destination buffer for a float
+// array with aWidth values per vertex (aIndex is the index into mLoadDest).
+// *aDest is set to null if no buffer was provided, in which case *aStride is
+// aWidth. Returns false if the buffer is too small for the mesh.
+//-----------------------------------------------------------------------------
+static CTMint _ctmGetLoadDest(_CTMcontext * self, CTMuint aIndex,
+  CTMuint aWidth, CTMfloat ** aDest, CTMuint * aStride)
+{
+  _CTMdest * dest;
+
+  *aDest = (CTMfloat *) 0;
+  *aStride = aWidth;
+  dest = &self->mLoadDest[aIndex];
+  if(!dest->mData)
+    return CTM_TRUE;
+
+  // The last vertex must fit in the buffer
+  if(dest->mSize < (((size_t) self->mVertexCount - 1) * dest->mStride +
+                    aWidth) * sizeof(CTMfloat))
   {
-    self->mError = CTM_FILE_ERROR;
-    return;
+    self->mError = CTM_INVALID_ARGUMENT;
+    return CTM_FALSE;
   }
 
-  // Load the file
-  ctmLoadCustom(self, _ctmDefaultRead, (void *) f);
-
-  // Close file stream
-  fclose(f);
+  *aDest = dest->mData;
+  *aStride = dest->mStride;
+  return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmAllocateFloatMaps()
+// _ctmAllocateFloatMaps() - Allocate a list of float maps. The values are
+// only allocated if aLoadValues is true (otherwise they are skipped when
+// loading), and not until they are requested if aPending is true. Maps that
+// have a caller provided buffer (see ctmLoadDestination()) are loaded to that
+// buffer, starting with mLoadDest[aDestIndex] for the first map.
 //-----------------------------------------------------------------------------
 static CTMuint _ctmAllocateFloatMaps(_CTMcontext * self,
-  _CTMfloatmap ** aMapListPtr, CTMuint aCount, CTMuint aChannels)
+  _CTMfloatmap ** aMapListPtr, CTMuint aCount, CTMuint aChannels,
+  CTMint aLoadValues, CTMint aPending, CTMuint aDestIndex)
 {
-  _CTMfloatmap ** mapListPtr;
-  CTMuint i, size;
+  _CTMfloatmap ** mapListPtr, * map;
+  CTMuint i;
 
   mapListPtr = aMapListPtr;
   for(i = 0; i < aCount; ++ i)
   {
     // Allocate & clear memory for this map
-    *mapListPtr = (_CTMfloatmap *) malloc(sizeof(_CTMfloatmap));
+    *mapListPtr = (_CTMfloatmap *) _ctmAlloc(self, sizeof(_CTMfloatmap));
     if(!*mapListPtr)
     {
       self->mError = CTM_OUT_OF_MEMORY;
       return CTM_FALSE;
     }
-    memset(*mapListPtr, 0, sizeof(_CTMfloatmap));
+    map = *mapListPtr;
+    memset(map, 0, sizeof(_CTMfloatmap));
+    map->mStride = aChannels;
+
+    // Use the caller provided buffer (if any, only the first eight maps of
+    // each kind can have one)
+    if(aLoadValues && (i < 8) &&
+       !_ctmGetLoadDest(self, aDestIndex + i, aChannels, &map->mDest,
+                        &map->mStride))
+      return CTM_FALSE;
 
-    // Allocate & clear memory for the float array
-    size = aChannels * sizeof(CTMfloat) * self->mVertexCount;
-    (*mapListPtr)->mValues = (CTMfloat *) malloc(size);
-    if(!(*mapListPtr)->mValues)
+    // Allocate & clear memory for the float array (or load it on demand)
+    if(aLoadValues && aPending)
     {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
+      map->mPending = CTM_TRUE;
+      ++ self->mPendingCount;
+    }
+    else if(aLoadValues && map->mDest)
+      map->mValues = map->mDest;
+    else if(aLoadValues)
+    {
+      map->mValues = (CTMfloat *) _ctmCalloc(self, self->mVertexCount,
+                                             aChannels * sizeof(CTMfloat));
+      if(!map->mValues)
+      {
+        self->mError = CTM_OUT_OF_MEMORY;
+        return CTM_FALSE;
+      }
     }
-    memset((*mapListPtr)->mValues, 0, size);
 
     // Next map...
     mapListPtr = &(*mapListPtr)->mNext;
@@ -1170,28 +1965,20 @@ static CTMuint _ctmAllocateFloatMaps(_CTMcontext * self,
 }
 
 //-----------------------------------------------------------------------------
-// ctmLoadCustom()
+// _ctmLoadStream() - Load a mesh from the stream that has been set up in the
+// CTM context (any old mesh must have been cleared first). If aHeaderOnly is
+// true, only the header and the array properties (names, precisions etc) are
+// loaded, and the packed arrays are skipped. The method decoders skip any
+// array that has not been allocated here (see ctmLoadOptions()).
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
-  void * aUserData)
+static void _ctmLoadStream(_CTMcontext * self, CTMint aHeaderOnly)
 {
-  _CTMcontext * self = (_CTMcontext *) aContext;
   CTMuint formatVersion, flags, method;
-  if(!self) return;
-
-  // You are only allowed to load data in import mode
-  if(self->mMode != CTM_IMPORT)
-  {
-    self->mError = CTM_INVALID_OPERATION;
-    return;
-  }
+  CTMuint64 vertexCount, triangleCount;
+  CTMint lazy;
+  CTMenum error;
 
-  // Initialize stream
-  self->mReadFn = aReadFn;
-  self->mUserData = aUserData;
-
-  // Clear any old mesh arrays
-  _ctmClearMesh(self);
+  self->mHeaderOnly = aHeaderOnly;
 
   // Read header from stream
   if(_ctmStreamReadUINT(self) != FOURCC("OCTM"))
@@ -1200,11 +1987,14 @@ CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
     return;
   }
   formatVersion = _ctmStreamReadUINT(self);
-  if(formatVersion != _CTM_FORMAT_VERSION)
+  if((formatVersion != _CTM_FORMAT_VERSION) &&
+     (formatVersion != _CTM_FORMAT_VERSION_5) &&
+     (formatVersion != _CTM_FORMAT_VERSION_7))
   {
     self->mError = CTM_UNSUPPORTED_FORMAT_VERSION;
     return;
   }
+  self->mFormatVersion = formatVersion;
   method = _ctmStreamReadUINT(self);
   if(method == FOURCC("RAW\0"))
     self->mMethod = CTM_METHOD_RAW;
@@ -1217,59 +2007,108 @@ CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
     self->mError = CTM_BAD_FORMAT;
     return;
   }
-  self->mVertexCount = _ctmStreamReadUINT(self);
-  if(self->mVertexCount == 0)
+
+  // Vertex and triangle counts (64-bit in format version 7 files)
+  if(formatVersion == _CTM_FORMAT_VERSION_7)
+  {
+    vertexCount = _ctmStreamReadUINT64(self);
+    triangleCount = _ctmStreamReadUINT64(self);
+  }
+  else
+  {
+    vertexCount = _ctmStreamReadUINT(self);
+    triangleCount = _ctmStreamReadUINT(self);
+  }
+  if((vertexCount == 0) || (triangleCount == 0))
   {
     self->mError = CTM_BAD_FORMAT;
     return;
   }
-  self->mTriangleCount = _ctmStreamReadUINT(self);
-  if(self->mTriangleCount == 0)
+  if(!_ctmIsValidCount(vertexCount) || !_ctmIsValidCount(triangleCount))
   {
-    self->mError = CTM_BAD_FORMAT;
+    self->mError = CTM_OUT_OF_MEMORY;
     return;
   }
+  self->mVertexCount = (size_t) vertexCount;
+  self->mTriangleCount = (size_t) triangleCount;
   self->mUVMapCount = _ctmStreamReadUINT(self);
   self->mAttribMapCount = _ctmStreamReadUINT(self);
   flags = _ctmStreamReadUINT(self);
+  self->mHasNormals = (flags & _CTM_HAS_NORMALS_BIT) ? CTM_TRUE : CTM_FALSE;
   _ctmStreamReadSTRING(self, &self->mFileComment);
 
-  // Allocate memory for the mesh arrays
-  self->mVertices = (CTMfloat *) malloc(self->mVertexCount * sizeof(CTMfloat) * 3);
-  if(!self->mVertices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return;
-  }
-  self->mIndices = (CTMuint *) malloc(self->mTriangleCount * sizeof(CTMuint) * 3);
-  if(!self->mIndices)
-  {
-    _ctmClearMesh(self);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return;
-  }
-  if(flags & _CTM_HAS_NORMALS_BIT)
+  // Normals and UV/attribute maps can be loaded on demand if the stream is
+  // seekable (the vertices and indices are always loaded)
+  lazy = !aHeaderOnly && (self->mLoadOptions & CTM_LAZY_LOAD) &&
+         _ctmStreamIsSeekable(self);
+
+  // Allocate memory for the mesh arrays (or use the caller provided buffers)
+  if(!aHeaderOnly)
   {
-    self->mNormals = (CTMfloat *) malloc(self->mVertexCount * sizeof(CTMfloat) * 3);
-    if(!self->mNormals)
+    if(!_ctmGetLoadDest(self, 0, 3, &self->mVertexDest, &self->mVertexStride))
+      return;
+    if(self->mVertexDest)
+      self->mVertices = self->mVertexDest;
+    else
+      self->mVertices = (CTMfloat *) _ctmAlloc(self, self->mVertexCount * sizeof(CTMfloat) * 3);
+    if(!self->mVertices)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return;
+    }
+    self->mIndices = (CTMuint *) _ctmAlloc(self, self->mTriangleCount * sizeof(CTMuint) * 3);
+    if(!self->mIndices)
     {
       _ctmClearMesh(self);
       self->mError = CTM_OUT_OF_MEMORY;
       return;
     }
+    if(self->mHasNormals && !(self->mLoadOptions & CTM_SKIP_NORMALS) &&
+       !_ctmGetLoadDest(self, 1, 3, &self->mNormalDest, &self->mNormalStride))
+    {
+      _ctmClearMesh(self);
+      self->mError = CTM_INVALID_ARGUMENT;
+      return;
+    }
+    if(self->mHasNormals && !(self->mLoadOptions & CTM_SKIP_NORMALS) && lazy)
+    {
+      self->mNormalsPending = CTM_TRUE;
+      ++ self->mPendingCount;
+    }
+    else if(self->mHasNormals && !(self->mLoadOptions & CTM_SKIP_NORMALS))
+    {
+      if(self->mNormalDest)
+        self->mNormals = self->mNormalDest;
+      else
+        self->mNormals = (CTMfloat *) _ctmAlloc(self, self->mVertexCount * sizeof(CTMfloat) * 3);
+      if(!self->mNormals)
+      {
+        _ctmClearMesh(self);
+        self->mError = CTM_OUT_OF_MEMORY;
+        return;
+      }
+    }
   }
 
   // Allocate memory for the UV and attribute maps (if any)
-  if(!_ctmAllocateFloatMaps(self, &self->mUVMaps, self->mUVMapCount, 2))
+  if(!_ctmAllocateFloatMaps(self, &self->mUVMaps, self->mUVMapCount, 2,
+       !aHeaderOnly && !(self->mLoadOptions & CTM_SKIP_UV_MAPS), lazy, 2) ||
+     !_ctmAllocateFloatMaps(self, &self->mAttribMaps, self->mAttribMapCount, 4,
+       !aHeaderOnly && !(self->mLoadOptions & CTM_SKIP_ATTRIBS), lazy, 10))
   {
+    error = self->mError;
     _ctmClearMesh(self);
-    self->mError = CTM_OUT_OF_MEMORY;
+    self->mError = error;
     return;
   }
-  if(!_ctmAllocateFloatMaps(self, &self->mAttribMaps, self->mAttribMapCount, 4))
+
+  // Select the memory strategy (this fails if the mesh can not be loaded
+  // within the memory limit)
+  if(!aHeaderOnly && !_ctmPlanLoad(self))
   {
+    error = self->mError;
     _ctmClearMesh(self);
-    self->mError = CTM_OUT_OF_MEMORY;
+    self->mError = error;
     return;
   }
 
@@ -1292,14 +2131,220 @@ CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
       self->mError = CTM_INTERNAL_ERROR;
   }
 
+  // In low memory mode, the temporary buffers are not kept. The decoding
+  // scratch buffer and the scratch arena are never kept after a load (they
+  // would stay resident next to the mesh), only between saves.
+  if(self->mLowMemory)
+    _ctmFreeTemporaries(self);
+  else
+  {
+    _ctmFreeScratch(self);
+    _ctmArenaFree(self);
+  }
+
   // Check mesh integrity
-  if(!_ctmCheckMeshIntegrity(self))
+  if(!aHeaderOnly && !_ctmCheckMeshIntegrity(self))
   {
     self->mError = CTM_INVALID_MESH;
     return;
   }
 }
 
+//-----------------------------------------------------------------------------
+// _ctmLoadFile() - Load a file (or only its header) through a file stream.
+//-----------------------------------------------------------------------------
+static void _ctmLoadFile(_CTMcontext * self, const char * aFileName,
+  CTMint aHeaderOnly)
+{
+  FILE * f;
+
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Open file stream
+  f = fopen(aFileName, "rb");
+  if(!f)
+  {
+    self->mError = CTM_FILE_ERROR;
+    return;
+  }
+
+  // Clear any old mesh arrays
+  _ctmClearMesh(self);
+
+  // Initialize stream (file streams are seekable)
+  self->mReadFn = _ctmDefaultRead;
+  self->mSeekFn = _ctmDefaultSeek;
+  self->mUserData = (void *) f;
+  self->mStreamReadAhead = CTM_TRUE;
+  _ctmStreamInit(self);
+
+  // Load the mesh
+  _ctmLoadStream(self, aHeaderOnly);
+
+  // Close file stream (unless it is needed for loading arrays on demand)
+  if(self->mPendingCount > 0)
+    self->mPendingFile = (void *) f;
+  else
+  {
+    fclose(f);
+    self->mUserData = (void *) 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoad()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  _ctmLoadFile(self, aFileName, CTM_FALSE);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadHeader()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadHeader(CTMcontext aContext,
+  const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  _ctmLoadFile(self, aFileName, CTM_TRUE);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLoadCustom() - Load a file (or only its header) through a custom
+// stream read function.
+//-----------------------------------------------------------------------------
+static void _ctmLoadCustom(_CTMcontext * self, CTMreadfn aReadFn,
+  void * aUserData, CTMint aHeaderOnly)
+{
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Clear any old mesh arrays
+  _ctmClearMesh(self);
+
+  // Initialize stream (a custom stream may hold other data after the OpenCTM
+  // data, so never read more than is needed)
+  self->mReadFn = aReadFn;
+  self->mSeekFn = (_CTMseekfn) 0;
+  self->mUserData = aUserData;
+  self->mStreamReadAhead = CTM_FALSE;
+  _ctmStreamInit(self);
+
+  // Load the mesh
+  _ctmLoadStream(self, aHeaderOnly);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadCustom()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
+  void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  _ctmLoadCustom(self, aReadFn, aUserData, CTM_FALSE);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadHeaderCustom()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadHeaderCustom(CTMcontext aContext,
+  CTMreadfn aReadFn, void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  _ctmLoadCustom(self, aReadFn, aUserData, CTM_TRUE);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadFromMemory()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadFromMemory(CTMcontext aContext,
+  const void * aData, size_t aSize)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+  if(!aData)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Clear any old mesh arrays
+  _ctmClearMesh(self);
+
+  // Initialize stream, and load the mesh
+  _ctmStreamInitMemory(self, aData, aSize);
+  _ctmLoadStream(self, CTM_FALSE);
+
+  // Forget about the memory block (unless it is needed for loading arrays on
+  // demand)
+  if(self->mPendingCount == 0)
+    _ctmStreamInitMemory(self, (const void *) 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadMapped()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadMapped(CTMcontext aContext,
+  const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Clear any old mesh arrays (and old mapping)
+  _ctmClearMesh(self);
+
+  // Map the file into memory
+  if(!_ctmMapFile(self, aFileName))
+    return;
+
+  // Initialize stream
+  _ctmStreamInitMemory(self, self->mFileMap, self->mFileMapSize);
+
+  // Load the mesh
+  _ctmLoadStream(self, CTM_FALSE);
+
+  // Forget about the stream, and keep the mapping only if the mesh arrays
+  // refer to it (unless it is needed for loading arrays on demand)
+  if(self->mPendingCount == 0)
+  {
+    _ctmStreamInitMemory(self, (const void *) 0, 0);
+    if(!self->mFileMapInUse)
+      _ctmUnmapFile(self);
+  }
+}
+
 //-----------------------------------------------------------------------------
 // _ctmDefaultWrite()
 //-----------------------------------------------------------------------------
@@ -1364,6 +2409,8 @@ static CTMuint CTMCALL _ctmWriteToBuffer(const void * aBuf, CTMuint aCount,
     while (newSize < needSpace)
       newSize *= 2;
     newBuf = malloc(newSize);
+    if (!newBuf)
+      return 0;
     // copy old buffer to new, free old buffer
     memcpy(newBuf, dynBuf->buffer, dynBuf->size);
     free(dynBuf->buffer);
@@ -1408,6 +2455,34 @@ CTMEXPORT void CTMCALL ctmFreeBuffer(void *buffer)
   free(buffer);
 }
 
+//-----------------------------------------------------------------------------
+// _ctmSaveFormatVersion() - Select the file format version for saving. Only
+// files with packed arrays that are split into several LZMA blocks need
+// version 6, and only meshes with more than 0xffffffff vertices or triangles
+// need version 7, so other files are saved as version 5 files (which can be
+// read by older versions of OpenCTM).
+//-----------------------------------------------------------------------------
+static CTMuint _ctmSaveFormatVersion(_CTMcontext * self)
+{
+  size_t largest;
+
+  // 64-bit counts?
+  if(((CTMuint64) self->mVertexCount > 0xffffffff) ||
+     ((CTMuint64) self->mTriangleCount > 0xffffffff))
+    return _CTM_FORMAT_VERSION_7;
+
+  // The RAW method has no packed arrays
+  if(self->mMethod == CTM_METHOD_RAW)
+    return _CTM_FORMAT_VERSION_5;
+
+  // The largest packed array is the indices (three words per triangle), or a
+  // per vertex array (up to four words per vertex, for attribute maps)
+  _ctmPackedArraysSize(self, &largest, (size_t *) 0);
+
+  return (_ctmStreamPackedBlockCount(largest) > 1) ? _CTM_FORMAT_VERSION :
+                                                     _CTM_FORMAT_VERSION_5;
+}
+
 //-----------------------------------------------------------------------------
 // ctmSaveCustom()
 //-----------------------------------------------------------------------------
@@ -1416,6 +2491,7 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
   CTMuint flags;
+  CTMint multiThreaded, ok;
   if(!self) return;
 
   // You are only allowed to save data in export mode
@@ -1432,9 +2508,15 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
     return;
   }
 
+  // Select the memory strategy (this fails if the mesh can not be saved
+  // within the memory limit)
+  if(!_ctmPlanSave(self))
+    return;
+
   // Initialize stream
   self->mWriteFn = aWriteFn;
   self->mUserData = aUserData;
+  _ctmStreamInit(self);
 
   // Determine flags
   flags = 0;
@@ -1442,8 +2524,9 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
     flags |= _CTM_HAS_NORMALS_BIT;
 
   // Write header to stream
+  self->mFormatVersion = _ctmSaveFormatVersion(self);
   _ctmStreamWrite(self, (void *) "OCTM", 4);
-  _ctmStreamWriteUINT(self, _CTM_FORMAT_VERSION);
+  _ctmStreamWriteUINT(self, self->mFormatVersion);
   switch(self->mMethod)
   {
     case CTM_METHOD_RAW:
@@ -1459,33 +2542,60 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
       break;
 
     default:
+      _ctmStreamFlush(self);
       self->mError = CTM_INTERNAL_ERROR;
       return;
   }
-  _ctmStreamWriteUINT(self, self->mVertexCount);
-  _ctmStreamWriteUINT(self, self->mTriangleCount);
+  if(self->mFormatVersion == _CTM_FORMAT_VERSION_7)
+  {
+    _ctmStreamWriteUINT64(self, (CTMuint64) self->mVertexCount);
+    _ctmStreamWriteUINT64(self, (CTMuint64) self->mTriangleCount);
+  }
+  else
+  {
+    _ctmStreamWriteUINT(self, (CTMuint) self->mVertexCount);
+    _ctmStreamWriteUINT(self, (CTMuint) self->mTriangleCount);
+  }
   _ctmStreamWriteUINT(self, self->mUVMapCount);
   _ctmStreamWriteUINT(self, self->mAttribMapCount);
   _ctmStreamWriteUINT(self, flags);
   _ctmStreamWriteSTRING(self, self->mFileComment);
 
+  // With several threads, the packed arrays are compressed concurrently (the
+  // output is the same as with a single thread)
+  multiThreaded = (_ctmThreadCount(self) > 1) &&
+                  (self->mMethod != CTM_METHOD_RAW);
+  if(multiThreaded)
+    _ctmStreamBeginBatch(self);
+
   // Compress to stream
   switch(self->mMethod)
   {
     case CTM_METHOD_RAW:
-      _ctmCompressMesh_RAW(self);
+      ok = _ctmCompressMesh_RAW(self);
       break;
 
     case CTM_METHOD_MG1:
-      _ctmCompressMesh_MG1(self);
+      ok = _ctmCompressMesh_MG1(self);
       break;
 
     case CTM_METHOD_MG2:
-      _ctmCompressMesh_MG2(self);
+      ok = _ctmCompressMesh_MG2(self);
       break;
 
     default:
       self->mError = CTM_INTERNAL_ERROR;
-      return;
+      ok = CTM_FALSE;
   }
+
+  // Compress and write the collected packed arrays
+  if(multiThreaded)
+    _ctmStreamEndBatch(self, ok);
+
+  // Write any buffered data to the stream
+  _ctmStreamFlush(self);
+
+  // In low memory mode, the temporary buffers are not kept
+  if(self->mLowMemory)
+    _ctmFreeTemporaries(self);
 }
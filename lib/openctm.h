@@ -159,6 +159,7 @@ extern "C" {
   // MS Visual Studio does not support C99
   typedef int int32_t;
   typedef unsigned int uint32_t;
+  typedef unsigned __int64 uint64_t;
 #else
   #include <stdint.h>
 #endif
@@ -183,6 +184,10 @@ typedef int32_t CTMint;
 /// Unsigned integer (32 bits wide).
 typedef uint32_t CTMuint;
 
+/// Unsigned integer (64 bits wide), used for element counts of very large
+/// meshes (see ctmDefineMesh64() and ctmGetInteger64()).
+typedef uint64_t CTMuint64;
+
 /// OpenCTM context handle.
 typedef void * CTMcontext;
 
@@ -216,6 +221,12 @@ typedef enum {
   CTM_METHOD_MG1        = 0x0202, ///< Lossless compression (floating point).
   CTM_METHOD_MG2        = 0x0203, ///< Lossless compression (fixed point).
 
+  // Load options (bit flags for ctmLoadOptions(), in a range of their own)
+  CTM_SKIP_NORMALS      = 0x1000, ///< Do not load the normals.
+  CTM_SKIP_UV_MAPS      = 0x2000, ///< Do not load the UV maps.
+  CTM_SKIP_ATTRIBS      = 0x4000, ///< Do not load the vertex attribute maps.
+  CTM_LAZY_LOAD         = 0x8000, ///< Load normals, UV maps and attribute maps on first access.
+
   // Context queries
   CTM_VERTEX_COUNT      = 0x0301, ///< Number of vertices in the mesh (integer).
   CTM_TRIANGLE_COUNT    = 0x0302, ///< Number of triangles in the mesh (integer).
@@ -226,6 +237,13 @@ typedef enum {
   CTM_NORMAL_PRECISION  = 0x0307, ///< Normal precision - for MG2 (float).
   CTM_COMPRESSION_METHOD = 0x0308, ///< Compression method (integer).
   CTM_FILE_COMMENT      = 0x0309, ///< File comment (string).
+  CTM_STREAM_BUFFER_SIZE = 0x030A, ///< Size of the stream I/O buffer, in bytes (integer).
+  CTM_LOAD_OPTIONS      = 0x030B, ///< Load options, see ctmLoadOptions() (integer).
+  CTM_THREAD_COUNT      = 0x030C, ///< Number of threads, see ctmThreadCount() (integer).
+  CTM_COMPRESSION_THREADS = 0x030D, ///< Number of LZMA encoder threads, see ctmCompressionThreads() (integer).
+  CTM_PEAK_MEMORY       = 0x030E, ///< Largest amount of memory allocated by the context so far, in bytes (integer).
+  CTM_MEMORY_USAGE      = 0x030F, ///< Amount of memory currently allocated by the context, in bytes (integer).
+  CTM_MEMORY_LIMIT      = 0x0310, ///< Memory limit of the context, in bytes, see ctmMemoryLimit() (integer).
 
   // UV/attribute map queries
   CTM_NAME              = 0x0501, ///< Unique name (UV/attrib map string).
@@ -236,6 +254,7 @@ typedef enum {
   CTM_INDICES           = 0x0601, ///< Triangle indices (integer array).
   CTM_VERTICES          = 0x0602, ///< Vertex point coordinates (float array).
   CTM_NORMALS           = 0x0603, ///< Per vertex normals (float array).
+  CTM_AABB              = 0x0604, ///< Axis aligned bounding box: min x, y, z, max x, y, z (float array).
   CTM_UV_MAP_1          = 0x0700, ///< Per vertex UV map 1 (float array).
   CTM_UV_MAP_2          = 0x0701, ///< Per vertex UV map 2 (float array).
   CTM_UV_MAP_3          = 0x0702, ///< Per vertex UV map 3 (float array).
@@ -262,6 +281,8 @@ typedef enum {
 /// @return The number of bytes actually read (if this is less than aCount, it
 ///         indicates that an error occured or the end of file was reached
 ///         before all bytes were read).
+/// @note Larger transfers are split into several calls, so \c aCount is
+///       never more than 0x40000000 (1 GB).
 typedef CTMuint (CTMCALL * CTMreadfn)(void * aBuf, CTMuint aCount, void * aUserData);
 
 /// Stream write() function pointer.
@@ -271,8 +292,26 @@ typedef CTMuint (CTMCALL * CTMreadfn)(void * aBuf, CTMuint aCount, void * aUserD
 ///            ctmSaveCustom() function.
 /// @return The number of bytes actually written (if this is less than aCount, it
 ///         indicates that an error occured).
+/// @note Larger transfers are split into several calls, so \c aCount is
+///       never more than 0x40000000 (1 GB).
 typedef CTMuint (CTMCALL * CTMwritefn)(const void * aBuf, CTMuint aCount, void * aUserData);
 
+/// Memory allocation function pointer (see ctmAllocator()).
+/// @param[in] aSize The number of bytes to allocate (never zero).
+/// @param[in] aUserData The custom user data that was passed to the
+///            ctmAllocator() function.
+/// @return A pointer to the allocated memory (aligned for any type, like the
+///         memory returned by malloc()), or NULL if the memory could not be
+///         allocated.
+typedef void * (CTMCALL * CTMallocfn)(size_t aSize, void * aUserData);
+
+/// Memory free function pointer (see ctmAllocator()).
+/// @param[in] aPtr A pointer that was returned by the allocation function
+///            (never NULL).
+/// @param[in] aUserData The custom user data that was passed to the
+///            ctmAllocator() function.
+typedef void (CTMCALL * CTMfreefn)(void * aPtr, void * aUserData);
+
 /// Create a new OpenCTM context. The context is used for all subsequent
 /// OpenCTM function calls. Several contexts can coexist at the same time.
 /// @param[in] aMode An OpenCTM context mode. Set this to CTM_IMPORT if the
@@ -312,8 +351,23 @@ CTMEXPORT const char * CTMCALL ctmErrorString(CTMenum aError);
 /// @return An integer value, representing the OpenCTM context property given
 ///         by \c aProperty.
 /// @see CTMenum
+/// @note Values that do not fit in 32 bits (e.g. the triangle count of a
+///       very large mesh) are clamped to 0xffffffff. Use ctmGetInteger64()
+///       to get the full value.
 CTMEXPORT CTMuint CTMCALL ctmGetInteger(CTMcontext aContext, CTMenum aProperty);
 
+/// Get information about an OpenCTM context, as a 64-bit integer (e.g. the
+/// vertex and triangle counts of meshes that are too large for
+/// ctmGetInteger()).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aProperty Which property to return (any property that can be
+///            queried with ctmGetInteger()).
+/// @return An integer value, representing the OpenCTM context property given
+///         by \c aProperty.
+/// @see CTMenum, ctmGetInteger()
+CTMEXPORT CTMuint64 CTMCALL ctmGetInteger64(CTMcontext aContext, CTMenum aProperty);
+
 /// Get information about an OpenCTM context.
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
@@ -472,6 +526,18 @@ CTMEXPORT void CTMCALL ctmCompressionMethod(CTMcontext aContext,
 CTMEXPORT void CTMCALL ctmCompressionLevel(CTMcontext aContext,
   CTMuint aLevel);
 
+/// Set how many threads the LZMA encoder uses for compressing each packed
+/// array. With two threads, the match finder runs in a separate thread,
+/// which speeds up compression at compression levels 1 to 9 (level 0 always
+/// uses a single thread). The file format is not affected. The default is 1.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aThreads Number of LZMA encoder threads (1 or 2).
+/// @note This is independent of ctmThreadCount(), which controls how many
+///       packed arrays are compressed concurrently.
+CTMEXPORT void CTMCALL ctmCompressionThreads(CTMcontext aContext,
+  CTMuint aThreads);
+
 /// Set the vertex coordinate precision (only used by the MG2 compression
 /// method).
 /// @param[in] aContext An OpenCTM context that has been created by
@@ -545,6 +611,130 @@ CTMEXPORT void CTMCALL ctmAttribPrecision(CTMcontext aContext,
 CTMEXPORT void CTMCALL ctmFileComment(CTMcontext aContext,
   const char * aFileComment);
 
+/// Set the size of the I/O buffer that is used for batching calls to the
+/// stream read/write functions (e.g. the file functions of ctmLoad(), and the
+/// function given to ctmSaveCustom()). The default buffer size is 65536 bytes.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aSize Buffer size in bytes. A value of zero disables buffering,
+///            so that every stream access results in a call to the stream
+///            read/write function.
+/// @note The read function that is given to ctmLoadCustom() is only asked
+///       for the bytes that are needed, so the stream is never read past the
+///       end of the OpenCTM data (the stream may contain other data after
+///       it).
+CTMEXPORT void CTMCALL ctmStreamBufferSize(CTMcontext aContext,
+  CTMuint aSize);
+
+/// Set the number of threads that are used for loading and saving. With more
+/// than one thread, the packed arrays of an MG1/MG2 file are first located in
+/// the stream, and then uncompressed concurrently before the mesh is
+/// restored. When saving, the packed arrays are compressed concurrently, and
+/// the file is identical to a file that is saved with a single thread. This
+/// uses more memory than a single thread, since the packed data (unless
+/// loaded from memory) and all the unpacked arrays are kept in memory at the
+/// same time.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aCount Number of threads (including the calling thread). A
+///            value of zero uses one thread per processor. The default is 1
+///            (everything is done in the calling thread).
+/// @note The worker threads are started when they are first needed, and they
+///       are reused until the context is freed with ctmFreeContext().
+CTMEXPORT void CTMCALL ctmThreadCount(CTMcontext aContext, CTMuint aCount);
+
+/// Set the memory allocator of a context. All the memory that the context
+/// allocates (mesh arrays, maps, stream buffers, packed data and the LZMA
+/// encoder/decoder state) is allocated and freed with the given functions.
+/// The exceptions are the context itself, and the buffer that is returned by
+/// ctmSaveToBuffer() (which is freed by ctmFreeBuffer()).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aAllocFn Pointer to an allocation function, or NULL (together
+///            with aFreeFn) to use the standard malloc()/free() functions
+///            (the default).
+/// @param[in] aFreeFn Pointer to a function that frees memory that was
+///            allocated by aAllocFn.
+/// @param[in] aUserData Custom user data that is passed to the allocator
+///            functions.
+/// @note The allocator can not be changed while the context holds a mesh or
+///       a file comment (i.e. call this function right after
+///       ctmNewContext()).
+/// @note With several threads (see ctmThreadCount() and
+///       ctmCompressionThreads()), the allocator functions are called from
+///       several threads at the same time.
+CTMEXPORT void CTMCALL ctmAllocator(CTMcontext aContext, CTMallocfn aAllocFn,
+  CTMfreefn aFreeFn, void * aUserData);
+
+/// Set the memory limit of a context. The memory that the context allocates
+/// (see ctmAllocator(), CTM_MEMORY_USAGE and CTM_PEAK_MEMORY) is kept within
+/// the limit: an allocation that would exceed it fails (with
+/// CTM_OUT_OF_MEMORY) without calling the allocator. Before loading or
+/// saving a mesh, the memory that the operation needs is estimated. If it
+/// does not fit, a low memory strategy is used (a single thread, one packed
+/// array at a time, a smaller LZMA dictionary, and no temporary buffers are
+/// kept between operations), and if that does not fit either, the operation
+/// fails with CTM_OUT_OF_MEMORY before anything is allocated.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aLimit The memory limit in bytes, or zero for no limit (the
+///            default). The current limit is returned by the
+///            CTM_MEMORY_LIMIT property.
+/// @note The memory of the context structure itself, and the buffer that is
+///       returned by ctmSaveToBuffer(), are not counted.
+/// @note The memory amounts of CTM_MEMORY_USAGE and CTM_PEAK_MEMORY include
+///       some bookkeeping overhead per allocation, and are clamped to
+///       0xffffffff by ctmGetInteger() (see ctmGetInteger64()).
+CTMEXPORT void CTMCALL ctmMemoryLimit(CTMcontext aContext, size_t aLimit);
+
+/// Select which parts of the mesh to load. Skipped arrays are not
+/// uncompressed, and no memory is allocated for them. The mesh properties
+/// (e.g. CTM_HAS_NORMALS, CTM_UV_MAP_COUNT and the map names) still describe
+/// the file, but the array queries for skipped arrays (e.g. CTM_NORMALS)
+/// return NULL. The options are used by all the following load operations.
+///
+/// With CTM_LAZY_LOAD, the normals and the UV/attribute maps are not
+/// uncompressed until they are first requested with ctmGetFloatArray(). This
+/// requires a seekable input stream, i.e. ctmLoad(), ctmLoadFromMemory() or
+/// ctmLoadMapped() (other load functions load everything at once). The input
+/// stream is kept open until all such arrays have been loaded, or the mesh
+/// is cleared (the next load, or ctmFreeContext()). Note that this means that
+/// the memory block given to ctmLoadFromMemory() must stay valid until then.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aOptions A combination of the CTM_SKIP_NORMALS,
+///            CTM_SKIP_UV_MAPS, CTM_SKIP_ATTRIBS and CTM_LAZY_LOAD flags
+///            (zero loads everything, which is the default).
+CTMEXPORT void CTMCALL ctmLoadOptions(CTMcontext aContext, CTMuint aOptions);
+
+/// Set a caller provided destination buffer for a float array that is loaded
+/// (e.g. an interleaved vertex buffer that is ready for GPU upload). The
+/// loaded values are written straight to the buffer, instead of to an array
+/// that is allocated by OpenCTM. The destination is used by all the following
+/// load operations, until it is changed (or removed with a NULL buffer). Use
+/// ctmLoadHeader() to get the vertex count first, if needed.
+///
+/// After loading, ctmGetFloatArray() returns a pointer to the first value in
+/// the buffer (i.e. aBuffer + aOffset), and the values of the array are
+/// aStride bytes apart. The buffer must stay valid until the mesh is cleared
+/// (the next load, or ctmFreeContext()). If the buffer is too small for the
+/// loaded mesh, the load fails with the error CTM_INVALID_ARGUMENT.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aArray Which array to set the destination for (CTM_VERTICES,
+///            CTM_NORMALS, CTM_UV_MAP_1 to CTM_UV_MAP_8 or CTM_ATTRIB_MAP_1
+///            to CTM_ATTRIB_MAP_8).
+/// @param[in] aBuffer Pointer to the buffer, or NULL to let OpenCTM allocate
+///            the array (which is the default).
+/// @param[in] aSize Size of the buffer, in bytes.
+/// @param[in] aStride Distance between the values of two consecutive
+///            vertices in the buffer, in bytes (a multiple of 4). Zero means
+///            that the values are tightly packed.
+/// @param[in] aOffset Offset of the first value in the buffer, in bytes (a
+///            multiple of 4).
+CTMEXPORT void CTMCALL ctmLoadDestination(CTMcontext aContext, CTMenum aArray,
+  void * aBuffer, size_t aSize, CTMuint aStride, CTMuint aOffset);
+
 /// Define a triangle mesh.
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
@@ -564,6 +754,30 @@ CTMEXPORT void CTMCALL ctmDefineMesh(CTMcontext aContext,
   const CTMfloat * aVertices, CTMuint aVertexCount, const CTMuint * aIndices,
   CTMuint aTriangleCount, const CTMfloat * aNormals);
 
+/// Define a triangle mesh with 64-bit element counts. This is the same as
+/// ctmDefineMesh(), but the triangle count may exceed 32 bits (the vertex
+/// count is limited by the 32-bit vertex indices). Meshes with more than
+/// 0xffffffff triangles are saved in format version 7 files, which older
+/// versions of OpenCTM can not read.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aVertices An array of vertices (three consecutive floats make
+///            one vertex).
+/// @param[in] aVertexCount The number of vertices in \c aVertices (at most
+///            0x100000000).
+/// @param[in] aIndices An array of vertex indices (three consecutive integers
+///            make one triangle).
+/// @param[in] aTriangleCount The number of triangles in \c aIndices.
+/// @param[in] aNormals An array of per-vertex normals (or NULL if there are
+///            no normals).
+/// @note The function fails with CTM_INVALID_ARGUMENT if the arrays are too
+///       large to be addressed on this platform.
+/// @see ctmDefineMesh(), ctmGetInteger64().
+CTMEXPORT void CTMCALL ctmDefineMesh64(CTMcontext aContext,
+  const CTMfloat * aVertices, CTMuint64 aVertexCount,
+  const CTMuint * aIndices, CTMuint64 aTriangleCount,
+  const CTMfloat * aNormals);
+
 /// Define a UV map. There can be several UV maps in a mesh. A UV map is
 /// typically used for 2D texture mapping.
 /// @param[in] aContext An OpenCTM context that has been created by
@@ -623,6 +837,60 @@ CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName);
 CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
   void * aUserData);
 
+/// Load an OpenCTM format file from a memory block. The mesh data can be
+/// retrieved with the various ctmGet functions. The data is decoded directly
+/// from the memory block (no copy of the file data is made).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aData Pointer to the OpenCTM file data in memory. The memory
+///            block only needs to stay valid during the call (unless the
+///            CTM_LAZY_LOAD option is used, see ctmLoadOptions()).
+/// @param[in] aSize Size of the memory block, in bytes.
+CTMEXPORT void CTMCALL ctmLoadFromMemory(CTMcontext aContext,
+  const void * aData, size_t aSize);
+
+/// Load an OpenCTM format file by mapping it into memory. This works like
+/// ctmLoad(), but the file data is decoded straight from the mapping instead
+/// of being read through a file stream. For files that use the RAW method,
+/// the mesh arrays (e.g. CTM_VERTICES) may point directly into the mapping
+/// (on little endian hosts), in which case the file stays mapped until the
+/// mesh is cleared (i.e. the next load, or ctmFreeContext()).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aFileName The name of the file to be loaded.
+CTMEXPORT void CTMCALL ctmLoadMapped(CTMcontext aContext,
+  const char * aFileName);
+
+/// Load only the header of an OpenCTM format file. This is much faster than
+/// ctmLoad(), since no mesh data is uncompressed. Afterwards, the mesh
+/// properties (CTM_VERTEX_COUNT, CTM_TRIANGLE_COUNT, CTM_HAS_NORMALS,
+/// CTM_UV_MAP_COUNT, CTM_ATTRIB_MAP_COUNT, CTM_COMPRESSION_METHOD,
+/// CTM_FILE_COMMENT etc), the map names and precisions can be retrieved with
+/// the various ctmGet functions. For MG2 files, the bounding box of the mesh
+/// is also available (CTM_AABB). Note that this is the bounding box that was
+/// stored in the file, and the uncompressed vertices may fall outside of it by
+/// up to the vertex precision.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aFileName The name of the file to be probed.
+/// @note The array queries (e.g. CTM_VERTICES) return NULL after a header
+///       only load.
+CTMEXPORT void CTMCALL ctmLoadHeader(CTMcontext aContext,
+  const char * aFileName);
+
+/// Load only the header of an OpenCTM format file using a custom stream read
+/// function (see ctmLoadHeader() and ctmLoadCustom()). Since the stream can
+/// not be seeked, the compressed mesh data is read and discarded (but not
+/// uncompressed).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aReadFn Pointer to a custom stream read function.
+/// @param[in] aUserData Custom user data, which will be passed to the custom
+///            stream read function.
+/// @see CTMreadfn.
+CTMEXPORT void CTMCALL ctmLoadHeaderCustom(CTMcontext aContext,
+  CTMreadfn aReadFn, void * aUserData);
+
 /// Save an OpenCTM format file. The mesh must have been defined by
 /// ctmDefineMesh().
 /// @param[in] aContext An OpenCTM context that has been created by
@@ -119,6 +119,14 @@ class CTMimporter {
       return res;
     }
 
+    /// Wrapper for ctmGetInteger64()
+    CTMuint64 GetInteger64(CTMenum aProperty)
+    {
+      CTMuint64 res = ctmGetInteger64(mContext, aProperty);
+      CheckError();
+      return res;
+    }
+
     /// Wrapper for ctmGetFloat()
     CTMfloat GetFloat(CTMenum aProperty)
     {
@@ -199,6 +207,49 @@ class CTMimporter {
       return res;
     }
 
+    /// Wrapper for ctmStreamBufferSize()
+    void StreamBufferSize(CTMuint aSize)
+    {
+      ctmStreamBufferSize(mContext, aSize);
+      CheckError();
+    }
+
+    /// Wrapper for ctmThreadCount()
+    void ThreadCount(CTMuint aCount)
+    {
+      ctmThreadCount(mContext, aCount);
+      CheckError();
+    }
+
+    /// Wrapper for ctmAllocator()
+    void Allocator(CTMallocfn aAllocFn, CTMfreefn aFreeFn, void * aUserData)
+    {
+      ctmAllocator(mContext, aAllocFn, aFreeFn, aUserData);
+      CheckError();
+    }
+
+    /// Wrapper for ctmMemoryLimit()
+    void MemoryLimit(size_t aLimit)
+    {
+      ctmMemoryLimit(mContext, aLimit);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadOptions()
+    void LoadOptions(CTMuint aOptions)
+    {
+      ctmLoadOptions(mContext, aOptions);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadDestination()
+    void LoadDestination(CTMenum aArray, void * aBuffer, size_t aSize,
+      CTMuint aStride, CTMuint aOffset)
+    {
+      ctmLoadDestination(mContext, aArray, aBuffer, aSize, aStride, aOffset);
+      CheckError();
+    }
+
     /// Wrapper for ctmLoad()
     void Load(const char * aFileName)
     {
@@ -213,6 +264,34 @@ class CTMimporter {
       CheckError();
     }
 
+    /// Wrapper for ctmLoadFromMemory()
+    void LoadFromMemory(const void * aData, size_t aSize)
+    {
+      ctmLoadFromMemory(mContext, aData, aSize);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadMapped()
+    void LoadMapped(const char * aFileName)
+    {
+      ctmLoadMapped(mContext, aFileName);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadHeader()
+    void LoadHeader(const char * aFileName)
+    {
+      ctmLoadHeader(mContext, aFileName);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadHeaderCustom()
+    void LoadHeaderCustom(CTMreadfn aReadFn, void * aUserData)
+    {
+      ctmLoadHeaderCustom(mContext, aReadFn, aUserData);
+      CheckError();
+    }
+
     // You can not copy nor assign from one CTMimporter object to another, since
     // the object contains hidden state. By declaring these dummy prototypes
     // without an implementation, you will at least get linker errors if you try
@@ -281,6 +360,13 @@ class CTMexporter {
       CheckError();
     }
 
+    /// Wrapper for ctmCompressionThreads()
+    void CompressionThreads(CTMuint aThreads)
+    {
+      ctmCompressionThreads(mContext, aThreads);
+      CheckError();
+    }
+
     /// Wrapper for ctmVertexPrecision()
     void VertexPrecision(CTMfloat aPrecision)
     {
@@ -323,6 +409,34 @@ class CTMexporter {
       CheckError();
     }
 
+    /// Wrapper for ctmStreamBufferSize()
+    void StreamBufferSize(CTMuint aSize)
+    {
+      ctmStreamBufferSize(mContext, aSize);
+      CheckError();
+    }
+
+    /// Wrapper for ctmThreadCount()
+    void ThreadCount(CTMuint aCount)
+    {
+      ctmThreadCount(mContext, aCount);
+      CheckError();
+    }
+
+    /// Wrapper for ctmAllocator()
+    void Allocator(CTMallocfn aAllocFn, CTMfreefn aFreeFn, void * aUserData)
+    {
+      ctmAllocator(mContext, aAllocFn, aFreeFn, aUserData);
+      CheckError();
+    }
+
+    /// Wrapper for ctmMemoryLimit()
+    void MemoryLimit(size_t aLimit)
+    {
+      ctmMemoryLimit(mContext, aLimit);
+      CheckError();
+    }
+
     /// Wrapper for ctmDefineMesh()
     void DefineMesh(const CTMfloat * aVertices, CTMuint aVertexCount, 
       const CTMuint * aIndices, CTMuint aTriangleCount,
@@ -333,6 +447,16 @@ class CTMexporter {
       CheckError();
     }
 
+    /// Wrapper for ctmDefineMesh64()
+    void DefineMesh64(const CTMfloat * aVertices, CTMuint64 aVertexCount,
+      const CTMuint * aIndices, CTMuint64 aTriangleCount,
+      const CTMfloat * aNormals)
+    {
+      ctmDefineMesh64(mContext, aVertices, aVertexCount, aIndices,
+                      aTriangleCount, aNormals);
+      CheckError();
+    }
+
     /// Wrapper for ctmAddUVMap()
     CTMenum AddUVMap(const CTMfloat * aUVCoords, const char * aName,
       const char * aFileName)
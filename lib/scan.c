@@ -0,0 +1,279 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        scan.c
+// Description: Parallel prefix sums, used for restoring delta coded arrays
+//              in the MG1 and MG2 decoders.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include "openctm.h"
+#include "internal.h"
+
+
+// Minimum number of elements per scan job (smaller arrays are scanned by
+// fewer threads, since starting a thread costs more than it gains)
+#define _CTM_SCAN_MIN_JOB 65536
+
+// Maximum number of components per element
+#define _CTM_SCAN_MAX_WIDTH 4
+
+
+//-----------------------------------------------------------------------------
+// _CTMscanjob - One part (a range of elements) of a prefix sum.
+//-----------------------------------------------------------------------------
+typedef struct {
+  CTMuint * mData;                    // Elements
+  const CTMuint * mKeys;              // Segment keys (segmented sums only)
+  size_t mStart;                      // First element of the range
+  size_t mEnd;                        // End of the range (exclusive)
+  CTMuint mWidth;                     // Number of components per element
+  CTMuint mStride;                    // Distance between elements (words)
+  CTMint mHasHead;                    // Does a segment start in the range?
+  CTMuint mSum[_CTM_SCAN_MAX_WIDTH];  // Sum of the range / sum to add
+} _CTMscanjob;
+
+//-----------------------------------------------------------------------------
+// _ctmScanJobs() - Split aCount elements into one range per thread. Returns
+// the number of jobs (zero if the array is too small to gain from threads, or
+// if the jobs could not be allocated). The jobs are allocated from the
+// scratch arena.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmScanJobs(_CTMcontext * self, _CTMscanjob ** aJobs,
+  CTMuint * aData, const CTMuint * aKeys, size_t aCount, CTMuint aWidth,
+  CTMuint aStride)
+{
+  _CTMscanjob * jobs;
+  CTMuint jobCount, j;
+  size_t chunk;
+
+  jobCount = _ctmThreadCount(self);
+  if(aCount / _CTM_SCAN_MIN_JOB < jobCount)
+    jobCount = (CTMuint) (aCount / _CTM_SCAN_MIN_JOB);
+  if(jobCount < 2)
+    return 0;
+  jobs = (_CTMscanjob *) _ctmArenaAlloc(self, sizeof(_CTMscanjob) * jobCount);
+  if(!jobs)
+    return 0;
+
+  chunk = aCount / jobCount;
+  for(j = 0; j < jobCount; ++ j)
+  {
+    jobs[j].mData = aData;
+    jobs[j].mKeys = aKeys;
+    jobs[j].mStart = j * chunk;
+    jobs[j].mEnd = (j == jobCount - 1) ? aCount : (j + 1) * chunk;
+    jobs[j].mWidth = aWidth;
+    jobs[j].mStride = aStride;
+  }
+
+  *aJobs = jobs;
+  return jobCount;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSumJob() - Sum the elements within the range of a job.
+//-----------------------------------------------------------------------------
+static void _ctmSumJob(void * aJob)
+{
+  _CTMscanjob * job = (_CTMscanjob *) aJob;
+  const CTMuint * data = job->mData;
+  size_t i;
+  CTMuint j;
+
+  for(j = 0; j < job->mWidth; ++ j)
+  {
+    job->mSum[j] = 0;
+    for(i = job->mStart; i < job->mEnd; ++ i)
+      job->mSum[j] += data[i * job->mStride + j];
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmScanJob() - Prefix sum of the elements within the range of a job,
+// starting from the sum of all earlier elements (mSum).
+//-----------------------------------------------------------------------------
+static void _ctmScanJob(void * aJob)
+{
+  _CTMscanjob * job = (_CTMscanjob *) aJob;
+  CTMuint * data = job->mData;
+  CTMuint sum;
+  size_t i;
+  CTMuint j;
+
+  for(j = 0; j < job->mWidth; ++ j)
+  {
+    sum = job->mSum[j];
+    for(i = job->mStart; i < job->mEnd; ++ i)
+    {
+      sum += data[i * job->mStride + j];
+      data[i * job->mStride + j] = sum;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPrefixSum() - Replace each element of an array by the sum of itself and
+// all earlier elements (i.e. restore a delta coded array). There are aCount
+// elements of aWidth components each (at most four), stored aStride words
+// apart, and each component is summed separately. Large arrays are split
+// into ranges that are summed by separate threads (first the sum of each
+// range, then the prefix sums of all ranges). The sums wrap around, so
+// signed integers can be summed too.
+//-----------------------------------------------------------------------------
+void _ctmPrefixSum(_CTMcontext * self, CTMuint * aData, size_t aCount,
+  CTMuint aWidth, CTMuint aStride)
+{
+  _CTMscanjob * jobs, job;
+  CTMuint jobCount, j, k, sum[_CTM_SCAN_MAX_WIDTH], tmp;
+  size_t mark;
+
+  mark = _ctmArenaMark(self);
+  jobCount = _ctmScanJobs(self, &jobs, aData, (const CTMuint *) 0, aCount,
+                          aWidth, aStride);
+  if(jobCount == 0)
+  {
+    // Single threaded
+    job.mData = aData;
+    job.mStart = 0;
+    job.mEnd = aCount;
+    job.mWidth = aWidth;
+    job.mStride = aStride;
+    for(k = 0; k < aWidth; ++ k)
+      job.mSum[k] = 0;
+    _ctmScanJob(&job);
+    _ctmArenaRelease(self, mark);
+    return;
+  }
+
+  // Sum the ranges, and turn the sums into the sum of all earlier ranges
+  _ctmRunJobs(self, _ctmSumJob, (void *) jobs, sizeof(_CTMscanjob), jobCount);
+  for(k = 0; k < aWidth; ++ k)
+    sum[k] = 0;
+  for(j = 0; j < jobCount; ++ j)
+  {
+    for(k = 0; k < aWidth; ++ k)
+    {
+      tmp = jobs[j].mSum[k];
+      jobs[j].mSum[k] = sum[k];
+      sum[k] += tmp;
+    }
+  }
+
+  _ctmRunJobs(self, _ctmScanJob, (void *) jobs, sizeof(_CTMscanjob), jobCount);
+  _ctmArenaRelease(self, mark);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSegmentSumJob() - Sum the elements within the range of a job, from the
+// last segment start in the range (if any).
+//-----------------------------------------------------------------------------
+static void _ctmSegmentSumJob(void * aJob)
+{
+  _CTMscanjob * job = (_CTMscanjob *) aJob;
+  const CTMuint * data = job->mData, * keys = job->mKeys;
+  CTMuint stride = job->mStride, sum = 0;
+  size_t i;
+
+  job->mHasHead = CTM_FALSE;
+  for(i = job->mStart; i < job->mEnd; ++ i)
+  {
+    if((i == 0) || (keys[i * stride] != keys[(i - 1) * stride]))
+    {
+      job->mHasHead = CTM_TRUE;
+      sum = keys[i * stride];
+    }
+    sum += data[i * stride];
+  }
+  job->mSum[0] = sum;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSegmentScanJob() - Segmented prefix sum of the elements within the range
+// of a job, starting from the sum of the earlier elements of the segment that
+// the range starts in (mSum).
+//-----------------------------------------------------------------------------
+static void _ctmSegmentScanJob(void * aJob)
+{
+  _CTMscanjob * job = (_CTMscanjob *) aJob;
+  CTMuint * data = job->mData;
+  const CTMuint * keys = job->mKeys;
+  CTMuint stride = job->mStride, sum = job->mSum[0];
+  size_t i;
+
+  for(i = job->mStart; i < job->mEnd; ++ i)
+  {
+    if((i == 0) || (keys[i * stride] != keys[(i - 1) * stride]))
+      sum = keys[i * stride];
+    sum += data[i * stride];
+    data[i * stride] = sum;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSegmentedPrefixSum() - Prefix sum of an array that is split into
+// segments: runs of elements with equal keys. Within a segment, each element
+// is replaced by the sum of itself and the earlier elements of the segment,
+// plus the key of the segment. The aCount elements (and their keys) are
+// stored aStride words apart. Large arrays are summed by several threads, as
+// in _ctmPrefixSum().
+//-----------------------------------------------------------------------------
+void _ctmSegmentedPrefixSum(_CTMcontext * self, CTMuint * aData,
+  const CTMuint * aKeys, size_t aCount, CTMuint aStride)
+{
+  _CTMscanjob * jobs, job;
+  CTMuint jobCount, j, sum, tmp;
+  size_t mark;
+
+  mark = _ctmArenaMark(self);
+  jobCount = _ctmScanJobs(self, &jobs, aData, aKeys, aCount, 1, aStride);
+  if(jobCount == 0)
+  {
+    // Single threaded
+    job.mData = aData;
+    job.mKeys = aKeys;
+    job.mStart = 0;
+    job.mEnd = aCount;
+    job.mStride = aStride;
+    job.mSum[0] = 0;
+    _ctmSegmentScanJob(&job);
+    _ctmArenaRelease(self, mark);
+    return;
+  }
+
+  // Sum the ranges, and find the sum that each range starts from: the sum of
+  // the previous range if a segment starts in it, otherwise the sum that the
+  // previous range starts from plus its sum
+  _ctmRunJobs(self, _ctmSegmentSumJob, (void *) jobs, sizeof(_CTMscanjob),
+              jobCount);
+  sum = 0;
+  for(j = 0; j < jobCount; ++ j)
+  {
+    tmp = jobs[j].mSum[0];
+    jobs[j].mSum[0] = sum;
+    sum = jobs[j].mHasHead ? tmp : sum + tmp;
+  }
+
+  _ctmRunJobs(self, _ctmSegmentScanJob, (void *) jobs, sizeof(_CTMscanjob),
+              jobCount);
+  _ctmArenaRelease(self, mark);
+}
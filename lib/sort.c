@@ -0,0 +1,280 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        sort.c
+// Description: Stable radix sorting of 64-bit keys, used for ordering the
+//              vertices and triangles in the MG1 and MG2 encoders.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include "openctm.h"
+#include "internal.h"
+
+
+// Number of bits per radix digit (one pass over the data per digit)
+#define _CTM_RADIX_BITS 8
+#define _CTM_RADIX_SIZE (1 << _CTM_RADIX_BITS)
+
+// Minimum number of elements per sorting job (smaller arrays are sorted by
+// fewer threads, since starting a thread costs more than it gains)
+#define _CTM_SORT_MIN_JOB 65536
+
+
+//-----------------------------------------------------------------------------
+// _CTMsortjob - One part (a range of elements) of a radix sort.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const CTMuint64 * mKeys;        // Source keys
+  const CTMuint * mValues;        // Source values
+  CTMuint64 * mDstKeys;           // Destination keys
+  CTMuint * mDstValues;           // Destination values
+  size_t mStart;                  // First element of the range
+  size_t mEnd;                    // End of the range (exclusive)
+  CTMuint mShift;                 // Bit position of the current digit
+  CTMuint64 mAnd;                 // Bitwise and of all keys in the range
+  CTMuint64 mOr;                  // Bitwise or of all keys in the range
+  size_t mCount[_CTM_RADIX_SIZE]; // Digit histogram / scatter positions
+} _CTMsortjob;
+
+//-----------------------------------------------------------------------------
+// _ctmSortBitsJob() - Find which key bits differ within the range of a job.
+//-----------------------------------------------------------------------------
+static void _ctmSortBitsJob(void * aJob)
+{
+  _CTMsortjob * job = (_CTMsortjob *) aJob;
+  CTMuint64 keyAnd = ~((CTMuint64) 0), keyOr = 0;
+  size_t i;
+
+  for(i = job->mStart; i < job->mEnd; ++ i)
+  {
+    keyAnd &= job->mKeys[i];
+    keyOr |= job->mKeys[i];
+  }
+  job->mAnd = keyAnd;
+  job->mOr = keyOr;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSortCountJob() - Count the digits of the keys within the range of a job.
+//-----------------------------------------------------------------------------
+static void _ctmSortCountJob(void * aJob)
+{
+  _CTMsortjob * job = (_CTMsortjob *) aJob;
+  const CTMuint64 * keys = job->mKeys;
+  CTMuint shift = job->mShift;
+  size_t i;
+
+  memset(job->mCount, 0, sizeof(job->mCount));
+  for(i = job->mStart; i < job->mEnd; ++ i)
+    ++ job->mCount[(keys[i] >> shift) & (_CTM_RADIX_SIZE - 1)];
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSortScatterJob() - Move the elements within the range of a job to their
+// positions in the destination arrays (mCount holds the position of the next
+// element for each digit).
+//-----------------------------------------------------------------------------
+static void _ctmSortScatterJob(void * aJob)
+{
+  _CTMsortjob * job = (_CTMsortjob *) aJob;
+  const CTMuint64 * keys = job->mKeys;
+  const CTMuint * values = job->mValues;
+  CTMuint64 * dstKeys = job->mDstKeys;
+  CTMuint * dstValues = job->mDstValues;
+  CTMuint shift = job->mShift;
+  size_t i, pos;
+
+  for(i = job->mStart; i < job->mEnd; ++ i)
+  {
+    pos = job->mCount[(keys[i] >> shift) & (_CTM_RADIX_SIZE - 1)] ++;
+    dstKeys[pos] = keys[i];
+    dstValues[pos] = values[i];
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRadixSort() - Sort aCount keys in ascending order, and move the values
+// along with the keys. The sort is stable (equal keys keep their order), and
+// is spread over several threads for large arrays. Digits that are the same
+// for all keys are skipped. The temporary arrays are allocated from the
+// scratch arena. Returns false (without touching the arrays) if they could
+// not be allocated.
+//-----------------------------------------------------------------------------
+int _ctmRadixSort(_CTMcontext * self, CTMuint64 * aKeys, CTMuint * aValues,
+  size_t aCount)
+{
+  _CTMsortjob * jobs;
+  CTMuint64 * tmpKeys, * keys, * dstKeys, * swapKeys, keyAnd, keyOr, diff;
+  CTMuint * tmpValues, * values, * dstValues, * swapValues;
+  CTMuint jobCount, j, shift;
+  size_t mark, chunk, sum, count, b;
+
+  if(aCount < 2)
+    return CTM_TRUE;
+
+  // Split the array into one range per thread
+  jobCount = _ctmThreadCount(self);
+  if(aCount / _CTM_SORT_MIN_JOB < jobCount)
+    jobCount = (CTMuint) (aCount / _CTM_SORT_MIN_JOB);
+  if(jobCount < 1)
+    jobCount = 1;
+
+  // Allocate the jobs and the temporary arrays
+  mark = _ctmArenaMark(self);
+  jobs = (_CTMsortjob *) _ctmArenaAlloc(self, sizeof(_CTMsortjob) * jobCount);
+  tmpKeys = (CTMuint64 *) _ctmArenaAlloc(self, sizeof(CTMuint64) * aCount);
+  tmpValues = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * aCount);
+  if(!jobs || !tmpKeys || !tmpValues)
+  {
+    _ctmArenaRelease(self, mark);
+    return CTM_FALSE;
+  }
+  chunk = aCount / jobCount;
+  for(j = 0; j < jobCount; ++ j)
+  {
+    jobs[j].mKeys = aKeys;
+    jobs[j].mStart = j * chunk;
+    jobs[j].mEnd = (j == jobCount - 1) ? aCount : (j + 1) * chunk;
+  }
+
+  // Find the key bits that differ (digits without such bits need no pass)
+  _ctmRunJobs(self, _ctmSortBitsJob, (void *) jobs, sizeof(_CTMsortjob),
+              jobCount);
+  keyAnd = ~((CTMuint64) 0);
+  keyOr = 0;
+  for(j = 0; j < jobCount; ++ j)
+  {
+    keyAnd &= jobs[j].mAnd;
+    keyOr |= jobs[j].mOr;
+  }
+  diff = keyAnd ^ keyOr;
+
+  // One counting sort pass per digit, from the least significant digit
+  keys = aKeys;
+  values = aValues;
+  dstKeys = tmpKeys;
+  dstValues = tmpValues;
+  for(shift = 0; shift < 64; shift += _CTM_RADIX_BITS)
+  {
+    if(!((diff >> shift) & (_CTM_RADIX_SIZE - 1)))
+      continue;
+
+    for(j = 0; j < jobCount; ++ j)
+    {
+      jobs[j].mKeys = keys;
+      jobs[j].mValues = values;
+      jobs[j].mDstKeys = dstKeys;
+      jobs[j].mDstValues = dstValues;
+      jobs[j].mShift = shift;
+    }
+    _ctmRunJobs(self, _ctmSortCountJob, (void *) jobs, sizeof(_CTMsortjob),
+                jobCount);
+
+    // Turn the counts into positions (for a given digit, the elements of
+    // earlier ranges go first, which keeps the sort stable)
+    sum = 0;
+    for(b = 0; b < _CTM_RADIX_SIZE; ++ b)
+    {
+      for(j = 0; j < jobCount; ++ j)
+      {
+        count = jobs[j].mCount[b];
+        jobs[j].mCount[b] = sum;
+        sum += count;
+      }
+    }
+
+    _ctmRunJobs(self, _ctmSortScatterJob, (void *) jobs, sizeof(_CTMsortjob),
+                jobCount);
+
+    // The destination is the source of the next pass
+    swapKeys = keys;
+    keys = dstKeys;
+    dstKeys = swapKeys;
+    swapValues = values;
+    values = dstValues;
+    dstValues = swapValues;
+  }
+
+  // Make sure that the result ends up in the caller's arrays
+  if(keys != aKeys)
+  {
+    memcpy(aKeys, keys, sizeof(CTMuint64) * aCount);
+    memcpy(aValues, values, sizeof(CTMuint) * aCount);
+  }
+
+  _ctmArenaRelease(self, mark);
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSortTriangles() - Sort aTriangleCount triangles (three indices each) by
+// their first index, and secondly by their second index. Triangles with equal
+// first and second indices keep their order. Returns false (without touching
+// the triangles) if the temporary arrays could not be allocated, or if there
+// are too many triangles to number them with CTMuint values.
+//-----------------------------------------------------------------------------
+int _ctmSortTriangles(_CTMcontext * self, CTMuint * aIndices,
+  size_t aTriangleCount)
+{
+  CTMuint64 * keys;
+  CTMuint * order;
+  size_t mark, i;
+
+  if((CTMuint64) aTriangleCount > 0xffffffff)
+    return CTM_FALSE;
+
+  mark = _ctmArenaMark(self);
+  keys = (CTMuint64 *) _ctmArenaAlloc(self, sizeof(CTMuint64) * aTriangleCount);
+  order = (CTMuint *) _ctmArenaAlloc(self, sizeof(CTMuint) * aTriangleCount);
+  if(!keys || !order)
+  {
+    _ctmArenaRelease(self, mark);
+    return CTM_FALSE;
+  }
+
+  // Sort the first two indices of each triangle (as one key), along with the
+  // triangle number
+  for(i = 0; i < aTriangleCount; ++ i)
+  {
+    keys[i] = (((CTMuint64) aIndices[i * 3]) << 32) | aIndices[i * 3 + 1];
+    order[i] = (CTMuint) i;
+  }
+  if(!_ctmRadixSort(self, keys, order, aTriangleCount))
+  {
+    _ctmArenaRelease(self, mark);
+    return CTM_FALSE;
+  }
+
+  // Gather the third indices (in place), and rebuild the triangles
+  for(i = 0; i < aTriangleCount; ++ i)
+    order[i] = aIndices[(size_t) order[i] * 3 + 2];
+  for(i = 0; i < aTriangleCount; ++ i)
+  {
+    aIndices[i * 3] = (CTMuint) (keys[i] >> 32);
+    aIndices[i * 3 + 1] = (CTMuint) keys[i];
+    aIndices[i * 3 + 2] = order[i];
+  }
+
+  _ctmArenaRelease(self, mark);
+  return CTM_TRUE;
+}
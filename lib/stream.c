@@ -27,7 +27,8 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <LzmaLib.h>
+#include <LzmaDec.h>
+#include <LzmaEnc.h>
 #include "openctm.h"
 #include "internal.h"
 
@@ -35,26 +36,441 @@
 #include <stdio.h>
 #endif
 
+// Size of the pieces in which packed data is fed to the LZMA decoder
+#define _CTM_STREAM_CHUNK_SIZE 16384
+
+// Size of the output buffer for packing aSize bytes of data with LZMA (room
+// for incompressible data, which LZMA expands by up to a third, according to
+// the LZMA SDK documentation)
+#define _CTM_PACKED_SIZE(aSize) ((aSize) + (aSize) / 3 + 1000)
+
+// Smallest LZMA dictionary size (in bytes)
+#define _CTM_LZMA_MIN_DICT_SIZE 0x00001000
+
+// Memory used by an LZMA encoder (see _ctmStreamEncoderMemory()): the encoder
+// state and the smallest hash tables, twelve bytes per dictionary byte for
+// the match finder (binary tree, hash table and input window), and the
+// buffers of the multi-threaded match finder
+#define _CTM_LZMA_ENC_MEMORY    0x00180000
+#define _CTM_LZMA_DICT_MEMORY   12
+#define _CTM_LZMA_MT_MEMORY     0x00480000
+
+// Memory used by an LZMA decoder (the probability tables)
+#define _CTM_LZMA_DEC_MEMORY    0x00004000
+
+
+//-----------------------------------------------------------------------------
+// Memory allocator for the LZMA encoder/decoder (the allocator of a context,
+// see _ctmLzmaAllocInit()).
+//-----------------------------------------------------------------------------
+typedef struct {
+  ISzAlloc mFuncs;        // LZMA allocator interface (must be first)
+  _CTMcontext * mContext; // Context that owns the memory
+} _CTMlzmaalloc;
+
+static void * _ctmLzmaAllocFn(void * p, size_t aSize)
+{
+  return aSize ? _ctmAlloc(((_CTMlzmaalloc *) p)->mContext, aSize) :
+                 (void *) 0;
+}
+
+static void _ctmLzmaFreeFn(void * p, void * aAddress)
+{
+  _ctmFree(((_CTMlzmaalloc *) p)->mContext, aAddress);
+}
+
+static ISzAlloc * _ctmLzmaAllocInit(_CTMlzmaalloc * aAlloc,
+  _CTMcontext * aContext)
+{
+  aAlloc->mFuncs.Alloc = _ctmLzmaAllocFn;
+  aAlloc->mFuncs.Free = _ctmLzmaFreeFn;
+  aAlloc->mContext = aContext;
+  return &aAlloc->mFuncs;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmIsLittleEndian() - Check if the host stores words in little endian byte
+// order (the byte order used in OpenCTM files).
+//-----------------------------------------------------------------------------
+static int _ctmIsLittleEndian(void)
+{
+  union {
+    CTMuint i;
+    unsigned char c[4];
+  } u;
+  u.i = 1;
+  return u.c[0] == 1;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamInit() - Prepare the stream buffer for a new load or save
+// operation (the read/write function and user data must be set up first).
+//-----------------------------------------------------------------------------
+void _ctmStreamInit(_CTMcontext * self)
+{
+  unsigned char * buf;
+
+  self->mStreamData = (const unsigned char *) 0;
+  self->mStreamBase = 0;
+  self->mStreamBufPos = 0;
+  self->mStreamBufLen = 0;
+
+  // (Re)allocate the buffer if the requested size has changed. If we can not
+  // get a buffer, we simply fall back to unbuffered I/O.
+  if(self->mStreamBufCapacity != self->mStreamBufferSize)
+  {
+    if(self->mStreamBuf)
+      _ctmFree(self, self->mStreamBuf);
+    self->mStreamBuf = (unsigned char *) 0;
+    self->mStreamBufCapacity = 0;
+    if(self->mStreamBufferSize > 0)
+    {
+      buf = (unsigned char *) _ctmAlloc(self, self->mStreamBufferSize);
+      if(buf)
+      {
+        self->mStreamBuf = buf;
+        self->mStreamBufCapacity = self->mStreamBufferSize;
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamInitMemory() - Set up a memory block as the input stream. The
+// memory block is used as the stream buffer, and there is no read function to
+// refill it. Call with a null pointer to detach the memory block.
+//-----------------------------------------------------------------------------
+void _ctmStreamInitMemory(_CTMcontext * self, const void * aData,
+  size_t aSize)
+{
+  self->mReadFn = (CTMreadfn) 0;
+  self->mSeekFn = (_CTMseekfn) 0;
+  self->mUserData = (void *) 0;
+  self->mStreamData = (const unsigned char *) aData;
+  self->mStreamBase = 0;
+  self->mStreamBufPos = 0;
+  self->mStreamBufLen = aData ? aSize : 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamFlush() - Write any buffered data to the stream.
+//-----------------------------------------------------------------------------
+void _ctmStreamFlush(_CTMcontext * self)
+{
+  if(self->mStreamBufPos > 0)
+  {
+    if(self->mUserData && self->mWriteFn)
+      self->mWriteFn(self->mStreamBuf, (CTMuint) self->mStreamBufPos,
+                     self->mUserData);
+    self->mStreamBufPos = 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamFill() - Refill the stream buffer if it is empty. aNeeded is the
+// number of bytes that the caller is going to read: without read-ahead (see
+// mStreamReadAhead), no more than that is read into the buffer. Returns the
+// number of unread bytes in the buffer.
+//-----------------------------------------------------------------------------
+static size_t _ctmStreamFill(_CTMcontext * self, size_t aNeeded)
+{
+  CTMuint count;
+
+  if((self->mStreamBufPos >= self->mStreamBufLen) &&
+     self->mUserData && self->mReadFn && (self->mStreamBufCapacity > 0))
+  {
+    count = self->mStreamBufCapacity;
+    if(!self->mStreamReadAhead && (aNeeded < count))
+      count = (CTMuint) aNeeded;
+    self->mStreamData = self->mStreamBuf;
+    self->mStreamBase += self->mStreamBufLen;
+    self->mStreamBufLen = self->mReadFn(self->mStreamBuf, count,
+                                        self->mUserData);
+    self->mStreamBufPos = 0;
+  }
+
+  return self->mStreamBufLen - self->mStreamBufPos;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadDirect() - Read aCount bytes straight from the read function
+// of a stream (bypassing the stream buffer), in pieces of at most
+// _CTM_STREAM_MAX_TRANSFER bytes (so that the byte count fits in a CTMuint).
+//-----------------------------------------------------------------------------
+static size_t _ctmStreamReadDirect(_CTMcontext * self, unsigned char * aBuf,
+  size_t aCount)
+{
+  size_t done, count, got;
+
+  for(done = 0; done < aCount; done += got)
+  {
+    count = aCount - done;
+    if(count > _CTM_STREAM_MAX_TRANSFER)
+      count = _CTM_STREAM_MAX_TRANSFER;
+    got = (size_t) self->mReadFn(&aBuf[done], (CTMuint) count,
+                                 self->mUserData);
+    if(got != count)
+      return done + got;
+  }
+  return done;
+}
+
 //-----------------------------------------------------------------------------
 // _ctmStreamRead() - Read data from a stream.
 //-----------------------------------------------------------------------------
-CTMuint _ctmStreamRead(_CTMcontext * self, void * aBuf, CTMuint aCount)
+size_t _ctmStreamRead(_CTMcontext * self, void * aBuf, size_t aCount)
 {
-  if(!self->mUserData || !self->mReadFn)
-    return 0;
+  unsigned char * dst = (unsigned char *) aBuf;
+  size_t count, done;
+
+  // Use what is left in the buffer (or memory block)
+  count = self->mStreamBufLen - self->mStreamBufPos;
+  if(count > aCount)
+    count = aCount;
+  if(count > 0)
+  {
+    memcpy(dst, &self->mStreamData[self->mStreamBufPos], count);
+    self->mStreamBufPos += count;
+  }
+  done = count;
+  if((done == aCount) || !self->mUserData || !self->mReadFn)
+    return done;
+
+  // Large reads go directly to the destination
+  if((aCount - done) >= self->mStreamBufCapacity)
+  {
+    count = _ctmStreamReadDirect(self, &dst[done], aCount - done);
+    self->mStreamBase += count;
+    return done + count;
+  }
+
+  // Refill the buffer
+  count = _ctmStreamFill(self, aCount - done);
+  if(count > aCount - done)
+    count = aCount - done;
+  memcpy(&dst[done], self->mStreamData, count);
+  self->mStreamBufPos = count;
+
+  return done + count;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamBatchWrite() - Append data to the batch data buffer (see
+// _ctmStreamBeginBatch()).
+//-----------------------------------------------------------------------------
+static int _ctmStreamBatchWrite(_CTMcontext * self, const void * aBuf,
+  size_t aCount)
+{
+  unsigned char * data;
+  size_t capacity;
+
+  // Grow the buffer, if necessary
+  if(aCount > ((size_t) -1) / 2 - self->mBatchDataSize)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  if((self->mBatchDataSize + aCount) > self->mBatchDataCapacity)
+  {
+    capacity = self->mBatchDataCapacity ? self->mBatchDataCapacity : 4096;
+    while(capacity < (self->mBatchDataSize + aCount))
+      capacity *= 2;
+    data = (unsigned char *) _ctmRealloc(self, self->mBatchData,
+                                         self->mBatchDataSize, capacity);
+    if(!data)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    self->mBatchData = data;
+    self->mBatchDataCapacity = capacity;
+  }
+
+  memcpy(&self->mBatchData[self->mBatchDataSize], aBuf, aCount);
+  self->mBatchDataSize += aCount;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteDirect() - Write aCount bytes straight to the write function
+// of a stream (bypassing the stream buffer), in pieces of at most
+// _CTM_STREAM_MAX_TRANSFER bytes (so that the byte count fits in a CTMuint).
+//-----------------------------------------------------------------------------
+static size_t _ctmStreamWriteDirect(_CTMcontext * self,
+  const unsigned char * aBuf, size_t aCount)
+{
+  size_t done, count, put;
 
-  return self->mReadFn(aBuf, aCount, self->mUserData);
+  for(done = 0; done < aCount; done += put)
+  {
+    count = aCount - done;
+    if(count > _CTM_STREAM_MAX_TRANSFER)
+      count = _CTM_STREAM_MAX_TRANSFER;
+    put = (size_t) self->mWriteFn(&aBuf[done], (CTMuint) count,
+                                  self->mUserData);
+    if(put != count)
+      return done + put;
+  }
+  return done;
 }
 
 //-----------------------------------------------------------------------------
 // _ctmStreamWrite() - Write data to a stream.
 //-----------------------------------------------------------------------------
-CTMuint _ctmStreamWrite(_CTMcontext * self, void * aBuf, CTMuint aCount)
+size_t _ctmStreamWrite(_CTMcontext * self, void * aBuf, size_t aCount)
 {
   if(!self->mUserData || !self->mWriteFn)
     return 0;
 
-  return self->mWriteFn(aBuf, aCount, self->mUserData);
+  // Keep the data until the current batch is ended?
+  if(self->mBatchActive)
+    return _ctmStreamBatchWrite(self, aBuf, aCount) ? aCount : 0;
+
+  // Make room in the buffer
+  if(aCount > self->mStreamBufCapacity - self->mStreamBufPos)
+    _ctmStreamFlush(self);
+
+  // Large writes go directly to the stream
+  if(aCount >= self->mStreamBufCapacity)
+    return _ctmStreamWriteDirect(self, (const unsigned char *) aBuf, aCount);
+
+  memcpy(&self->mStreamBuf[self->mStreamBufPos], aBuf, aCount);
+  self->mStreamBufPos += aCount;
+
+  return aCount;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamSkip() - Skip aCount bytes of an input stream. If the stream is
+// seekable, we seek past the data, otherwise it is read and discarded.
+//-----------------------------------------------------------------------------
+int _ctmStreamSkip(_CTMcontext * self, size_t aCount)
+{
+  unsigned char buf[1024];
+  size_t count;
+
+  // Skip what is left in the buffer (or memory block)
+  count = self->mStreamBufLen - self->mStreamBufPos;
+  if(count > aCount)
+    count = aCount;
+  self->mStreamBufPos += count;
+  aCount -= count;
+
+  if(aCount > 0)
+  {
+    if(!self->mUserData || !self->mReadFn)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+
+    // Seek past the data (the buffer is empty at this point)
+    if(self->mSeekFn)
+    {
+      self->mStreamBase += self->mStreamBufLen + aCount;
+      self->mStreamBufPos = self->mStreamBufLen = 0;
+      if(!self->mSeekFn(self->mStreamBase, self->mUserData))
+      {
+        self->mError = CTM_BAD_FORMAT;
+        return CTM_FALSE;
+      }
+      return CTM_TRUE;
+    }
+
+    // Read and discard the data
+    while(aCount > 0)
+    {
+      count = aCount < sizeof(buf) ? aCount : sizeof(buf);
+      if(_ctmStreamRead(self, (void *) buf, count) != count)
+      {
+        self->mError = CTM_BAD_FORMAT;
+        return CTM_FALSE;
+      }
+      aCount -= count;
+    }
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamSkipPacked() - Skip a packed (LZMA compressed) array in an input
+// stream, without uncompressing it.
+//-----------------------------------------------------------------------------
+int _ctmStreamSkipPacked(_CTMcontext * self)
+{
+  size_t packedSize;
+  CTMuint blockCount, i;
+
+  // Number of LZMA blocks (format version 6)
+  blockCount = 1;
+  if(self->mFormatVersion >= _CTM_FORMAT_VERSION)
+  {
+    blockCount = _ctmStreamReadUINT(self);
+    if(blockCount < 1)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+  }
+
+  // Packed data size + LZMA compression props + packed data
+  for(i = 0; i < blockCount; ++ i)
+  {
+    packedSize = (size_t) _ctmStreamReadUINT(self);
+    if(!_ctmStreamSkip(self, packedSize + 5))
+      return CTM_FALSE;
+  }
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamTell() - Get the current position of an input stream.
+//-----------------------------------------------------------------------------
+size_t _ctmStreamTell(_CTMcontext * self)
+{
+  return self->mStreamBase + self->mStreamBufPos;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamIsSeekable() - Check if we can seek in the input stream (i.e. it
+// is a memory block, or it has a seek function).
+//-----------------------------------------------------------------------------
+int _ctmStreamIsSeekable(_CTMcontext * self)
+{
+  if(!self->mReadFn)
+    return self->mStreamData ? CTM_TRUE : CTM_FALSE;
+  return (self->mSeekFn && self->mUserData) ? CTM_TRUE : CTM_FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamSeek() - Move to an absolute position in a seekable input stream
+// (see _ctmStreamIsSeekable()).
+//-----------------------------------------------------------------------------
+int _ctmStreamSeek(_CTMcontext * self, size_t aOffset)
+{
+  // Memory block?
+  if(!self->mReadFn)
+  {
+    if(!self->mStreamData || (aOffset > self->mStreamBufLen))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    self->mStreamBufPos = aOffset;
+    return CTM_TRUE;
+  }
+
+  // Seek in the stream (this empties the buffer)
+  self->mStreamBase = aOffset;
+  self->mStreamBufPos = self->mStreamBufLen = 0;
+  if(!self->mSeekFn || !self->mUserData ||
+     !self->mSeekFn(aOffset, self->mUserData))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -85,6 +501,27 @@ void _ctmStreamWriteUINT(_CTMcontext * self, CTMuint aValue)
   _ctmStreamWrite(self, (void *) buf, 4);
 }
 
+//-----------------------------------------------------------------------------
+// _ctmStreamReadUINT64() - Read a 64-bit unsigned integer from a stream
+// (stored as two unsigned integers, the least significant one first).
+//-----------------------------------------------------------------------------
+CTMuint64 _ctmStreamReadUINT64(_CTMcontext * self)
+{
+  CTMuint64 lo;
+  lo = (CTMuint64) _ctmStreamReadUINT(self);
+  return lo | (((CTMuint64) _ctmStreamReadUINT(self)) << 32);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteUINT64() - Write a 64-bit unsigned integer to a stream
+// (stored as two unsigned integers, the least significant one first).
+//-----------------------------------------------------------------------------
+void _ctmStreamWriteUINT64(_CTMcontext * self, CTMuint64 aValue)
+{
+  _ctmStreamWriteUINT(self, (CTMuint) (aValue & 0xffffffff));
+  _ctmStreamWriteUINT(self, (CTMuint) (aValue >> 32));
+}
+
 //-----------------------------------------------------------------------------
 // _ctmStreamReadFLOAT() - Read a floating point value from a stream in a
 // machine endian independent manner (for portability).
@@ -113,6 +550,170 @@ void _ctmStreamWriteFLOAT(_CTMcontext * self, CTMfloat aValue)
   _ctmStreamWriteUINT(self, u.i);
 }
 
+//-----------------------------------------------------------------------------
+// _ctmStreamReadUINTArray() - Read an array of unsigned integers from a
+// stream (stored in little endian byte order).
+//-----------------------------------------------------------------------------
+void _ctmStreamReadUINTArray(_CTMcontext * self, CTMuint * aData,
+  size_t aCount)
+{
+  size_t i;
+  unsigned char * p;
+
+  // Read the raw bytes straight into the destination array
+  _ctmStreamRead(self, (void *) aData, aCount * 4);
+
+  // Convert to native byte order?
+  if(!_ctmIsLittleEndian())
+  {
+    p = (unsigned char *) aData;
+    for(i = 0; i < aCount; ++ i, p += 4)
+      aData[i] = ((CTMuint) p[0]) |
+                 (((CTMuint) p[1]) << 8) |
+                 (((CTMuint) p[2]) << 16) |
+                 (((CTMuint) p[3]) << 24);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteUINTArray() - Write an array of unsigned integers to a
+// stream (stored in little endian byte order).
+//-----------------------------------------------------------------------------
+void _ctmStreamWriteUINTArray(_CTMcontext * self, const CTMuint * aData,
+  size_t aCount)
+{
+  size_t i, count, k;
+  CTMuint x;
+  unsigned char buf[1024];
+
+  // Little endian hosts can write the array as is
+  if(_ctmIsLittleEndian())
+  {
+    _ctmStreamWrite(self, (void *) aData, aCount * 4);
+    return;
+  }
+
+  // Otherwise, convert to little endian in small pieces
+  for(i = 0; i < aCount; i += count)
+  {
+    count = aCount - i;
+    if(count > (sizeof(buf) / 4))
+      count = sizeof(buf) / 4;
+    for(k = 0; k < count; ++ k)
+    {
+      x = aData[i + k];
+      buf[k * 4] = x & 0x000000ff;
+      buf[k * 4 + 1] = (x >> 8) & 0x000000ff;
+      buf[k * 4 + 2] = (x >> 16) & 0x000000ff;
+      buf[k * 4 + 3] = (x >> 24) & 0x000000ff;
+    }
+    _ctmStreamWrite(self, (void *) buf, count * 4);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadFLOATArray() - Read an array of floating point values from a
+// stream (stored in little endian byte order).
+//-----------------------------------------------------------------------------
+void _ctmStreamReadFLOATArray(_CTMcontext * self, CTMfloat * aData,
+  size_t aCount)
+{
+  _ctmStreamReadUINTArray(self, (CTMuint *) aData, aCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadFLOATRows() - Read aRows rows of aWidth floating point values
+// from a stream, and store the rows aStride values apart in aData (e.g. in an
+// interleaved vertex buffer).
+//-----------------------------------------------------------------------------
+void _ctmStreamReadFLOATRows(_CTMcontext * self, CTMfloat * aData,
+  size_t aRows, CTMuint aWidth, CTMuint aStride)
+{
+  size_t i;
+
+  // Tightly packed rows can be read in one go
+  if(aStride == aWidth)
+  {
+    _ctmStreamReadFLOATArray(self, aData, aRows * aWidth);
+    return;
+  }
+
+  for(i = 0; i < aRows; ++ i)
+    _ctmStreamReadUINTArray(self, (CTMuint *) &aData[i * aStride], aWidth);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteFLOATArray() - Write an array of floating point values to a
+// stream (stored in little endian byte order).
+//-----------------------------------------------------------------------------
+void _ctmStreamWriteFLOATArray(_CTMcontext * self, const CTMfloat * aData,
+  size_t aCount)
+{
+  _ctmStreamWriteUINTArray(self, (const CTMuint *) aData, aCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamMapArray() - Try to reference aCount words of the stream in place
+// (instead of copying them). This is only possible when reading from a memory
+// mapped file on a little endian host, and when the data is suitably aligned.
+//-----------------------------------------------------------------------------
+static void * _ctmStreamMapArray(_CTMcontext * self, size_t aCount)
+{
+  const unsigned char * p;
+  size_t size;
+
+  if(!self->mFileMap ||
+     (self->mStreamData != (const unsigned char *) self->mFileMap) ||
+     !_ctmIsLittleEndian())
+    return (void *) 0;
+
+  size = aCount * 4;
+  p = &self->mStreamData[self->mStreamBufPos];
+  if(((self->mStreamBufLen - self->mStreamBufPos) < size) ||
+     (((size_t) p) % sizeof(CTMuint)))
+    return (void *) 0;
+
+  self->mStreamBufPos += size;
+  self->mFileMapInUse = CTM_TRUE;
+  return (void *) p;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadMappedUINTArray() - Read an array of unsigned integers from a
+// stream. If possible, the array is referenced directly in the memory mapped
+// file, in which case the array that *aData points to is freed, and *aData is
+// changed to point into the mapping.
+//-----------------------------------------------------------------------------
+void _ctmStreamReadMappedUINTArray(_CTMcontext * self, CTMuint ** aData,
+  size_t aCount)
+{
+  void * p = _ctmStreamMapArray(self, aCount);
+  if(p)
+  {
+    _ctmFree(self, *aData);
+    *aData = (CTMuint *) p;
+  }
+  else
+    _ctmStreamReadUINTArray(self, *aData, aCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadMappedFLOATArray() - Read an array of floating point values
+// from a stream (see _ctmStreamReadMappedUINTArray()).
+//-----------------------------------------------------------------------------
+void _ctmStreamReadMappedFLOATArray(_CTMcontext * self, CTMfloat ** aData,
+  size_t aCount)
+{
+  void * p = _ctmStreamMapArray(self, aCount);
+  if(p)
+  {
+    _ctmFree(self, *aData);
+    *aData = (CTMfloat *) p;
+  }
+  else
+    _ctmStreamReadFLOATArray(self, *aData, aCount);
+}
+
 //-----------------------------------------------------------------------------
 // _ctmStreamReadSTRING() - Read a string value from a stream. The format of
 // the string in the stream is: an unsigned integer (string length) followed by
@@ -125,7 +726,7 @@ void _ctmStreamReadSTRING(_CTMcontext * self, char ** aValue)
   // Clear the old string
   if(*aValue)
   {
-    free(*aValue);
+    _ctmFree(self, *aValue);
     *aValue = (char *) 0;
   }
 
@@ -135,7 +736,7 @@ void _ctmStreamReadSTRING(_CTMcontext * self, char ** aValue)
   // Read string
   if(len > 0)
   {
-    *aValue = (char *) malloc(len + 1);
+    *aValue = (char *) _ctmAlloc(self, len + 1);
     if(*aValue)
     {
       _ctmStreamRead(self, (void *) *aValue, len);
@@ -168,345 +769,1085 @@ void _ctmStreamWriteSTRING(_CTMcontext * self, const char * aValue)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamReadPackedInts() - Read an compressed binary integer data array
-// from a stream, and uncompress it.
+// _ctmStreamGetScratch() - Get the per-context scratch buffer, making sure
+// that it can hold at least aSize bytes. The buffer is reused between the
+// arrays of a load, and is freed at the end of the load.
 //-----------------------------------------------------------------------------
-int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
-  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+static unsigned char * _ctmStreamGetScratch(_CTMcontext * self, size_t aSize)
 {
-  size_t packedSize, unpackedSize;
-  CTMuint i, k, x;
-  CTMint value;
-  unsigned char * packed, * tmp;
-  unsigned char props[5];
-  int lzmaRes;
-
-  // Read packed data size from the stream
-  packedSize = (size_t) _ctmStreamReadUINT(self);
-
-  // Read LZMA compression props from the stream
-  _ctmStreamRead(self, (void *) props, 5);
-
-  // Allocate memory and read the packed data from the stream
-  packed = (unsigned char *) malloc(packedSize);
-  if(!packed)
+  if(aSize > self->mScratchSize)
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    // The old contents are not needed, so free before allocating (this keeps
+    // the peak memory usage down)
+    if(self->mScratch)
+      _ctmFree(self, self->mScratch);
+    self->mScratch = (unsigned char *) _ctmAlloc(self, aSize);
+    if(!self->mScratch)
+    {
+      self->mScratchSize = 0;
+      self->mError = CTM_OUT_OF_MEMORY;
+      return (unsigned char *) 0;
+    }
+    self->mScratchSize = aSize;
   }
-  _ctmStreamRead(self, (void *) packed, packedSize);
+  return self->mScratch;
+}
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
+//-----------------------------------------------------------------------------
+// _ctmStreamGetDecoder() - Get the LZMA decoder of a context. The decoder
+// (i.e. its probability tables) is reused for all the packed arrays that are
+// read with the context.
+//-----------------------------------------------------------------------------
+static CLzmaDec * _ctmStreamGetDecoder(_CTMcontext * self)
+{
+  if(!self->mLzmaDec)
   {
-    free(packed);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    self->mLzmaDec = _ctmAlloc(self, sizeof(CLzmaDec));
+    if(!self->mLzmaDec)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return (CLzmaDec *) 0;
+    }
+    LzmaDec_Construct((CLzmaDec *) self->mLzmaDec);
   }
+  return (CLzmaDec *) self->mLzmaDec;
+}
 
-  // Uncompress
-  unpackedSize = aCount * aSize * 4;
-  lzmaRes = LzmaUncompress(tmp, &unpackedSize, packed,
-                           &packedSize, props, 5);
+//-----------------------------------------------------------------------------
+// _ctmStreamGetEncoder() - Get the LZMA encoder of a context. The encoder
+// (i.e. its match finder and probability tables) is reused for all the
+// packed arrays that are written with the context, until the context is
+// freed (see _ctmStreamFreeLZMA()).
+//-----------------------------------------------------------------------------
+static CLzmaEncHandle _ctmStreamGetEncoder(_CTMcontext * self)
+{
+  _CTMlzmaalloc alloc;
+
+  if(!self->mLzmaEnc)
+  {
+    self->mLzmaEnc = LzmaEnc_Create(_ctmLzmaAllocInit(&alloc, self));
+    if(!self->mLzmaEnc)
+      self->mError = CTM_OUT_OF_MEMORY;
+  }
+  return (CLzmaEncHandle) self->mLzmaEnc;
+}
 
-  // Free the packed array
-  free(packed);
+//-----------------------------------------------------------------------------
+// _ctmStreamFreeLZMA() - Free the LZMA encoder/decoder of a context.
+//-----------------------------------------------------------------------------
+void _ctmStreamFreeLZMA(_CTMcontext * self)
+{
+  _CTMlzmaalloc alloc;
 
-  // Error?
-  if((lzmaRes != SZ_OK) || (unpackedSize != aCount * aSize * 4))
+  _ctmLzmaAllocInit(&alloc, self);
+  if(self->mLzmaEnc)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(tmp);
-    return CTM_FALSE;
+    LzmaEnc_Destroy((CLzmaEncHandle) self->mLzmaEnc, &alloc.mFuncs,
+                    &alloc.mFuncs);
+    self->mLzmaEnc = (void *) 0;
+  }
+  if(self->mLzmaDec)
+  {
+    // Note: the dictionary is owned by the caller of the decoder, so only the
+    // probability tables are freed
+    LzmaDec_FreeProbs((CLzmaDec *) self->mLzmaDec, &alloc.mFuncs);
+    _ctmFree(self, self->mLzmaDec);
+    self->mLzmaDec = (void *) 0;
   }
+}
 
-  // Convert interleaved array to integers
-  for(i = 0; i < aCount; ++ i)
+//-----------------------------------------------------------------------------
+// _ctmStreamReadLZMA() - Read an LZMA compressed data block from a stream,
+// and uncompress it into aDest. The packed data is fed to the decoder in
+// small pieces as it is read from the stream, so it never has to be stored
+// in memory as a whole.
+//-----------------------------------------------------------------------------
+static int _ctmStreamReadLZMA(_CTMcontext * self, unsigned char * aDest,
+  size_t aDestSize)
+{
+  size_t packedSize, chunkSize, inSize;
+  unsigned char props[5], chunk[_CTM_STREAM_CHUNK_SIZE];
+  const unsigned char * in;
+  CLzmaDec * dec;
+  _CTMlzmaalloc alloc;
+  ELzmaStatus status;
+  SRes lzmaRes;
+
+  // Read packed data size from the stream
+  packedSize = (size_t) _ctmStreamReadUINT(self);
+
+  // Read LZMA compression props from the stream
+  _ctmStreamRead(self, (void *) props, 5);
+
+  // Initialize the decoder (the probability tables are only reallocated if
+  // the props call for a different size), and let it use the destination
+  // array as its dictionary (i.e. uncompress straight into aDest)
+  dec = _ctmStreamGetDecoder(self);
+  if(!dec)
+    return CTM_FALSE;
+  lzmaRes = LzmaDec_AllocateProbs(dec, props, 5,
+                                  _ctmLzmaAllocInit(&alloc, self));
+  if(lzmaRes != SZ_OK)
   {
-    for(k = 0; k < aSize; ++ k)
+    self->mError = (lzmaRes == SZ_ERROR_MEM) ? CTM_OUT_OF_MEMORY : CTM_LZMA_ERROR;
+    return CTM_FALSE;
+  }
+  dec->dic = aDest;
+  dec->dicBufSize = aDestSize;
+  LzmaDec_Init(dec);
+
+  // Feed the packed data through the decoder, one piece at a time. The
+  // decoder reads straight from the stream buffer (or from the caller's memory
+  // block) when possible. Note: we always consume the entire packed block, so
+  // that the stream is positioned at the next item when we are done.
+  while(packedSize > 0)
+  {
+    chunkSize = _ctmStreamFill(self, packedSize);
+    if(chunkSize > 0)
+    {
+      if(chunkSize > packedSize)
+        chunkSize = packedSize;
+      in = &self->mStreamData[self->mStreamBufPos];
+      self->mStreamBufPos += chunkSize;
+    }
+    else
     {
-      value = (CTMint) tmp[i + k * aCount + 3 * aCount * aSize] |
-              (((CTMint) tmp[i + k * aCount + 2 * aCount * aSize]) << 8) |
-              (((CTMint) tmp[i + k * aCount + aCount * aSize]) << 16) |
-              (((CTMint) tmp[i + k * aCount]) << 24);
-      // Convert signed magnitude to two's complement?
-      if(aSignedInts)
+      // Unbuffered stream (or end of stream)
+      chunkSize = packedSize < sizeof(chunk) ? packedSize : sizeof(chunk);
+      if(_ctmStreamRead(self, (void *) chunk, chunkSize) != chunkSize)
       {
-        x = (CTMuint) value;
-        value = (x & 1) ? -(CTMint)((x + 1) >> 1) : (CTMint)(x >> 1);
+        lzmaRes = SZ_ERROR_INPUT_EOF;
+        break;
       }
-      aData[i * aSize + k] = value;
+      in = chunk;
+    }
+    packedSize -= chunkSize;
+    if((lzmaRes == SZ_OK) && (dec->dicPos < aDestSize))
+    {
+      inSize = chunkSize;
+      lzmaRes = LzmaDec_DecodeToDic(dec, aDestSize, in, &inSize,
+                                    LZMA_FINISH_ANY, &status);
     }
   }
+  dec->dic = (Byte *) 0;
 
-  // Free the interleaved array
-  free(tmp);
+  // Error?
+  if((lzmaRes != SZ_OK) || (dec->dicPos != aDestSize))
+  {
+    self->mError = CTM_LZMA_ERROR;
+    return CTM_FALSE;
+  }
 
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamWritePackedInts() - Compress a binary integer data array, and
-// write it to a stream.
+// _ctmBlockSize() - Get the size of the LZMA blocks of a packed array of
+// aSize (uncompressed) bytes that is split into aBlockCount blocks. All the
+// blocks but the last one have this size.
 //-----------------------------------------------------------------------------
-int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData,
-  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+static size_t _ctmBlockSize(size_t aSize, CTMuint aBlockCount)
 {
-  int lzmaRes, lzmaAlgo;
-  CTMuint i, k;
-  CTMint value;
-  size_t bufSize, outPropsSize;
-  unsigned char * packed, outProps[5], *tmp;
-#ifdef __DEBUG_
-  CTMuint negCount = 0;  
-#endif
+  return (aSize + aBlockCount - 1) / aBlockCount;
+}
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
+//-----------------------------------------------------------------------------
+// _ctmStreamPackedBlockCount() - Get the number of LZMA blocks that a packed
+// array of aSize (uncompressed) bytes is split into when it is written (in
+// format version 6 files).
+//-----------------------------------------------------------------------------
+CTMuint _ctmStreamPackedBlockCount(size_t aSize)
+{
+  if(aSize <= _CTM_PACKED_BLOCK_SIZE)
+    return 1;
+  return (CTMuint) ((aSize + _CTM_PACKED_BLOCK_SIZE - 1) / _CTM_PACKED_BLOCK_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadBlockCount() - Read the number of LZMA blocks of a packed
+// array of aSize (uncompressed) bytes. Format version 5 files have no block
+// count (there is always a single block). Returns zero on error.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmStreamReadBlockCount(_CTMcontext * self, size_t aSize)
+{
+  CTMuint blockCount;
+
+  if(self->mFormatVersion < _CTM_FORMAT_VERSION)
+    return 1;
+
+  // Every block must hold at least one byte
+  blockCount = _ctmStreamReadUINT(self);
+  if((blockCount < 1) ||
+     ((blockCount > 1) &&
+      (((size_t) (blockCount - 1) * _ctmBlockSize(aSize, blockCount)) >= aSize)))
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    self->mError = CTM_BAD_FORMAT;
+    return 0;
   }
 
-  // Convert integers to an interleaved array
-  for(i = 0; i < aCount; ++ i)
+  return blockCount;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamNewBatchArray() - Add a new (cleared) packed array entry to the
+// current batch.
+//-----------------------------------------------------------------------------
+static _CTMpackedarray * _ctmStreamNewBatchArray(_CTMcontext * self)
+{
+  _CTMpackedarray * array, * arrays;
+  CTMuint capacity;
+
+  if(self->mBatchArrayCount >= self->mBatchArrayCapacity)
   {
-    for(k = 0; k < aSize; ++ k)
+    capacity = self->mBatchArrayCapacity ? self->mBatchArrayCapacity * 2 : 16;
+    arrays = (_CTMpackedarray *) _ctmRealloc(self, self->mBatchArrays,
+      self->mBatchArrayCount * sizeof(_CTMpackedarray),
+      capacity * sizeof(_CTMpackedarray));
+    if(!arrays)
     {
-      value = aData[i * aSize + k];
-      // Convert two's complement to signed magnitude?
-      if(aSignedInts)
-        value = value < 0 ? -1 - (value << 1) : value << 1;
-#ifdef __DEBUG_
-      else if(value < 0)
-        ++ negCount;
-#endif
-      tmp[i + k * aCount + 3 * aCount * aSize] = value & 0x000000ff;
-      tmp[i + k * aCount + 2 * aCount * aSize] = (value >> 8) & 0x000000ff;
-      tmp[i + k * aCount + aCount * aSize] = (value >> 16) & 0x000000ff;
-      tmp[i + k * aCount] = (value >> 24) & 0x000000ff;
+      self->mError = CTM_OUT_OF_MEMORY;
+      return (_CTMpackedarray *) 0;
     }
+    self->mBatchArrays = arrays;
+    self->mBatchArrayCapacity = capacity;
   }
+  array = &self->mBatchArrays[self->mBatchArrayCount ++];
+  memset(array, 0, sizeof(_CTMpackedarray));
+  array->mContext = (void *) self;
+  return array;
+}
 
-  // Allocate memory for the packed data
-  bufSize = 1000 + aCount * aSize * 4;
-  packed = (unsigned char *) malloc(bufSize);
-  if(!packed)
+//-----------------------------------------------------------------------------
+// _ctmStreamNewBatchBlock() - Add a new (cleared) LZMA block entry to the
+// current batch. The block belongs to the last array of the batch.
+//-----------------------------------------------------------------------------
+static _CTMpackedblock * _ctmStreamNewBatchBlock(_CTMcontext * self)
+{
+  _CTMpackedblock * block, * blocks;
+  CTMuint capacity;
+
+  if(self->mBatchBlockCount >= self->mBatchBlockCapacity)
   {
-    free(tmp);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    capacity = self->mBatchBlockCapacity ? self->mBatchBlockCapacity * 2 : 16;
+    blocks = (_CTMpackedblock *) _ctmRealloc(self, self->mBatchBlocks,
+      self->mBatchBlockCount * sizeof(_CTMpackedblock),
+      capacity * sizeof(_CTMpackedblock));
+    if(!blocks)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return (_CTMpackedblock *) 0;
+    }
+    self->mBatchBlocks = blocks;
+    self->mBatchBlockCapacity = capacity;
   }
+  block = &self->mBatchBlocks[self->mBatchBlockCount ++];
+  memset(block, 0, sizeof(_CTMpackedblock));
+  block->mArrayIndex = self->mBatchArrayCount - 1;
+  return block;
+}
 
-  // Call LZMA to compress
-  outPropsSize = 5;
-  lzmaAlgo = (self->mCompressionLevel < 1 ? 0 : 1);
-  lzmaRes = LzmaCompress(packed,
-                         &bufSize,
-                         (const unsigned char *) tmp,
-                         aCount * aSize * 4,
-                         outProps,
-                         &outPropsSize,
-                         self->mCompressionLevel, // Level (0-9)
-                         0, -1, -1, -1, -1, -1,   // Default values (set by level)
-                         lzmaAlgo                 // Algorithm (0 = fast, 1 = normal)
-                        );
-
-  // Free temporary array
-  free(tmp);
+//-----------------------------------------------------------------------------
+// _ctmStreamLocatePacked() - Locate a packed (LZMA compressed) array of aSize
+// (uncompressed) bytes in an input stream, and add it to the current batch
+// without uncompressing it. For memory streams the packed data is used in
+// place, otherwise it is read into a buffer of its own. The caller fills out
+// the destination fields of the returned array.
+//-----------------------------------------------------------------------------
+static _CTMpackedarray * _ctmStreamLocatePacked(_CTMcontext * self,
+  size_t aSize)
+{
+  _CTMpackedarray * array;
+  _CTMpackedblock * block;
+  size_t blockSize;
+  CTMuint blockCount, i;
+
+  // Read the number of blocks
+  blockCount = _ctmStreamReadBlockCount(self, aSize);
+  if(!blockCount)
+    return (_CTMpackedarray *) 0;
+  blockSize = _ctmBlockSize(aSize, blockCount);
+
+  array = _ctmStreamNewBatchArray(self);
+  if(!array)
+    return (_CTMpackedarray *) 0;
+  array->mBlockCount = blockCount;
+
+  // Several blocks are uncompressed into a shared interleaved array
+  if(blockCount > 1)
+  {
+    array->mInterleaved = (unsigned char *) _ctmAlloc(self, aSize);
+    if(!array->mInterleaved)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return (_CTMpackedarray *) 0;
+    }
+  }
 
-  // Error?
-  if(lzmaRes != SZ_OK)
+  for(i = 0; i < blockCount; ++ i)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(packed);
-    return CTM_FALSE;
+    block = _ctmStreamNewBatchBlock(self);
+    if(!block)
+      return (_CTMpackedarray *) 0;
+    block->mStart = i * blockSize;
+    block->mSize = (i < blockCount - 1) ? blockSize : aSize - block->mStart;
+
+    // Read packed data size and LZMA compression props from the stream
+    block->mPackedSize = (size_t) _ctmStreamReadUINT(self);
+    if(_ctmStreamRead(self, (void *) block->mProps, 5) != 5)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return (_CTMpackedarray *) 0;
+    }
+
+    // Memory block? Then we can use the packed data where it is.
+    if(!self->mReadFn)
+    {
+      if(block->mPackedSize > (self->mStreamBufLen - self->mStreamBufPos))
+      {
+        self->mError = CTM_BAD_FORMAT;
+        return (_CTMpackedarray *) 0;
+      }
+      block->mPacked = &self->mStreamData[self->mStreamBufPos];
+      self->mStreamBufPos += block->mPackedSize;
+    }
+    else
+    {
+      block->mBuffer = (unsigned char *) _ctmAlloc(self, block->mPackedSize ?
+                                                block->mPackedSize : 1);
+      if(!block->mBuffer)
+      {
+        self->mError = CTM_OUT_OF_MEMORY;
+        return (_CTMpackedarray *) 0;
+      }
+      if(_ctmStreamRead(self, (void *) block->mBuffer, block->mPackedSize) !=
+         block->mPackedSize)
+      {
+        self->mError = CTM_BAD_FORMAT;
+        return (_CTMpackedarray *) 0;
+      }
+      block->mPacked = block->mBuffer;
+    }
   }
 
-#ifdef __DEBUG_
-  printf("%d->%d bytes (%d negative words)\n", aCount * aSize * 4, (int) bufSize, negCount);
-#endif
+  return array;
+}
 
-  // Write packed data size to the stream
-  _ctmStreamWriteUINT(self, (CTMuint) bufSize);
+//-----------------------------------------------------------------------------
+// _ctmDeinterleaveArray() - Convert the interleaved array aData back to the
+// destination array of a packed array.
+//-----------------------------------------------------------------------------
+static void _ctmDeinterleaveArray(_CTMpackedarray * aArray,
+  const unsigned char * aData)
+{
+  if(aArray->mWidth)
+    _ctmDeinterleaveWordsStrided(aData, aArray->mData, aArray->mCount,
+                                 aArray->mSize, aArray->mWidth,
+                                 aArray->mStride);
+  else
+    _ctmDeinterleaveWords(aData, aArray->mData, aArray->mCount, aArray->mSize,
+                          aArray->mSignedInts);
+}
 
-  // Write LZMA compression props to the stream
-  _ctmStreamWrite(self, (void *) outProps, 5);
+//-----------------------------------------------------------------------------
+// _ctmStreamUnpackJob() - Uncompress one LZMA block of a batch (this is
+// called from the worker threads of _ctmRunJobs(), so it must not touch the
+// context, except for allocating memory). A block that makes up a whole
+// array is uncompressed into the job buffer of the block, and converted to
+// the destination array right away, otherwise the block is uncompressed into
+// the shared interleaved array.
+//-----------------------------------------------------------------------------
+static void _ctmStreamUnpackJob(void * aJob)
+{
+  _CTMpackedblock * block = (_CTMpackedblock *) aJob;
+  _CTMcontext * context = (_CTMcontext *) block->mArray->mContext;
+  _CTMlzmaalloc alloc;
+  size_t destSize, packedSize;
+  unsigned char * tmp;
+  ELzmaStatus status;
+  SRes lzmaRes;
+
+  // Get memory for the interleaved data
+  if(block->mArray->mInterleaved)
+    tmp = &block->mArray->mInterleaved[block->mStart];
+  else
+    tmp = block->mJobBuffer;
+
+  // Uncompress the block
+  destSize = block->mSize;
+  packedSize = block->mPackedSize;
+  lzmaRes = LzmaDecode(tmp, &destSize, block->mPacked, &packedSize,
+                       block->mProps, 5, LZMA_FINISH_ANY, &status,
+                       _ctmLzmaAllocInit(&alloc, context));
+  if((lzmaRes != SZ_OK) || (destSize != block->mSize))
+    block->mError = (lzmaRes == SZ_ERROR_MEM) ? CTM_OUT_OF_MEMORY :
+                                                CTM_LZMA_ERROR;
+
+  // Convert the interleaved array to integers/floats
+  if(!block->mArray->mInterleaved && (block->mError == CTM_NONE))
+    _ctmDeinterleaveArray(block->mArray, tmp);
+}
 
-  // Write the packed data to the stream
-  _ctmStreamWrite(self, (void *) packed, (CTMuint) bufSize);
+//-----------------------------------------------------------------------------
+// _ctmStreamDeinterleaveJob() - Convert the shared interleaved array of a
+// packed array that was split into several blocks (see
+// _ctmStreamUnpackJob()).
+//-----------------------------------------------------------------------------
+static void _ctmStreamDeinterleaveJob(void * aJob)
+{
+  _CTMpackedarray * array = (_CTMpackedarray *) aJob;
 
-  // Free the packed data
-  free(packed);
+  if(array->mInterleaved)
+    _ctmDeinterleaveArray(array, array->mInterleaved);
+}
 
-  return CTM_TRUE;
+//-----------------------------------------------------------------------------
+// _ctmLzmaDictSize() - Get the LZMA dictionary size for compressing aSize
+// bytes at compression level aLevel. This is the default size for the level
+// (up to 64 MB), but no larger than the data requires (rounded up to a power
+// of two, so that the match finder memory can be reused for arrays of
+// similar sizes), and no larger than aMaxDictSize (if it is non-zero).
+//-----------------------------------------------------------------------------
+static UInt32 _ctmLzmaDictSize(size_t aSize, CTMuint aLevel,
+  size_t aMaxDictSize)
+{
+  CLzmaEncProps props;
+  UInt32 dictSize, maxDictSize;
+
+  LzmaEncProps_Init(&props);
+  props.level = (int) aLevel;
+  maxDictSize = LzmaEncProps_GetDictSize(&props);
+  if(aMaxDictSize && (aMaxDictSize < maxDictSize))
+    maxDictSize = (UInt32) aMaxDictSize;
+  dictSize = _CTM_LZMA_MIN_DICT_SIZE;
+  while((dictSize < aSize) && (dictSize < maxDictSize))
+    dictSize <<= 1;
+
+  return (dictSize < maxDictSize) ? dictSize : maxDictSize;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamReadPackedFloats() - Read an compressed binary float data array
-// from a stream, and uncompress it.
+// _ctmStreamEncoderMemory() - Estimate the amount of memory that an LZMA
+// encoder with aThreads threads uses for compressing aSize bytes (at the
+// compression level of a context).
 //-----------------------------------------------------------------------------
-int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData,
-  CTMuint aCount, CTMuint aSize)
+size_t _ctmStreamEncoderMemory(_CTMcontext * self, size_t aSize,
+  CTMuint aThreads)
 {
-  CTMuint i, k;
-  size_t packedSize, unpackedSize;
-  union {
-    CTMfloat f;
-    CTMint i;
-  } value;
-  unsigned char * packed, * tmp;
-  unsigned char props[5];
-  int lzmaRes;
+  size_t size;
 
-  // Read packed data size from the stream
-  packedSize = (size_t) _ctmStreamReadUINT(self);
+  size = _CTM_LZMA_ENC_MEMORY + _CTM_LZMA_DICT_MEMORY *
+         (size_t) _ctmLzmaDictSize(aSize, self->mCompressionLevel, 0);
+  if(aThreads > 1)
+    size += _CTM_LZMA_MT_MEMORY;
 
-  // Read LZMA compression props from the stream
-  _ctmStreamRead(self, (void *) props, 5);
+  return size;
+}
 
-  // Allocate memory and read the packed data from the stream
-  packed = (unsigned char *) malloc(packedSize);
-  if(!packed)
-  {
+//-----------------------------------------------------------------------------
+// _ctmStreamDecoderMemory() - Estimate the amount of memory that an LZMA
+// decoder uses (the dictionary is the destination array, so this is only the
+// probability tables).
+//-----------------------------------------------------------------------------
+size_t _ctmStreamDecoderMemory(void)
+{
+  return _CTM_LZMA_DEC_MEMORY;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamMaxDictSize() - Get the largest LZMA dictionary size that fits in
+// the memory that is left within the memory limit of a context (used in low
+// memory mode, when the encoder has not yet allocated its match finder).
+//-----------------------------------------------------------------------------
+static size_t _ctmStreamMaxDictSize(_CTMcontext * self)
+{
+  size_t available, dictSize;
+
+  available = _ctmMemoryAvailable(self);
+  if(available <= _CTM_LZMA_ENC_MEMORY)
+    return _CTM_LZMA_MIN_DICT_SIZE;
+  available = (available - _CTM_LZMA_ENC_MEMORY) / _CTM_LZMA_DICT_MEMORY;
+  dictSize = _CTM_LZMA_MIN_DICT_SIZE;
+  while((dictSize << 1) <= available)
+    dictSize <<= 1;
+
+  return dictSize;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCompressLZMA() - Compress aSize bytes of aData into the buffer aPacked
+// (which must hold _CTM_PACKED_SIZE(aSize) bytes) with aThreads LZMA encoder
+// threads and a dictionary of at most aMaxDictSize bytes (0 = the default
+// size for the level), and store the size of the packed data in *aPackedSize
+// and the LZMA compression props in aProps. The encoder aEncoder is reset
+// and reused, or if it is NULL, a temporary encoder is used. All memory is
+// allocated with the allocator of aContext (the context is not touched
+// otherwise). Returns CTM_NONE on success, or an error code.
+//-----------------------------------------------------------------------------
+static CTMenum _ctmCompressLZMA(_CTMcontext * aContext,
+  CLzmaEncHandle aEncoder, const unsigned char * aData, size_t aSize,
+  CTMuint aLevel, CTMuint aThreads, size_t aMaxDictSize,
+  unsigned char * aPacked, size_t * aPackedSize, unsigned char * aProps)
+{
+  CLzmaEncProps props;
+  CLzmaEncHandle enc;
+  _CTMlzmaalloc alloc;
+  SRes lzmaRes;
+  size_t bufSize, outPropsSize;
+
+  // Select the encoder settings
+  LzmaEncProps_Init(&props);
+  props.level = (int) aLevel;                // Level (0-9)
+  props.algo = (aLevel < 1 ? 0 : 1);         // Algorithm (0 = fast, 1 = normal)
+  props.numThreads = (int) aThreads;         // Threads (1 or 2)
+  props.dictSize = _ctmLzmaDictSize(aSize, aLevel, aMaxDictSize);
+
+  // Call LZMA to compress
+  _ctmLzmaAllocInit(&alloc, aContext);
+  enc = aEncoder ? aEncoder : LzmaEnc_Create(&alloc.mFuncs);
+  if(!enc)
+    return CTM_OUT_OF_MEMORY;
+  bufSize = _CTM_PACKED_SIZE(aSize);
+  outPropsSize = 5;
+  lzmaRes = LzmaEnc_SetProps(enc, &props);
+  if(lzmaRes == SZ_OK)
+    lzmaRes = LzmaEnc_WriteProperties(enc, aProps, &outPropsSize);
+  if(lzmaRes == SZ_OK)
+    lzmaRes = LzmaEnc_MemEncode(enc, aPacked, &bufSize, aData, aSize, 0,
+                                NULL, &alloc.mFuncs, &alloc.mFuncs);
+  if(!aEncoder)
+    LzmaEnc_Destroy(enc, &alloc.mFuncs, &alloc.mFuncs);
+
+  // Error?
+  if(lzmaRes != SZ_OK)
+    return (lzmaRes == SZ_ERROR_MEM) ? CTM_OUT_OF_MEMORY : CTM_LZMA_ERROR;
+
+#ifdef __DEBUG_
+  printf("%d->%d bytes\n", (int) aSize, (int) bufSize);
+#endif
+
+  *aPackedSize = bufSize;
+  return CTM_NONE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWritePacked() - Write a packed data block (packed size, LZMA
+// compression props and packed data) to a stream.
+//-----------------------------------------------------------------------------
+static void _ctmStreamWritePacked(_CTMcontext * self,
+  const unsigned char * aPacked, size_t aPackedSize,
+  const unsigned char * aProps)
+{
+  _ctmStreamWriteUINT(self, (CTMuint) aPackedSize);
+  _ctmStreamWrite(self, (void *) aProps, 5);
+  _ctmStreamWrite(self, (void *) aPacked, aPackedSize);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamNewInterleaved() - Allocate memory for an interleaved array of
+// aSize bytes that is to be written with _ctmStreamWriteLZMA(). If a batch
+// is being collected, the array is handed over to the batch (it is kept
+// until the batch is ended), otherwise it is allocated from the scratch
+// arena.
+//-----------------------------------------------------------------------------
+static unsigned char * _ctmStreamNewInterleaved(_CTMcontext * self,
+  size_t aSize)
+{
+  unsigned char * data;
+
+  if(self->mBatchActive)
+    data = (unsigned char *) _ctmAlloc(self, aSize);
+  else
+    data = (unsigned char *) _ctmArenaAlloc(self, aSize);
+  if(!data)
     self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+  return data;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteLZMA() - Compress an interleaved array (aCount elements of
+// aSize words, allocated with _ctmStreamNewInterleaved()), and write it to a
+// stream. If a batch is being collected, the array is owned by the batch and
+// compressed when the batch is ended. Otherwise it is compressed right away
+// (the memory for the packed data is allocated from the scratch arena, and
+// the caller releases it). In format version 6 files, large arrays are split
+// into several LZMA blocks.
+//-----------------------------------------------------------------------------
+static int _ctmStreamWriteLZMA(_CTMcontext * self, unsigned char * aData,
+  size_t aCount, CTMuint aSize)
+{
+  _CTMpackedarray * array;
+  _CTMpackedblock * block;
+  CLzmaEncHandle encoder;
+  unsigned char * packed, props[5];
+  size_t size, blockSize, start, packedSize, maxDictSize;
+  CTMuint blockCount, lzmaThreads, i;
+  CTMenum err;
+
+  // Split the array into blocks?
+  size = aCount * aSize * 4;
+  blockCount = 1;
+  if(self->mFormatVersion >= _CTM_FORMAT_VERSION)
+    blockCount = _ctmStreamPackedBlockCount(size);
+  blockSize = _ctmBlockSize(size, blockCount);
+
+  // Compress later?
+  if(self->mBatchActive)
+  {
+    array = _ctmStreamNewBatchArray(self);
+    if(!array)
+    {
+      _ctmFree(self, aData);
+      return CTM_FALSE;
+    }
+    array->mInterleaved = aData;
+    array->mCount = aCount;
+    array->mSize = aSize;
+    array->mBlockCount = blockCount;
+    array->mLevel = self->mCompressionLevel;
+    array->mLzmaThreads = self->mCompressionThreads;
+    array->mOffset = self->mBatchDataSize;
+    for(i = 0; i < blockCount; ++ i)
+    {
+      block = _ctmStreamNewBatchBlock(self);
+      if(!block)
+        return CTM_FALSE;
+      block->mStart = i * blockSize;
+      block->mSize = (i < blockCount - 1) ? blockSize : size - block->mStart;
+    }
+    return CTM_TRUE;
   }
-  _ctmStreamRead(self, (void *) packed, packedSize);
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
+  // Write the number of blocks
+  if(self->mFormatVersion >= _CTM_FORMAT_VERSION)
+    _ctmStreamWriteUINT(self, blockCount);
+
+  // Compress the blocks with the encoder of the context, and write them to
+  // the stream (all blocks use the same buffer for the packed data)
+  encoder = _ctmStreamGetEncoder(self);
+  if(!encoder)
+    return CTM_FALSE;
+  packed = (unsigned char *) _ctmArenaAlloc(self, _CTM_PACKED_SIZE(blockSize));
+  if(!packed)
   {
-    free(packed);
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
 
-  // Uncompress
-  unpackedSize = aCount * aSize * 4;
-  lzmaRes = LzmaUncompress(tmp, &unpackedSize, packed,
-                           &packedSize, props, 5);
-
-  // Free the packed array
-  free(packed);
-
-  // Error?
-  if((lzmaRes != SZ_OK) || (unpackedSize != aCount * aSize * 4))
+  // In low memory mode, the dictionary is limited to what fits in the memory
+  // that is left, and a single encoder thread is used
+  lzmaThreads = self->mCompressionThreads;
+  maxDictSize = 0;
+  if(self->mLowMemory)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(tmp);
-    return CTM_FALSE;
+    lzmaThreads = 1;
+    maxDictSize = _ctmStreamMaxDictSize(self);
   }
 
-  // Convert interleaved array to floats
-  for(i = 0; i < aCount; ++ i)
+  for(i = 0; i < blockCount; ++ i)
   {
-    for(k = 0; k < aSize; ++ k)
+    start = i * blockSize;
+    err = _ctmCompressLZMA(self, encoder, &aData[start],
+                           (i < blockCount - 1) ? blockSize : size - start,
+                           self->mCompressionLevel, lzmaThreads, maxDictSize,
+                           packed, &packedSize, props);
+    if(err != CTM_NONE)
     {
-      value.i = (CTMint) tmp[i + k * aCount + 3 * aCount * aSize] |
-                (((CTMint) tmp[i + k * aCount + 2 * aCount * aSize]) << 8) |
-                (((CTMint) tmp[i + k * aCount + aCount * aSize]) << 16) |
-                (((CTMint) tmp[i + k * aCount]) << 24);
-      aData[i * aSize + k] = value.f;
+      self->mError = err;
+      return CTM_FALSE;
     }
+    _ctmStreamWritePacked(self, packed, packedSize, props);
   }
 
-  // Free the interleaved array
-  free(tmp);
+  // In low memory mode, the encoder is not kept for the next array (the
+  // dictionary size may have to be smaller then)
+  if(self->mLowMemory)
+    _ctmStreamFreeLZMA(self);
 
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamWritePackedFloats() - Compress a binary float data array, and
-// write it to a stream.
+// _ctmStreamPackJob() - Compress one LZMA block of a batch into the job
+// buffer of the block (this is called from the worker threads of
+// _ctmRunJobs(), so it must not touch the context, except for allocating
+// memory).
 //-----------------------------------------------------------------------------
-int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData,
-  CTMuint aCount, CTMuint aSize)
+static void _ctmStreamPackJob(void * aJob)
 {
-  int lzmaRes, lzmaAlgo;
-  CTMuint i, k;
-  union {
-    CTMfloat f;
-    CTMint i;
-  } value;
-  size_t bufSize, outPropsSize;
-  unsigned char * packed, outProps[5], *tmp;
+  _CTMpackedblock * block = (_CTMpackedblock *) aJob;
+  _CTMcontext * context = (_CTMcontext *) block->mArray->mContext;
+
+  block->mError = _ctmCompressLZMA(context, (CLzmaEncHandle) 0,
+                                   &block->mArray->mInterleaved[block->mStart],
+                                   block->mSize, block->mArray->mLevel,
+                                   block->mArray->mLzmaThreads, 0,
+                                   block->mJobBuffer, &block->mPackedSize,
+                                   block->mProps);
+  block->mPacked = block->mJobBuffer;
+}
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
+//-----------------------------------------------------------------------------
+// _ctmStreamJobBufferSize() - Get the size of the job buffer of a block of a
+// batch (see _ctmStreamEndBatch()), rounded up to the scratch arena
+// alignment. Returns zero if the block needs no job buffer.
+//-----------------------------------------------------------------------------
+static size_t _ctmStreamJobBufferSize(_CTMpackedblock * aBlock,
+  CTMint aWriting)
+{
+  size_t size;
+
+  if(aWriting)
+    size = _CTM_PACKED_SIZE(aBlock->mSize);
+  else if(!aBlock->mArray->mInterleaved)
+    size = aBlock->mSize ? aBlock->mSize : 1;
+  else
+    return 0;
+
+  return (size + (_CTM_ARENA_ALIGN - 1)) & ~((size_t) _CTM_ARENA_ALIGN - 1);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamBatchScratchSize() - Estimate the amount of scratch arena memory
+// that _ctmStreamEndBatch() uses for the job buffers of a batch: the
+// compressed data of every block when writing (aTotal is the size of all the
+// packed arrays, uncompressed), or the interleaved data of every array that
+// is stored as a single block when reading (aTotal is the size of those
+// arrays). Used by _ctmPlanSave() and _ctmPlanLoad() for sizing the arena.
+//-----------------------------------------------------------------------------
+size_t _ctmStreamBatchScratchSize(_CTMcontext * self, size_t aTotal,
+  CTMint aWriting)
+{
+  size_t blocks;
+
+  // Indices, vertices, grid indices, normals and maps, plus the extra blocks
+  // of the arrays that are split
+  blocks = 4 + self->mUVMapCount + self->mAttribMapCount +
+           aTotal / _CTM_PACKED_BLOCK_SIZE;
+
+  if(aWriting)
+    return _CTM_PACKED_SIZE(aTotal) + blocks * (1000 + _CTM_ARENA_ALIGN);
+  return aTotal + blocks * _CTM_ARENA_ALIGN;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamBeginBatch() - Start collecting packed arrays. Until
+// _ctmStreamEndBatch() is called, _ctmStreamReadPackedInts() and
+// _ctmStreamReadPackedFloats() only locate the packed data in the stream, and
+// the destination arrays are not filled out until the batch is ended. When
+// writing, the packed arrays are not compressed until the batch is ended,
+// and all other data that is written is kept until then too (so that
+// everything is written in the right order).
+//-----------------------------------------------------------------------------
+void _ctmStreamBeginBatch(_CTMcontext * self)
+{
+  self->mBatchActive = CTM_TRUE;
+  self->mBatchArrayCount = 0;
+  self->mBatchBlockCount = 0;
+  self->mBatchDataSize = 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamEndBatch() - Finish the current batch (if aFinish is true), and
+// stop collecting packed arrays. When reading, all the LZMA blocks of the
+// batch are uncompressed concurrently. When writing, they are compressed
+// concurrently, and then everything is written to the stream in the order it
+// was given (i.e. the output is the same as without a batch). The batch is
+// always released, also when aFinish is false (e.g. after a failed read).
+//-----------------------------------------------------------------------------
+int _ctmStreamEndBatch(_CTMcontext * self, CTMint aFinish)
+{
+  _CTMpackedarray * array;
+  _CTMpackedblock * block;
+  CTMint writing;
+  size_t pos, size, jobSize, mark;
+  unsigned char * buffer;
+  CTMuint i, j, b;
+  int ok = CTM_TRUE;
+
+  writing = (self->mMode == CTM_EXPORT) ? CTM_TRUE : CTM_FALSE;
+
+  // The array list will not move anymore, so link the blocks to their arrays
+  for(i = 0; i < self->mBatchBlockCount; ++ i)
+    self->mBatchBlocks[i].mArray =
+      &self->mBatchArrays[self->mBatchBlocks[i].mArrayIndex];
+
+  // Give each job a buffer of its own, carved from one region of the scratch
+  // arena (which is sized for it by _ctmPlanSave() and _ctmPlanLoad(), see
+  // _ctmStreamBatchScratchSize()), so that the jobs do not allocate them
+  mark = _ctmArenaMark(self);
+  if(aFinish && (self->mBatchBlockCount > 0))
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    size = 0;
+    for(i = 0; (i < self->mBatchBlockCount) && ok; ++ i)
+    {
+      jobSize = _ctmStreamJobBufferSize(&self->mBatchBlocks[i], writing);
+      if(jobSize > ((size_t) -1) - size)
+        ok = CTM_FALSE;
+      size += jobSize;
+    }
+    buffer = (unsigned char *) 0;
+    if(ok && (size > 0))
+    {
+      buffer = (unsigned char *) _ctmArenaAlloc(self, size);
+      if(!buffer)
+        ok = CTM_FALSE;
+    }
+    if(!ok)
+      self->mError = CTM_OUT_OF_MEMORY;
+    for(i = 0; (i < self->mBatchBlockCount) && buffer; ++ i)
+    {
+      jobSize = _ctmStreamJobBufferSize(&self->mBatchBlocks[i], writing);
+      if(jobSize > 0)
+      {
+        self->mBatchBlocks[i].mJobBuffer = buffer;
+        buffer += jobSize;
+      }
+    }
   }
 
-  // Convert floats to an interleaved array
-  for(i = 0; i < aCount; ++ i)
+  // Uncompress/compress the blocks
+  if(aFinish && ok && (self->mBatchBlockCount > 0))
+    _ctmRunJobs(self, writing ? _ctmStreamPackJob : _ctmStreamUnpackJob,
+                (void *) self->mBatchBlocks, sizeof(_CTMpackedblock),
+                self->mBatchBlockCount);
+
+  // Check for errors
+  for(i = 0; (i < self->mBatchBlockCount) && aFinish && ok; ++ i)
   {
-    for(k = 0; k < aSize; ++ k)
+    if(self->mBatchBlocks[i].mError != CTM_NONE)
     {
-      value.f = aData[i * aSize + k];
-      tmp[i + k * aCount + 3 * aCount * aSize] = value.i & 0x000000ff;
-      tmp[i + k * aCount + 2 * aCount * aSize] = (value.i >> 8) & 0x000000ff;
-      tmp[i + k * aCount + aCount * aSize] = (value.i >> 16) & 0x000000ff;
-      tmp[i + k * aCount] = (value.i >> 24) & 0x000000ff;
+      self->mError = self->mBatchBlocks[i].mError;
+      ok = CTM_FALSE;
     }
   }
 
-  // Allocate memory for the packed data
-  bufSize = 1000 + aCount * aSize * 4;
-  packed = (unsigned char *) malloc(bufSize);
-  if(!packed)
+  // Convert the arrays that were split into several blocks
+  if(!writing && aFinish && ok && (self->mBatchArrayCount > 0))
+    _ctmRunJobs(self, _ctmStreamDeinterleaveJob, (void *) self->mBatchArrays,
+                sizeof(_CTMpackedarray), self->mBatchArrayCount);
+
+  self->mBatchActive = CTM_FALSE;
+
+  // Write the collected data and the packed arrays to the stream
+  if(writing && aFinish && ok)
   {
-    free(tmp);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    pos = 0;
+    b = 0;
+    for(i = 0; i < self->mBatchArrayCount; ++ i)
+    {
+      array = &self->mBatchArrays[i];
+      if(array->mOffset > pos)
+        _ctmStreamWrite(self, (void *) &self->mBatchData[pos],
+                        array->mOffset - pos);
+      pos = array->mOffset;
+      if(self->mFormatVersion >= _CTM_FORMAT_VERSION)
+        _ctmStreamWriteUINT(self, array->mBlockCount);
+      for(j = 0; j < array->mBlockCount; ++ j)
+      {
+        block = &self->mBatchBlocks[b ++];
+        _ctmStreamWritePacked(self, block->mPacked, block->mPackedSize,
+                              block->mProps);
+      }
+    }
+    if(self->mBatchDataSize > pos)
+      _ctmStreamWrite(self, (void *) &self->mBatchData[pos],
+                      self->mBatchDataSize - pos);
   }
 
-  // Call LZMA to compress
-  outPropsSize = 5;
-  lzmaAlgo = (self->mCompressionLevel < 1 ? 0 : 1);
-  lzmaRes = LzmaCompress(packed,
-                         &bufSize,
-                         (const unsigned char *) tmp,
-                         aCount * aSize * 4,
-                         outProps,
-                         &outPropsSize,
-                         self->mCompressionLevel, // Level (0-9)
-                         0, -1, -1, -1, -1, -1,   // Default values (set by level)
-                         lzmaAlgo                 // Algorithm (0 = fast, 1 = normal)
-                        );
-
-  // Free temporary array
-  free(tmp);
+  // Free the job buffers, the packed data and the interleaved arrays
+  _ctmArenaRelease(self, mark);
+  for(i = 0; i < self->mBatchBlockCount; ++ i)
+  {
+    if(self->mBatchBlocks[i].mBuffer)
+      _ctmFree(self, self->mBatchBlocks[i].mBuffer);
+  }
+  for(i = 0; i < self->mBatchArrayCount; ++ i)
+  {
+    if(self->mBatchArrays[i].mInterleaved)
+      _ctmFree(self, self->mBatchArrays[i].mInterleaved);
+  }
+  self->mBatchArrayCount = 0;
+  self->mBatchBlockCount = 0;
 
-  // Error?
-  if(lzmaRes != SZ_OK)
+  // Free the collected data
+  if(self->mBatchData)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(packed);
+    _ctmFree(self, self->mBatchData);
+    self->mBatchData = (unsigned char *) 0;
+  }
+  self->mBatchDataSize = self->mBatchDataCapacity = 0;
+
+  return ok;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPacked() - Read a compressed binary data array from a
+// stream, and uncompress it. If aWidth is zero, the array is an integer array
+// (see _ctmDeinterleaveWords()), otherwise it is a float array that is stored
+// in rows of aWidth values that start aStride values apart in aData (see
+// _ctmDeinterleaveWordsStrided()).
+//-----------------------------------------------------------------------------
+static int _ctmStreamReadPacked(_CTMcontext * self, CTMuint * aData,
+  size_t aCount, CTMuint aSize, CTMint aSignedInts, CTMuint aWidth,
+  CTMuint aStride)
+{
+  _CTMpackedarray tmpArray, * array;
+  unsigned char * tmp;
+  size_t size, blockSize, start;
+  CTMuint blockCount, i;
+  int ok;
+
+  size = aCount * aSize * 4;
+
+  // Uncompress later?
+  if(self->mBatchActive)
+  {
+    array = _ctmStreamLocatePacked(self, size);
+    if(!array)
+      return CTM_FALSE;
+    array->mData = aData;
+    array->mCount = aCount;
+    array->mSize = aSize;
+    array->mSignedInts = aSignedInts;
+    array->mWidth = aWidth;
+    array->mStride = aStride;
+    return CTM_TRUE;
+  }
+
+  // The blocks of a format version 6 array can be uncompressed concurrently
+  if((self->mFormatVersion >= _CTM_FORMAT_VERSION) &&
+     (_ctmThreadCount(self) > 1))
+  {
+    _ctmStreamBeginBatch(self);
+    ok = _ctmStreamReadPacked(self, aData, aCount, aSize, aSignedInts, aWidth,
+                              aStride);
+    if(!_ctmStreamEndBatch(self, ok))
+      ok = CTM_FALSE;
+    return ok;
+  }
+
+  // Get a scratch buffer for the interleaved array
+  tmp = _ctmStreamGetScratch(self, size);
+  if(!tmp)
+    return CTM_FALSE;
+
+  // Read & uncompress the interleaved array, one block at a time
+  blockCount = _ctmStreamReadBlockCount(self, size);
+  if(!blockCount)
     return CTM_FALSE;
+  blockSize = _ctmBlockSize(size, blockCount);
+  for(i = 0; i < blockCount; ++ i)
+  {
+    start = i * blockSize;
+    if(!_ctmStreamReadLZMA(self, &tmp[start],
+                           (i < blockCount - 1) ? blockSize : size - start))
+      return CTM_FALSE;
   }
 
+  // Convert interleaved array to integers/floats (and signed magnitude to
+  // two's complement, if requested)
+  tmpArray.mData = aData;
+  tmpArray.mCount = aCount;
+  tmpArray.mSize = aSize;
+  tmpArray.mSignedInts = aSignedInts;
+  tmpArray.mWidth = aWidth;
+  tmpArray.mStride = aStride;
+  _ctmDeinterleaveArray(&tmpArray, tmp);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPackedInts() - Read an compressed binary integer data array
+// from a stream, and uncompress it.
+//-----------------------------------------------------------------------------
+int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
+  size_t aCount, CTMuint aSize, CTMint aSignedInts)
+{
+  return _ctmStreamReadPacked(self, (CTMuint *) aData, aCount, aSize,
+                              aSignedInts, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWritePackedInts() - Compress a binary integer data array, and
+// write it to a stream.
+//-----------------------------------------------------------------------------
+int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData,
+  size_t aCount, CTMuint aSize, CTMint aSignedInts)
+{
+  unsigned char * tmp;
+  size_t mark;
+  int ok;
 #ifdef __DEBUG_
-  printf("%d->%d bytes\n", aCount * aSize * 4, (int) bufSize);
+  size_t i, negCount = 0;
 #endif
 
-  // Write packed data size to the stream
-  _ctmStreamWriteUINT(self, (CTMuint) bufSize);
+  // Allocate memory for interleaved array
+  mark = _ctmArenaMark(self);
+  tmp = _ctmStreamNewInterleaved(self, aCount * aSize * 4);
+  if(!tmp)
+    return CTM_FALSE;
+
+  // Convert integers to an interleaved array (and two's complement to
+  // signed magnitude, if requested)
+  _ctmInterleaveWords((CTMuint *) aData, tmp, aCount, aSize, aSignedInts);
+#ifdef __DEBUG_
+  if(!aSignedInts)
+  {
+    for(i = 0; i < aCount * aSize; ++ i)
+      if(aData[i] < 0)
+        ++ negCount;
+  }
+  printf("(%d negative words) ", (int) negCount);
+#endif
 
-  // Write LZMA compression props to the stream
-  _ctmStreamWrite(self, (void *) outProps, 5);
+  // Compress the interleaved array, and write it to the stream
+  ok = _ctmStreamWriteLZMA(self, tmp, aCount, aSize);
 
-  // Write the packed data to the stream
-  _ctmStreamWrite(self, (void *) packed, (CTMuint) bufSize);
+  // Free temporary resources
+  _ctmArenaRelease(self, mark);
 
-  // Free the packed data
-  free(packed);
+  return ok;
+}
 
-  return CTM_TRUE;
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPackedFloats() - Read an compressed binary float data array
+// from a stream, and uncompress it. The floats are stored in rows of aWidth
+// values that start aStride values apart in aData (aStride = aWidth for a
+// tightly packed array, see _ctmDeinterleaveWordsStrided()).
+//-----------------------------------------------------------------------------
+int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData,
+  size_t aCount, CTMuint aSize, CTMuint aWidth, CTMuint aStride)
+{
+  return _ctmStreamReadPacked(self, (CTMuint *) aData, aCount, aSize,
+                              CTM_FALSE, aWidth, aStride);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWritePackedFloats() - Compress a binary float data array, and
+// write it to a stream.
+//-----------------------------------------------------------------------------
+int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData,
+  size_t aCount, CTMuint aSize)
+{
+  unsigned char * tmp;
+  size_t mark;
+  int ok;
+
+  // Allocate memory for interleaved array
+  mark = _ctmArenaMark(self);
+  tmp = _ctmStreamNewInterleaved(self, aCount * aSize * 4);
+  if(!tmp)
+    return CTM_FALSE;
+
+  // Convert floats to an interleaved array
+  _ctmInterleaveWords((CTMuint *) aData, tmp, aCount, aSize, CTM_FALSE);
+
+  // Compress the interleaved array, and write it to the stream
+  ok = _ctmStreamWriteLZMA(self, tmp, aCount, aSize);
+
+  // Free temporary resources
+  _ctmArenaRelease(self, mark);
+
+  return ok;
 }
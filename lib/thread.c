@@ -0,0 +1,516 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        thread.c
+// Description: Minimal portable thread support, used for running a number of
+//              independent jobs (e.g. uncompressing packed arrays)
+//              concurrently.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+// Select the thread implementation (define OPENCTM_NO_THREADS to build a
+// library that always runs in the calling thread)
+#if !defined(OPENCTM_NO_THREADS)
+  #if defined(_WIN32)
+    #define _CTM_WIN32_THREADS
+  #else
+    #define _CTM_POSIX_THREADS
+  #endif
+#endif
+
+#if defined(_CTM_WIN32_THREADS)
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#elif defined(_CTM_POSIX_THREADS)
+  // We need POSIX/BSD extensions for sysconf(_SC_NPROCESSORS_ONLN)
+  #define _DEFAULT_SOURCE
+  #define _BSD_SOURCE
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+
+#include <stdlib.h>
+#include "openctm.h"
+#include "internal.h"
+
+// Maximum number of threads that are used for one batch of jobs
+#define _CTM_MAX_THREADS 64
+
+
+//-----------------------------------------------------------------------------
+// _CTMjobqueue - A batch of jobs that is shared by the worker threads.
+//-----------------------------------------------------------------------------
+typedef struct {
+  _CTMjobfn mJobFn;
+  unsigned char * mJobs;
+  size_t mJobSize;
+  CTMuint mJobCount;
+#if defined(_CTM_WIN32_THREADS)
+  volatile LONG mNextJob;
+#else
+  CTMuint mNextJob;
+#endif
+#if defined(_CTM_POSIX_THREADS)
+  pthread_mutex_t mMutex;
+#endif
+} _CTMjobqueue;
+
+//-----------------------------------------------------------------------------
+// _ctmNextJob() - Claim the next job of a job queue. Returns false when all
+// jobs have been claimed.
+//-----------------------------------------------------------------------------
+static int _ctmNextJob(_CTMjobqueue * aQueue, CTMuint * aJob)
+{
+  CTMuint job;
+
+#if defined(_CTM_WIN32_THREADS)
+  job = (CTMuint) InterlockedIncrement(&aQueue->mNextJob) - 1;
+#elif defined(_CTM_POSIX_THREADS)
+  pthread_mutex_lock(&aQueue->mMutex);
+  job = aQueue->mNextJob;
+  if(job < aQueue->mJobCount)
+    ++ aQueue->mNextJob;
+  pthread_mutex_unlock(&aQueue->mMutex);
+#else
+  job = aQueue->mNextJob ++;
+#endif
+
+  if(job >= aQueue->mJobCount)
+    return CTM_FALSE;
+  *aJob = job;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmWorker() - Run jobs from a job queue until it is empty.
+//-----------------------------------------------------------------------------
+static void _ctmWorker(_CTMjobqueue * aQueue)
+{
+  CTMuint job;
+  while(_ctmNextJob(aQueue, &job))
+    aQueue->mJobFn((void *) &aQueue->mJobs[(size_t) job * aQueue->mJobSize]);
+}
+
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+//-----------------------------------------------------------------------------
+// _CTMthreads - The thread state of a context (mThreads). This includes a
+// pool of worker threads, which are started when they are first needed, and
+// then reused for all the job batches of the context until it is freed.
+//-----------------------------------------------------------------------------
+typedef struct {
+  // Lock for the memory accounting of the context (see _ctmMemoryLock())
+#if defined(_CTM_WIN32_THREADS)
+  CRITICAL_SECTION mMemoryLock;
+#else
+  pthread_mutex_t mMemoryLock;
+#endif
+
+  // Worker threads (the calling thread is not included)
+#if defined(_CTM_WIN32_THREADS)
+  HANDLE mWorkers[_CTM_MAX_THREADS];
+#else
+  pthread_t mWorkers[_CTM_MAX_THREADS];
+#endif
+  CTMuint mWorkerCount;
+
+  // The current job batch. Each worker that takes part in the batch takes one
+  // count from mStart, and mActive is the number of those workers that have
+  // not yet finished (the last one signals mDone).
+  _CTMjobqueue * mQueue;
+  CTMint mQuit;
+#if defined(_CTM_WIN32_THREADS)
+  volatile LONG mActive;
+  HANDLE mStart;  // Semaphore
+  HANDLE mDone;   // Auto-reset event
+#else
+  CTMuint mActive;
+  CTMuint mStart;
+  pthread_mutex_t mMutex;
+  pthread_cond_t mStartCond;
+  pthread_cond_t mDoneCond;
+#endif
+} _CTMthreads;
+
+//-----------------------------------------------------------------------------
+// _ctmPoolWorker() - Main loop of a worker thread: wait for a job batch, run
+// jobs from it until it is empty, and repeat until the pool is shut down.
+//-----------------------------------------------------------------------------
+static void _ctmPoolWorker(_CTMthreads * aThreads)
+{
+  _CTMjobqueue * queue;
+
+  for(;;)
+  {
+    // Wait for a job batch (or for the pool to be shut down)
+#if defined(_CTM_WIN32_THREADS)
+    WaitForSingleObject(aThreads->mStart, INFINITE);
+    if(aThreads->mQuit)
+      return;
+    queue = aThreads->mQueue;
+#else
+    pthread_mutex_lock(&aThreads->mMutex);
+    while(!aThreads->mStart && !aThreads->mQuit)
+      pthread_cond_wait(&aThreads->mStartCond, &aThreads->mMutex);
+    if(aThreads->mQuit)
+    {
+      pthread_mutex_unlock(&aThreads->mMutex);
+      return;
+    }
+    -- aThreads->mStart;
+    queue = aThreads->mQueue;
+    pthread_mutex_unlock(&aThreads->mMutex);
+#endif
+
+    _ctmWorker(queue);
+
+    // Tell the calling thread when the last worker is done
+#if defined(_CTM_WIN32_THREADS)
+    if(InterlockedDecrement(&aThreads->mActive) == 0)
+      SetEvent(aThreads->mDone);
+#else
+    pthread_mutex_lock(&aThreads->mMutex);
+    if(-- aThreads->mActive == 0)
+      pthread_cond_signal(&aThreads->mDoneCond);
+    pthread_mutex_unlock(&aThreads->mMutex);
+#endif
+  }
+}
+
+#if defined(_CTM_WIN32_THREADS)
+static DWORD WINAPI _ctmThreadMain(LPVOID aThreads)
+{
+  _ctmPoolWorker((_CTMthreads *) aThreads);
+  return 0;
+}
+#else
+static void * _ctmThreadMain(void * aThreads)
+{
+  _ctmPoolWorker((_CTMthreads *) aThreads);
+  return (void *) 0;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// _ctmGetThreads() - Get the thread state of a context, creating it if
+// necessary (without any worker threads). Returns a null pointer if it could
+// not be created. This must be called from the calling thread of the context,
+// while no jobs are running.
+//-----------------------------------------------------------------------------
+static _CTMthreads * _ctmGetThreads(_CTMcontext * self)
+{
+  _CTMthreads * threads;
+
+  if(self->mThreads)
+    return (_CTMthreads *) self->mThreads;
+
+  // The thread state is not counted as allocated memory (like the context)
+  threads = (_CTMthreads *) malloc(sizeof(_CTMthreads));
+  if(!threads)
+    return (_CTMthreads *) 0;
+  threads->mWorkerCount = 0;
+  threads->mQueue = (_CTMjobqueue *) 0;
+  threads->mQuit = CTM_FALSE;
+  threads->mActive = 0;
+#if defined(_CTM_WIN32_THREADS)
+  threads->mStart = CreateSemaphore(NULL, 0, _CTM_MAX_THREADS, NULL);
+  threads->mDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if(!threads->mStart || !threads->mDone)
+  {
+    if(threads->mStart)
+      CloseHandle(threads->mStart);
+    if(threads->mDone)
+      CloseHandle(threads->mDone);
+    free(threads);
+    return (_CTMthreads *) 0;
+  }
+  InitializeCriticalSection(&threads->mMemoryLock);
+#else
+  threads->mStart = 0;
+  if(pthread_mutex_init(&threads->mMemoryLock, NULL) != 0)
+  {
+    free(threads);
+    return (_CTMthreads *) 0;
+  }
+  if(pthread_mutex_init(&threads->mMutex, NULL) != 0)
+  {
+    pthread_mutex_destroy(&threads->mMemoryLock);
+    free(threads);
+    return (_CTMthreads *) 0;
+  }
+  if(pthread_cond_init(&threads->mStartCond, NULL) != 0)
+  {
+    pthread_mutex_destroy(&threads->mMutex);
+    pthread_mutex_destroy(&threads->mMemoryLock);
+    free(threads);
+    return (_CTMthreads *) 0;
+  }
+  if(pthread_cond_init(&threads->mDoneCond, NULL) != 0)
+  {
+    pthread_cond_destroy(&threads->mStartCond);
+    pthread_mutex_destroy(&threads->mMutex);
+    pthread_mutex_destroy(&threads->mMemoryLock);
+    free(threads);
+    return (_CTMthreads *) 0;
+  }
+#endif
+
+  self->mThreads = (void *) threads;
+  return threads;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStartWorkers() - Make sure that the pool has (at least) aCount worker
+// threads. Returns the number of worker threads in the pool, which is less
+// than aCount if a thread could not be started.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmStartWorkers(_CTMthreads * aThreads, CTMuint aCount)
+{
+  while(aThreads->mWorkerCount < aCount)
+  {
+#if defined(_CTM_WIN32_THREADS)
+    HANDLE thread = CreateThread(NULL, 0, _ctmThreadMain, (LPVOID) aThreads,
+                                 0, NULL);
+    if(!thread)
+      break;
+    aThreads->mWorkers[aThreads->mWorkerCount] = thread;
+#else
+    if(pthread_create(&aThreads->mWorkers[aThreads->mWorkerCount], NULL,
+                      _ctmThreadMain, (void *) aThreads) != 0)
+      break;
+#endif
+    ++ aThreads->mWorkerCount;
+  }
+  return aThreads->mWorkerCount;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// _ctmFreeThreads() - Free the thread state of a context (this stops the
+// worker threads).
+//-----------------------------------------------------------------------------
+void _ctmFreeThreads(_CTMcontext * self)
+{
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  _CTMthreads * threads = (_CTMthreads *) self->mThreads;
+  CTMuint i;
+
+  if(!threads)
+    return;
+
+  // Stop the worker threads
+#if defined(_CTM_WIN32_THREADS)
+  threads->mQuit = CTM_TRUE;
+  if(threads->mWorkerCount > 0)
+    ReleaseSemaphore(threads->mStart, (LONG) threads->mWorkerCount, NULL);
+  for(i = 0; i < threads->mWorkerCount; ++ i)
+  {
+    WaitForSingleObject(threads->mWorkers[i], INFINITE);
+    CloseHandle(threads->mWorkers[i]);
+  }
+  CloseHandle(threads->mStart);
+  CloseHandle(threads->mDone);
+  DeleteCriticalSection(&threads->mMemoryLock);
+#else
+  pthread_mutex_lock(&threads->mMutex);
+  threads->mQuit = CTM_TRUE;
+  pthread_cond_broadcast(&threads->mStartCond);
+  pthread_mutex_unlock(&threads->mMutex);
+  for(i = 0; i < threads->mWorkerCount; ++ i)
+    pthread_join(threads->mWorkers[i], NULL);
+  pthread_cond_destroy(&threads->mDoneCond);
+  pthread_cond_destroy(&threads->mStartCond);
+  pthread_mutex_destroy(&threads->mMutex);
+  pthread_mutex_destroy(&threads->mMemoryLock);
+#endif
+  free(threads);
+  self->mThreads = (void *) 0;
+#else
+  (void) self;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMemoryLock() / _ctmMemoryUnlock() - Protect the memory accounting of a
+// context (see alloc.c), which is also updated from the worker threads. Each
+// context has its own lock, and it is only taken while worker threads are
+// running jobs for the context.
+//-----------------------------------------------------------------------------
+void _ctmMemoryLock(_CTMcontext * self)
+{
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  _CTMthreads * threads = (_CTMthreads *) self->mThreads;
+
+  if(!self->mJobsRunning)
+    return;
+#if defined(_CTM_WIN32_THREADS)
+  EnterCriticalSection(&threads->mMemoryLock);
+#else
+  pthread_mutex_lock(&threads->mMemoryLock);
+#endif
+#else
+  (void) self;
+#endif
+}
+
+void _ctmMemoryUnlock(_CTMcontext * self)
+{
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  _CTMthreads * threads = (_CTMthreads *) self->mThreads;
+
+  if(!self->mJobsRunning)
+    return;
+#if defined(_CTM_WIN32_THREADS)
+  LeaveCriticalSection(&threads->mMemoryLock);
+#else
+  pthread_mutex_unlock(&threads->mMemoryLock);
+#endif
+#else
+  (void) self;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmProcessorCount() - Get the number of processors in the system.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmProcessorCount(void)
+{
+#if defined(_CTM_WIN32_THREADS)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (CTMuint) info.dwNumberOfProcessors : 1;
+#elif defined(_CTM_POSIX_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (CTMuint) count : 1;
+#else
+  return 1;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmThreadCount() - Get the number of threads to use (see ctmThreadCount()).
+// In low memory mode (see ctmMemoryLimit()), everything is done in the
+// calling thread, so that only one packed array is in memory at a time.
+//-----------------------------------------------------------------------------
+CTMuint _ctmThreadCount(_CTMcontext * self)
+{
+  CTMuint count;
+
+  if(self->mLowMemory)
+    return 1;
+  count = self->mThreadCount ? self->mThreadCount : _ctmProcessorCount();
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  if(count > _CTM_MAX_THREADS)
+    count = _CTM_MAX_THREADS;
+#else
+  count = 1;
+#endif
+
+  return count;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRunJobs() - Run aJobFn for each of the aJobCount jobs in the aJobs array
+// (aJobSize bytes per job). The jobs are spread over up to _ctmThreadCount()
+// threads, including the calling thread, and the function returns when all
+// jobs are done. The other threads are taken from the worker pool of the
+// context. If the pool can not be created (or grown), the jobs are simply run
+// by fewer threads.
+//-----------------------------------------------------------------------------
+void _ctmRunJobs(_CTMcontext * self, _CTMjobfn aJobFn, void * aJobs,
+  size_t aJobSize, CTMuint aJobCount)
+{
+  _CTMjobqueue queue;
+  CTMuint threadCount;
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  _CTMthreads * threads = (_CTMthreads *) 0;
+  CTMuint workers = 0;
+#endif
+
+  queue.mJobFn = aJobFn;
+  queue.mJobs = (unsigned char *) aJobs;
+  queue.mJobSize = aJobSize;
+  queue.mJobCount = aJobCount;
+  queue.mNextJob = 0;
+
+  // Never use more threads than there are jobs
+  threadCount = _ctmThreadCount(self);
+  if(threadCount > aJobCount)
+    threadCount = aJobCount;
+
+  // Get the worker threads (the calling thread is one of the workers)
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  if(threadCount > 1)
+    threads = _ctmGetThreads(self);
+  if(threads)
+  {
+    workers = _ctmStartWorkers(threads, threadCount - 1);
+    if(workers > threadCount - 1)
+      workers = threadCount - 1;
+  }
+  self->mJobsRunning = (workers > 0) ? CTM_TRUE : CTM_FALSE;
+#endif
+#if defined(_CTM_POSIX_THREADS)
+  pthread_mutex_init(&queue.mMutex, NULL);
+#endif
+
+  // Hand the job batch to the worker threads
+#if defined(_CTM_WIN32_THREADS)
+  if(workers > 0)
+  {
+    threads->mQueue = &queue;
+    threads->mActive = (LONG) workers;
+    ReleaseSemaphore(threads->mStart, (LONG) workers, NULL);
+  }
+#elif defined(_CTM_POSIX_THREADS)
+  if(workers > 0)
+  {
+    pthread_mutex_lock(&threads->mMutex);
+    threads->mQueue = &queue;
+    threads->mActive = workers;
+    threads->mStart = workers;
+    pthread_cond_broadcast(&threads->mStartCond);
+    pthread_mutex_unlock(&threads->mMutex);
+  }
+#endif
+
+  // Do our share of the work
+  _ctmWorker(&queue);
+
+  // Wait for the worker threads to finish
+#if defined(_CTM_WIN32_THREADS)
+  if(workers > 0)
+    WaitForSingleObject(threads->mDone, INFINITE);
+#elif defined(_CTM_POSIX_THREADS)
+  if(workers > 0)
+  {
+    pthread_mutex_lock(&threads->mMutex);
+    while(threads->mActive > 0)
+      pthread_cond_wait(&threads->mDoneCond, &threads->mMutex);
+    threads->mQueue = (_CTMjobqueue *) 0;
+    pthread_mutex_unlock(&threads->mMutex);
+  }
+  pthread_mutex_destroy(&queue.mMutex);
+#endif
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  self->mJobsRunning = CTM_FALSE;
+#endif
+}
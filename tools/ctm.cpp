@@ -41,6 +41,33 @@ void Import_CTM(const char * aFileName, Mesh * aMesh)
   // Load the file using the OpenCTM API
   CTMimporter ctm;
 
+  // Read the header first, so that the mesh arrays can be sized and the
+  // arrays can be loaded straight into them
+  ctm.LoadHeader(aFileName);
+  CTMuint numVertices = ctm.GetInteger(CTM_VERTEX_COUNT);
+  aMesh->mVertices.resize(numVertices);
+  ctm.LoadDestination(CTM_VERTICES, &aMesh->mVertices[0],
+                      numVertices * sizeof(Vector3), sizeof(Vector3), 0);
+  if(ctm.GetInteger(CTM_HAS_NORMALS) == CTM_TRUE)
+  {
+    aMesh->mNormals.resize(numVertices);
+    ctm.LoadDestination(CTM_NORMALS, &aMesh->mNormals[0],
+                        numVertices * sizeof(Vector3), sizeof(Vector3), 0);
+  }
+  if(ctm.GetInteger(CTM_UV_MAP_COUNT) > 0)
+  {
+    aMesh->mTexCoords.resize(numVertices);
+    ctm.LoadDestination(CTM_UV_MAP_1, &aMesh->mTexCoords[0],
+                        numVertices * sizeof(Vector2), sizeof(Vector2), 0);
+  }
+  CTMenum colorAttrib = ctm.GetNamedAttribMap("Color");
+  if(colorAttrib != CTM_NONE)
+  {
+    aMesh->mColors.resize(numVertices);
+    ctm.LoadDestination(colorAttrib, &aMesh->mColors[0],
+                        numVertices * sizeof(Vector4), sizeof(Vector4), 0);
+  }
+
   // Load the file
   ctm.Load(aFileName);
 
@@ -56,61 +83,16 @@ void Import_CTM(const char * aFileName, Mesh * aMesh)
   for(CTMuint i = 0; i < numTriangles * 3; ++ i)
     aMesh->mIndices[i] = indices[i];
 
-  // Extract vertices
-  CTMuint numVertices = ctm.GetInteger(CTM_VERTEX_COUNT);
-  aMesh->mVertices.resize(numVertices);
-  const CTMfloat * vertices = ctm.GetFloatArray(CTM_VERTICES);
-  for(CTMuint i = 0; i < numVertices; ++ i)
-  {
-    aMesh->mVertices[i].x = vertices[i * 3];
-    aMesh->mVertices[i].y = vertices[i * 3 + 1];
-    aMesh->mVertices[i].z = vertices[i * 3 + 2];
-  }
-
-  // Extract normals
-  if(ctm.GetInteger(CTM_HAS_NORMALS) == CTM_TRUE)
-  {
-    aMesh->mNormals.resize(numVertices);
-    const CTMfloat * normals = ctm.GetFloatArray(CTM_NORMALS);
-    for(CTMuint i = 0; i < numVertices; ++ i)
-    {
-      aMesh->mNormals[i].x = normals[i * 3];
-      aMesh->mNormals[i].y = normals[i * 3 + 1];
-      aMesh->mNormals[i].z = normals[i * 3 + 2];
-    }
-  }
-
-  // Extract texture coordinates
+  // Extract texture file name (the vertices, normals, texture coordinates and
+  // colors have already been loaded into the mesh)
   if(ctm.GetInteger(CTM_UV_MAP_COUNT) > 0)
   {
-    aMesh->mTexCoords.resize(numVertices);
-    const CTMfloat * texCoords = ctm.GetFloatArray(CTM_UV_MAP_1);
-    for(CTMuint i = 0; i < numVertices; ++ i)
-    {
-      aMesh->mTexCoords[i].u = texCoords[i * 2];
-      aMesh->mTexCoords[i].v = texCoords[i * 2 + 1];
-    }
     const char * str = ctm.GetUVMapString(CTM_UV_MAP_1, CTM_FILE_NAME);
     if(str)
       aMesh->mTexFileName = string(str);
     else
       aMesh->mTexFileName = string("");
   }
-
-  // Extract colors
-  CTMenum colorAttrib = ctm.GetNamedAttribMap("Color");
-  if(colorAttrib != CTM_NONE)
-  {
-    aMesh->mColors.resize(numVertices);
-    const CTMfloat * colors = ctm.GetFloatArray(colorAttrib);
-    for(CTMuint i = 0; i < numVertices; ++ i)
-    {
-      aMesh->mColors[i].x = colors[i * 4];
-      aMesh->mColors[i].y = colors[i * 4 + 1];
-      aMesh->mColors[i].z = colors[i * 4 + 2];
-      aMesh->mColors[i].w = colors[i * 4 + 3];
-    }
-  }
 }
 
 /// Export an OpenCTM file to a file.